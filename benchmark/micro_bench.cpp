@@ -0,0 +1,202 @@
+/**
+ * micro_bench：一次 RPC 调用经过的各个热点步骤的微基准，不需要启动 RPCProvider 和 zookeeper
+ *
+ *   BM_PackRequest        RPCChannel::PackRequest（RPCCodec::EncodeRequest）：序列化请求、构造 RpcHeader、分块拼接请求帧
+ *   BM_ParseRequestFrame  RPCProvider::OnMessage：从 Buffer 里切出一帧请求并解析 RpcHeader
+ *   BM_PackBinaryRequest / BM_ParseBinaryRequestFrame  同上，使用二进制头部（requestHeader = binary）
+ *   BM_DecodeRequest      切帧之后再把参数反序列化成请求对象（Dispatch 里的 ParseFromChunks）
+ *   BM_EncodeResponse     RPCProvider::SendRpcResponse（RPCCodec::EncodeResponse）：response 和 RPCResponseWrapper 两次序列化，分块加长度前缀
+ *   BM_PoolGetReturn      RPCConnectionsPool::GetConnection/ReturnConnection 在多线程竞争下的开销
+ *
+ * 负载大小从 16B 到 1MB。用法：micro_bench [--benchmark_filter=...]，其余参数见 Google Benchmark
+ */
+#include "RPCCodec.h"
+#include "RPCChunk.h"
+#include "RPCConnectionsPool.h"
+#include "Buffer.h"
+#include "bench.pb.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// 和 RPCChannel::PackRequest 一样调用 RPCCodec::EncodeRequest，binary 对应配置项 requestHeader = binary
+static bool PackEcho(const RPCBench::EchoRequest& request, std::string* sendStr, bool binary = false)
+{
+    static const google::protobuf::MethodDescriptor* pMethod = RPCBench::EchoServiceRpc::descriptor()->FindMethodByName("Echo");
+
+    RPCRequestHeader header;
+    header.m_serviceName = static_cast<std::string>(pMethod->service()->name());
+    header.m_methodName = static_cast<std::string>(pMethod->name());
+
+    sendStr->clear();
+    return RPCCodec::EncodeRequest(header, request, binary, RPCChunk::GetChunkSize(), RPCChunk::GetMaxMessageSize(), sendStr) == RPCCodec::kEncodeOk;
+}
+
+static RPCBench::EchoRequest MakeRequest(size_t payload)
+{
+    RPCBench::EchoRequest request;
+    request.set_payload(std::string(payload, 'x'));
+    return request;
+}
+
+static void BM_PackRequest(benchmark::State& state)
+{
+    RPCBench::EchoRequest request = MakeRequest(state.range(0));
+    std::string sendStr;
+    for (auto _ : state)
+    {
+        PackEcho(request, &sendStr);
+        benchmark::DoNotOptimize(sendStr.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PackRequest)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+static void BM_PackBinaryRequest(benchmark::State& state)
+{
+    RPCBench::EchoRequest request = MakeRequest(state.range(0));
+    std::string sendStr;
+    for (auto _ : state)
+    {
+        PackEcho(request, &sendStr, true);
+        benchmark::DoNotOptimize(sendStr.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PackBinaryRequest)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+// 从缓冲区里反复切出 frame 里的请求帧
+static void ParseFrames(benchmark::State& state, const std::string& frame)
+{
+    Buffer buffer;
+    RPCRequestHeader header;
+    std::string argv;
+    for (auto _ : state)
+    {
+        buffer.append(frame.data(), frame.size()); // 模拟 I/O 线程把收到的数据写入缓冲区
+        while (RPCCodec::ParseRequestFrame(&buffer, &header, &argv) == RPCCodec::kFrameOk)
+        {
+            benchmark::DoNotOptimize(argv.data());
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+static void BM_ParseRequestFrame(benchmark::State& state)
+{
+    std::string frame;
+    PackEcho(MakeRequest(state.range(0)), &frame);
+    ParseFrames(state, frame);
+}
+BENCHMARK(BM_ParseRequestFrame)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+static void BM_ParseBinaryRequestFrame(benchmark::State& state)
+{
+    std::string frame;
+    PackEcho(MakeRequest(state.range(0)), &frame, true);
+    ParseFrames(state, frame);
+}
+BENCHMARK(BM_ParseBinaryRequestFrame)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+static void BM_DecodeRequest(benchmark::State& state)
+{
+    std::string frame;
+    PackEcho(MakeRequest(state.range(0)), &frame);
+
+    Buffer buffer;
+    RPCRequestHeader header;
+    std::vector<std::string> argvChunks;
+    std::string argv;
+    RPCBench::EchoRequest request;
+    for (auto _ : state)
+    {
+        buffer.append(frame.data(), frame.size());
+        argvChunks.clear();
+        do // 大于分块大小的请求由多帧组成，收齐之后再解析
+        {
+            if (RPCCodec::ParseRequestFrame(&buffer, &header, &argv) != RPCCodec::kFrameOk)
+            {
+                break;
+            }
+            argvChunks.emplace_back(std::move(argv));
+        } while (header.m_moreChunks);
+
+        if (argvChunks.empty() || !RPCChunk::ParseFromChunks(argvChunks, &request))
+        {
+            state.SkipWithError("decode failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_DecodeRequest)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+static void BM_EncodeResponse(benchmark::State& state)
+{
+    RPCBench::EchoResponse response;
+    response.set_payload(std::string(state.range(0), 'x'));
+
+    std::string frames;
+    for (auto _ : state)
+    {
+        frames.clear();
+        RPCCodec::EncodeResponse(response, 0, false, RPCChunk::GetChunkSize(), &frames);
+        benchmark::DoNotOptimize(frames.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeResponse)->RangeMultiplier(16)->Range(16, 1 << 20);
+
+// 在本地监听一个端口，内核完成三次握手之后连接就放在全连接队列里，不需要 accept
+static uint16_t ListenPort()
+{
+    static uint16_t port = []()
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0; // 由内核分配端口
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, 1024) != 0 ||
+            ::getsockname(fd, (struct sockaddr*)&addr, &len) != 0)
+        {
+            std::abort();
+        }
+        return ntohs(addr.sin_port);
+    }();
+    return port;
+}
+
+static void BM_PoolGetReturn(benchmark::State& state)
+{
+    static std::once_flag once;
+    std::call_once(once, []()
+    {
+        RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+        pPool->SetHeartbeatInterval(0); // 监听端口不会回复心跳
+        pPool->SetMaxConnectionsPerHost(64);
+        pPool->Prewarm("127.0.0.1", ListenPort(), 64);
+    });
+
+    RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+    for (auto _ : state)
+    {
+        auto pConn = pPool->GetConnection("127.0.0.1", ListenPort());
+        if (pConn == nullptr)
+        {
+            state.SkipWithError("no connection");
+            break;
+        }
+        pPool->ReturnConnection(std::move(pConn));
+    }
+}
+BENCHMARK(BM_PoolGetReturn)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
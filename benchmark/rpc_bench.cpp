@@ -0,0 +1,299 @@
+/**
+ * rpc_bench：MyRPC 的端到端压测工具
+ *
+ * 默认在进程内启动一个 RPCProvider，使用进程内的静态注册中心（registry = static，不依赖 zookeeper），
+ * 客户端和正式环境一样经过注册中心查找地址，一台机器上就能对比每次改动前后的吞吐和延迟。
+ * 也可以用 --target 直连压测已经部署好的 RPCProvider。
+ *
+ * 两种压测模式：
+ *   closed：每个并发线程收到响应后立即发起下一次调用，衡量的是最大吞吐，延迟是服务时间
+ *   open  ：按照固定速率 --rate 发起调用，延迟从“计划发起时间”开始计算。服务端变慢时后续请求
+ *           的排队时间也会计入延迟，避免协调遗漏（coordinated omission）让尾延迟看起来偏低
+ *
+ * 用法：rpc_bench [--mode=closed|open] [--concurrency=8] [--rate=10000] [--duration=10]
+ *                 [--warmup=2] [--payload=64] [--method=Echo|Sink] [--port=60100]
+ *                 [--target=ip:port] [--config=file]
+ */
+#include "RPCApplication.h"
+#include "RPCProvider.h"
+#include "RPCChannel.h"
+#include "RPCController.h"
+#include "RPCConnectionsPool.h"
+#include "bench.pb.h"
+#include "RPCHistogram.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+using Clock = std::chrono::steady_clock;
+
+// 压测参数
+struct BenchOptions
+{
+    std::string mode = "closed";
+    int concurrency = 8;
+    double rate = 10000;   // open 模式下所有线程合计的 QPS
+    int duration = 10;     // 统计时长（秒）
+    int warmup = 2;        // 预热时长（秒），预热期间的样本不统计
+    size_t payload = 64;   // 请求负载字节数
+    std::string method = "Echo";
+    uint16_t port = 60100; // 进程内 RPCProvider 的端口
+    std::string target;    // 压测外部的 RPCProvider，为空时在进程内启动
+    std::string config;    // 使用指定的配置文件，为空时生成临时配置文件
+};
+
+// 每个压测线程的统计结果
+struct WorkerResult
+{
+    RPCHistogram histogram;
+    uint64_t errors = 0;
+};
+
+// 压测用的服务实现
+class EchoService final : public RPCBench::EchoServiceRpc
+{
+public:
+    void Echo(google::protobuf::RpcController *controller,
+              const RPCBench::EchoRequest *request,
+              RPCBench::EchoResponse *response,
+              google::protobuf::Closure *done) override
+    {
+        response->set_payload(request->payload());
+        done->Run();
+    }
+
+    void Sink(google::protobuf::RpcController *controller,
+              const RPCBench::EchoRequest *request,
+              RPCBench::EchoResponse *response,
+              google::protobuf::Closure *done) override
+    {
+        done->Run();
+    }
+};
+
+static void PrintUsage(const char* prog)
+{
+    std::cout << "用法: " << prog << " [--mode=closed|open] [--concurrency=N] [--rate=QPS] [--duration=S]"
+              << " [--warmup=S] [--payload=BYTES] [--method=Echo|Sink] [--port=PORT]"
+              << " [--target=ip:port] [--config=file]" << std::endl;
+}
+
+// 解析 --key=value 形式的命令行参数
+static bool ParseArgs(int argc, char** argv, BenchOptions* opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg(argv[i]);
+        size_t pos = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || pos == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string key = arg.substr(2, pos - 2);
+        std::string value = arg.substr(pos + 1);
+        if (key == "mode") opts->mode = value;
+        else if (key == "concurrency") opts->concurrency = std::stoi(value);
+        else if (key == "rate") opts->rate = std::stod(value);
+        else if (key == "duration") opts->duration = std::stoi(value);
+        else if (key == "warmup") opts->warmup = std::stoi(value);
+        else if (key == "payload") opts->payload = std::stoul(value);
+        else if (key == "method") opts->method = value;
+        else if (key == "port") opts->port = std::stoi(value);
+        else if (key == "target") opts->target = value;
+        else if (key == "config") opts->config = value;
+        else return false;
+    }
+
+    return (opts->mode == "closed" || opts->mode == "open") &&
+           (opts->method == "Echo" || opts->method == "Sink") &&
+           opts->concurrency > 0 && opts->rate > 0 && opts->duration > 0;
+}
+
+// 生成临时配置文件：进程内 RPCProvider 监听本地地址，服务发布到进程内的静态注册中心
+static std::string WriteTempConfig(const BenchOptions& opts)
+{
+    std::string path = "/tmp/rpc_bench_" + std::to_string(getpid()) + ".conf";
+    std::ofstream out(path);
+    out << "rpcAddr = 127.0.0.1\n"
+        << "rpcPort = " << opts.port << "\n"
+        << "registry = static\n";
+    return path;
+}
+
+// 等待 ip:port 开始监听
+static bool WaitForListen(const std::string& ip, uint16_t port, int timeoutMs)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (Clock::now() < deadline)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip.data(), &addr.sin_addr.s_addr);
+        int ret = ::connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        ::close(fd);
+        if (ret == 0)
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return false;
+}
+
+// 单个压测线程
+static void RunWorker(const BenchOptions& opts, const std::string& endpoint, int index,
+                      Clock::time_point measureStart, Clock::time_point deadline, WorkerResult* result)
+{
+    RPCChannel channel(endpoint); // endpoint 为空时通过注册中心查找
+    RPCBench::EchoServiceRpc_Stub stub(&channel);
+
+    RPCBench::EchoRequest request;
+    request.set_payload(std::string(opts.payload, 'x'));
+    RPCBench::EchoResponse response;
+    RPCController controller;
+
+    bool open = (opts.mode == "open");
+    // open 模式下每个线程负责 rate / concurrency 的速率，各线程的发起时间错开
+    auto interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * opts.concurrency / opts.rate));
+    auto intended = Clock::now() + interval * index / opts.concurrency;
+
+    while (true)
+    {
+        Clock::time_point start;
+        if (open)
+        {
+            std::this_thread::sleep_until(intended);
+            start = intended; // 从计划发起时间开始计算延迟
+            intended += interval;
+        }
+        else
+        {
+            start = Clock::now();
+        }
+
+        if (start >= deadline)
+        {
+            break;
+        }
+
+        controller.Reset();
+        response.Clear();
+        if (opts.method == "Echo")
+        {
+            stub.Echo(&controller, &request, &response, nullptr);
+        }
+        else
+        {
+            stub.Sink(&controller, &request, &response, nullptr);
+        }
+        auto end = Clock::now();
+
+        if (start < measureStart) // 预热期间的样本不统计
+        {
+            continue;
+        }
+
+        if (controller.Failed())
+        {
+            ++result->errors;
+        }
+        else
+        {
+            result->histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions opts;
+    if (!ParseArgs(argc, argv, &opts))
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // 初始化 rpc 框架
+    std::string configFile = opts.config.empty() ? WriteTempConfig(opts) : opts.config;
+    std::string flag("-i");
+    char* initArgv[] = {argv[0], &flag[0], &configFile[0], nullptr};
+    RPCApplication::Init(3, initArgv);
+
+    // 没有指定 --target 时，在进程内启动 RPCProvider，客户端通过注册中心查找它的地址（endpoint 为空）
+    std::string endpoint = opts.target;
+    static EchoService echoService;
+    static RPCProvider provider;
+    if (endpoint.empty())
+    {
+        provider.NotifyService(&echoService);
+        std::thread([]() { provider.Run(); }).detach(); // Run() 会一直阻塞，压测结束时随进程退出
+
+        if (!WaitForListen("127.0.0.1", opts.port, 5000))
+        {
+            std::cout << "in-process provider failed to listen on 127.0.0.1:" << opts.port << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // 每个并发线程至少需要一条连接
+    RPCConnectionsPool::GetInstance()->SetMaxConnectionsPerHost(std::max(10, opts.concurrency));
+
+    std::cout << "rpc_bench: mode=" << opts.mode << " method=" << opts.method
+              << " concurrency=" << opts.concurrency << " payload=" << opts.payload << "B"
+              << (opts.mode == "open" ? " rate=" + std::to_string(static_cast<int64_t>(opts.rate)) : std::string())
+              << " target=" << (endpoint.empty() ? "in-process(127.0.0.1:" + std::to_string(opts.port) + ")" : endpoint) << std::endl;
+
+    auto measureStart = Clock::now() + std::chrono::seconds(opts.warmup);
+    auto deadline = measureStart + std::chrono::seconds(opts.duration);
+
+    std::vector<WorkerResult> results(opts.concurrency);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < opts.concurrency; ++i)
+    {
+        workers.emplace_back(RunWorker, std::cref(opts), std::cref(endpoint), i, measureStart, deadline, &results[i]);
+    }
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+
+    // 合并所有线程的直方图
+    RPCHistogram total;
+    uint64_t errors = 0;
+    for (const auto& r : results)
+    {
+        total.Merge(r.histogram);
+        errors += r.errors;
+    }
+
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::cout << std::fixed << std::setprecision(1)
+              << "requests: " << total.Count() << "  errors: " << errors
+              << "  qps: " << total.Count() / static_cast<double>(opts.duration) << std::endl
+              << "latency(us): mean=" << us(static_cast<uint64_t>(total.Mean()))
+              << " p50=" << us(total.Percentile(0.50))
+              << " p90=" << us(total.Percentile(0.90))
+              << " p99=" << us(total.Percentile(0.99))
+              << " p999=" << us(total.Percentile(0.999))
+              << " max=" << us(total.Max()) << std::endl;
+
+    if (opts.config.empty())
+    {
+        ::unlink(configFile.c_str());
+    }
+
+    // 进程内的 RPCProvider 没有停止接口，直接退出进程
+    std::_Exit(errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
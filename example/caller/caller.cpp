@@ -4,11 +4,21 @@
 #include "friend.pb.h"
 #include "RPCChannel.h"
 #include "RPCController.h"
+#include "RPCStats.h"
+#include "Stats.pb.h"
 #include <memory>
 
 int main(int argc, char **argv)
 {
     RPCApplication::Init(argc, argv); // 初始化 rpc 框架
+
+    // 等待启动时的连接预热完成，第一批调用不再需要查询 zookeeper 和建立连接
+    std::shared_future<RPCWarmUpResult> warmUp = RPCApplication::GetWarmUpFuture();
+    if (warmUp.valid())
+    {
+        const RPCWarmUpResult& result = warmUp.get();
+        std::cout << "warm up: " << result.m_connections << " connections in " << result.m_elapsedMs << "ms" << std::endl;
+    }
     std::unique_ptr<RPCChannel> pChannel = std::make_unique<RPCChannel>(); // 创建 Channel
     RPCTest::UserServiceRpc_Stub stub(pChannel.get()); // 创建 RPC 框架的客户端部分 stub
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -114,5 +124,58 @@ int main(int argc, char **argv)
         }   
     }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // 以服务端流式调用的方式获取好友列表，每次只在内存里保留一个好友
+    const google::protobuf::MethodDescriptor* pGflMethod = RPCTest::FriendServiceRpc::descriptor()->FindMethodByName("GetFriendList");
+    RPCController streamController;
+    std::unique_ptr<RPCStreamReader> pReader = pFriendServiceChannel->CallStream(pGflMethod, &streamController, &gflRequest);
+    if (pReader)
+    {
+        RPCTest::GetFriendListResponse chunk;
+        int index = 0;
+        while (pReader->Read(&chunk))
+        {
+            for (int i = 0; i < chunk.userinfo_size(); ++i)
+            {
+                std::cout << "stream index" << ++index << " "
+                << chunk.userinfo(i).name() << " "
+                << chunk.userinfo(i).sex() << " "
+                << chunk.userinfo(i).age() << std::endl;
+            }
+        }
+
+        RPCTest::GetFriendListResponse trailer;
+        if (pReader->Finish(&trailer) && 0 == trailer.result().errcode())
+        {
+            std::cout << "流式获取用户列表完成" << std::endl;
+        }
+    }
+
+    if (streamController.Failed())
+    {
+        std::cout << "流式获取用户列表失败:" << streamController.ErrorText() << std::endl;
+    }
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // 本进程的客户端统计
+    std::cout << RPCStats::GetInstance()->DumpText();
+
+    // 通过内置的统计服务拉取 RPCProvider 的统计
+    std::unique_ptr<RPCChannel> pStatsChannel = std::make_unique<RPCChannel>();
+    MyRPC::RPCStatsService_Stub statsStub(pStatsChannel.get());
+    MyRPC::StatsRequest statsRequest;
+    statsRequest.set_text(true);
+    MyRPC::StatsResponse statsResponse;
+    RPCController statsController;
+    statsStub.GetStats(&statsController, &statsRequest, &statsResponse, nullptr);
+    if (statsController.Failed())
+    {
+        std::cout << "获取统计信息失败:" << statsController.ErrorText() << std::endl;
+    }
+    else
+    {
+        std::cout << statsResponse.text();
+    }
+
     return 0;
 }
\ No newline at end of file
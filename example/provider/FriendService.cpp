@@ -1,4 +1,5 @@
 #include "FriendService.h"
+#include "RPCController.h"
 
 // 本地 GetFriendList 方法
 std::vector<FriendService::UserInfo> FriendService::GetFriendList(uint32_t id) const
@@ -38,6 +39,29 @@ void FriendService::GetFriendList(::google::protobuf::RpcController *controller,
         response->set_success(false);
     }
 
+    // 客户端以流式方式调用时，每个好友单独作为一帧发送，不需要在内存里拼出完整的好友列表
+    RPCController* pController = dynamic_cast<RPCController*>(controller);
+    if (pController != nullptr && pController->IsStreaming())
+    {
+        RPCTest::GetFriendListResponse chunk;
+        for (const auto &info : vecs)
+        {
+            auto pInfo = chunk.add_userinfo();
+            pInfo->set_name(info.name);
+            pInfo->set_sex(info.sex);
+            pInfo->set_age(info.age);
+            if (!pController->Write(chunk)) // 连接已断开或者客户端长时间没有读取，停止发送
+            {
+                break;
+            }
+            chunk.clear_userinfo();
+        }
+
+        // 最终的 response 只携带结果码，作为流的最后一帧发送
+        done->Run();
+        return;
+    }
+
     for (const auto &info : vecs)
     {
         auto pInfo = response->add_userinfo();
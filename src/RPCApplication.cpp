@@ -1,10 +1,14 @@
 #include "RPCApplication.h"
+#include "RPCLog.h"
 #include <unistd.h>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <vector>
 
 // 定义静态成员变量
 RPCConfig RPCApplication::config;
+std::shared_future<RPCWarmUpResult> RPCApplication::warmUpFuture;
 
 // 初始化操作
 void RPCApplication::Init(int argc, char** argv) 
@@ -34,6 +38,30 @@ void RPCApplication::Init(int argc, char** argv)
     // 加载配置文件
     // std::cout << file << std::endl;
     config.LoadConfigFile(file);
+
+    // 日志级别和限流
+    RPCLog::LoadConfig();
+
+    // 配置了 warmupServices（逗号分隔）时，在后台预热客户端连接
+    std::string services = config.Load("warmupServices");
+    if (!services.empty())
+    {
+        std::vector<std::string> serviceList;
+        std::stringstream ss(services);
+        std::string name;
+        while (std::getline(ss, name, ','))
+        {
+            name.erase(0, name.find_first_not_of(' '));
+            name.erase(name.find_last_not_of(' ') + 1);
+            if (!name.empty())
+            {
+                serviceList.push_back(name);
+            }
+        }
+
+        int connectionsPerHost = config.LoadNumber("warmupConnections", 1, 1);
+        warmUpFuture = RPCWarmUp::RunAsync(serviceList, connectionsPerHost);
+    }
 }
 
 // 获取框架类对象的单例
@@ -47,4 +75,10 @@ RPCApplication& RPCApplication::GetInstance()
 const RPCConfig& RPCApplication::GetConfig()
 {
     return RPCApplication::config;
-}
\ No newline at end of file
+}
+
+// 获取 Init 时根据配置项 warmupServices 自动发起的预热任务
+std::shared_future<RPCWarmUpResult> RPCApplication::GetWarmUpFuture()
+{
+    return RPCApplication::warmUpFuture;
+}
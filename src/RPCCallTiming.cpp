@@ -0,0 +1,92 @@
+#include "RPCCallTiming.h"
+#include "RPCApplication.h"
+#include "RPCStats.h"
+#include "RPCLog.h"
+
+#include <random>
+#include <string>
+
+namespace
+{
+    // 读取配置项 slowCallThresholdMs，默认 200ms，0 表示不输出慢调用日志
+    uint64_t SlowThresholdNs()
+    {
+        static const uint64_t thresholdNs = RPCApplication::GetInstance().GetConfig().LoadNumber<unsigned long long>("slowCallThresholdMs", 200) * 1000 * 1000;
+        return thresholdNs;
+    }
+
+    // 读取配置项 slowCallSampleRate，取值 [0, 1]，默认 0。被抽中的调用不论快慢都输出各阶段耗时
+    double SampleRate()
+    {
+        static const double rate = RPCApplication::GetInstance().GetConfig().LoadNumber("slowCallSampleRate", 0.0, 0.0, 1.0);
+        return rate;
+    }
+
+    bool Sampled()
+    {
+        double rate = SampleRate();
+        if (rate <= 0)
+        {
+            return false;
+        }
+        static thread_local std::minstd_rand rng(std::random_device{}());
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < rate;
+    }
+}
+
+const char* RPCCallTiming::PhaseName(Phase phase)
+{
+    switch (phase)
+    {
+    case kClientEncode:  return "encode";
+    case kClientLookup:  return "lookup";
+    case kClientConnect: return "connect";
+    case kClientWait:    return "wait";
+    case kClientDecode:  return "decode";
+    case kServerQueue:   return "queue";
+    case kServerDecode:  return "decode";
+    case kServerHandler: return "handler";
+    case kServerEncode:  return "encode";
+    case kServerSend:    return "send";
+    default:             return "unknown";
+    }
+}
+
+void RPCCallTiming::Finish(bool client, const google::protobuf::MethodDescriptor* method, int errorCode)
+{
+    RPCStats::GetInstance()->OnPhases(*this);
+
+    uint64_t totalNs = RPCClock::ToNs(RPCClock::Now() - m_start);
+    uint64_t thresholdNs = SlowThresholdNs();
+    bool slow = thresholdNs != 0 && totalNs >= thresholdNs;
+    if (!slow && !Sampled())
+    {
+        return;
+    }
+
+    // 各阶段的耗时精确到微秒，没有走到的阶段不输出
+    std::string text = client ? "client " : "server ";
+    text += method == nullptr ? std::string("<unknown>") : static_cast<std::string>(method->full_name());
+    text += " code=" + std::to_string(errorCode) + " total=" + std::to_string(totalNs / 1000) + "us";
+    int begin = client ? kClientPhaseBegin : kServerPhaseBegin;
+    int end = client ? kServerPhaseBegin : kPhaseCount;
+    for (int i = begin; i < end; ++i)
+    {
+        Phase phase = static_cast<Phase>(i);
+        if (Marked(phase))
+        {
+            text += ' ';
+            text += PhaseName(phase);
+            text += '=' + std::to_string(PhaseNs(phase) / 1000) + "us";
+        }
+    }
+
+    if (slow)
+    {
+        RPC_LOG(warn) << "slow call: " << text;
+    }
+    else
+    {
+        RPC_LOG(info) << "sampled call: " << text;
+    }
+}
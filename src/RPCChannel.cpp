@@ -1,173 +1,442 @@
 #include "RPCChannel.h"
 #include "Header.pb.h"
 #include "Response.pb.h"
+#include "Options.pb.h"
 #include "RPCApplication.h"
-#include "ZkConnectionManager.h"
-#include "Log.h"
+#include "RPCRegistry.h"
+#include "RPCLog.h"
 #include "RPCConnectionsPool.h"
+#include "RPCChunk.h"
+#include "RPCCodec.h"
+#include "RPCStats.h"
+#include "RPCController.h"
+#include "RPCProbes.h"
+#include "RPCCallTiming.h"
+#include "RPCRetryBudget.h"
 #include <string>
 #include <errno.h>
 #include <memory>
 #include <netinet/in.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <random>
 
 
+// 流式调用的 ID 生成器，进程内唯一
+static std::atomic<uint64_t> g_nextStreamId(1);
+
+// 重试的参数
+struct RetryConfig
+{
+    int m_maxRetries = 2;        // 一次调用最多重试的次数，0 表示不重试
+    int64_t m_backoffMs = 10;    // 第一次重试的退避上限（毫秒），之后每次翻倍，实际退避在 [0, 上限) 里随机
+    double m_budgetRatio = 0.1;  // 重试预算：重试的次数最多占调用次数的比例
+};
+
+static const RetryConfig& GetRetryConfig()
+{
+    static const RetryConfig retry = []()
+    {
+        const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+        RetryConfig r;
+        r.m_maxRetries = config.LoadNumber("maxRetries", r.m_maxRetries, 0);
+        r.m_backoffMs = config.LoadNumber<long>("retryBackoffMs", r.m_backoffMs, 0);
+        r.m_budgetRatio = config.LoadNumber("retryBudgetRatio", r.m_budgetRatio, 0.0, 1.0);
+        return r;
+    }();
+    return retry;
+}
+
+// 进程内所有 RPCChannel 共享的重试预算，最多攒 10 个令牌
+static RPCRetryBudget& GetRetryBudget()
+{
+    static RPCRetryBudget budget(GetRetryConfig().m_budgetRatio, 10);
+    return budget;
+}
+
+// 请求帧使用二进制头部还是 protobuf 头部（配置项 requestHeader）。所有提供者都能解析二进制头部之后再切换
+static bool UseBinaryHeader()
+{
+    static const bool binary = []()
+    {
+        std::string value = RPCApplication::GetInstance().GetConfig().Load("requestHeader");
+        if (!value.empty() && value != "protobuf" && value != "binary")
+        {
+            RPC_LOG(warn) << "invalid config requestHeader=" << value;
+        }
+        return value == "binary";
+    }();
+    return binary;
+}
+
+// 判断失败的调用能否重试。endpoint 为选中的提供者地址，sent 为请求是否已经发出
+static bool Retryable(int errorCode, const std::string& endpoint, bool sent, bool idempotent)
+{
+    if (errorCode == MyRPC::RPCResponseError::RESOURCE_EXHAUSTED || errorCode == MyRPC::RPCResponseError::UNAVAILABLE)
+    {
+        return true; // 服务端没有执行就拒绝了
+    }
+    if (errorCode != RPCStats::kLocalError || endpoint.empty())
+    {
+        return false; // 业务错误、解析错误，或者注册中心里没有该服务，重试也不会成功
+    }
+    return !sent || idempotent; // 请求发出之后收发失败，服务端可能已经执行
+}
+
+// 第 attempt 次重试前的退避时间：在 [0, retryBackoffMs * 2^(attempt-1)) 里均匀随机，避免大量客户端同时重试
+static std::chrono::milliseconds RetryBackoff(int attempt)
+{
+    int64_t ceiling = GetRetryConfig().m_backoffMs << std::min(attempt - 1, 10);
+    if (ceiling <= 0)
+    {
+        return std::chrono::milliseconds(0);
+    }
+    static thread_local std::mt19937_64 engine(std::random_device{}());
+    return std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(0, ceiling - 1)(engine));
+}
+
+// 重试前清除上一次的失败状态，保留用户设置的父调用链上下文
+static void ClearFailure(google::protobuf::RpcController *controller)
+{
+    RPCController* pController = dynamic_cast<RPCController*>(controller);
+    if (pController == nullptr)
+    {
+        controller->Reset();
+        return;
+    }
+    RPCTraceContext parent = pController->GetTraceContext();
+    pController->Reset();
+    pController->SetTraceContext(parent);
+}
+
+// 直连指定的 RPCProvider（"ip:port"），不经过服务发现
+RPCChannel::RPCChannel(const std::string& endpoint)
+: m_directEndpoint(endpoint)
+{
+}
+
 void RPCChannel::CallMethod(const google::protobuf::MethodDescriptor *method,
                             google::protobuf::RpcController *controller,
                             const google::protobuf::Message *request,
                             google::protobuf::Message *response,
                             google::protobuf::Closure *done)
 {
-//1.将被调用的函数和参数信息封装成 rpcHeader ==> serviceName + methodName + argvSize
+    auto start = std::chrono::steady_clock::now();
+    RPCCallTiming timing;
+    RPCStats* pStats = RPCStats::GetInstance();
+    pStats->OnStart(RPCStats::kClient, method);
+    RPCTraceContext trace = NewTraceContext(controller);
+    uint64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
 
-    // 获取服务名称 serviceName
-    const google::protobuf::ServiceDescriptor *service = method->service();
-    std::string serviceName = static_cast<std::string>(service->name());
+//1.将被调用的函数和参数信息封装成发送流 sendStr
+    std::string sendStr;
+    size_t requestSize = 0;
+    size_t responseSize = 0;
+    int errorCode = RPCStats::kLocalError;
+    int retries = 0;
+    GetRetryBudget().Deposit();
+    if (PackRequest(method, request, 0, trace, &sendStr, controller, &requestSize))
+    {
+        timing.Mark(RPCCallTiming::kClientEncode);
+        uint64_t encodedNs = trace.m_sampled ? RPCTrace::NowNs() : 0;
+        RPCTrace::Record(trace, "client.encode", method, startNs, encodedNs);
+
+//2.将已经封装好了的 sendStr 发送给框架的服务端RPCProvider，失败时按规则换一个提供者重试
+        std::string serviceName = static_cast<std::string>(method->service()->name()); // 获取服务名称 serviceName
+        std::string methodName = static_cast<std::string>(method->name()); // 获取方法名称 methodName
+        bool idempotent = method->options().GetExtension(MyRPC::idempotent);
+        std::string endpoint;
+        while (true)
+        {
+            bool sent = false;
+            std::string failedEndpoint(std::move(endpoint));
+            endpoint.clear();
+            responseSize = 0;
+            errorCode = SendToServer(serviceName, methodName, sendStr, response, controller, &responseSize, &timing, failedEndpoint, &endpoint, &sent); // sendStr = 4字节前缀长度 + headerSize (4字节)+ headerStr + requestStr
+            if (errorCode == MyRPC::RPCResponseError::SUCCESS || retries >= GetRetryConfig().m_maxRetries
+                || !Retryable(errorCode, endpoint, sent, idempotent))
+            {
+                break;
+            }
+            if (!GetRetryBudget().Withdraw())
+            {
+                RPC_LOG(warn) << "retry budget exhausted, " << serviceName << "." << methodName << " not retried";
+                break;
+            }
 
-    // 获取方法名称 methodName 
-    std::string methodName = static_cast<std::string>(method->name());
+            ++retries;
+            RPC_LOG(warn) << serviceName << "." << methodName << " failed on " << endpoint << ": " << controller->ErrorText()
+                          << ", retry " << retries;
+            std::this_thread::sleep_for(RetryBackoff(retries));
+            ClearFailure(controller);
+            response->Clear();
+        }
+        RPCTrace::Record(trace, "client.call", method, encodedNs, trace.m_sampled ? RPCTrace::NowNs() : 0);
+    }
 
-    // 将 request 序列化成字符串
-    std::string requestStr;
-    if (!request->SerializeToString(&requestStr))
+    RPCController* pController = dynamic_cast<RPCController*>(controller);
+    if (pController != nullptr)
     {
-        // 输出日志
-        LOG(Log::error) << "SerializeToString() err";
-        controller->SetFailed("SerializeToString() err");
-        return ;
+        pController->SetRetryCount(retries);
     }
 
-    // 获取参数长度 argvSize
-    uint32_t argvSize = requestStr.size();
+    pStats->OnFinish(RPCStats::kClient, method, errorCode, responseSize, requestSize,
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    timing.Finish(true, method, errorCode);
+}
 
-    // 将 serviceName、methodName 和 argcSize 封装成Header
-    MyRPC::RpcHeader Header;
-    Header.set_servicename(serviceName);
-    Header.set_methodname(methodName);
-    Header.set_argvsize(argvSize);
+// 发起服务端流式调用，通过返回的 RPCStreamReader 逐条读取响应
+std::unique_ptr<RPCStreamReader> RPCChannel::CallStream(const google::protobuf::MethodDescriptor *method,
+                                                        google::protobuf::RpcController *controller,
+                                                        const google::protobuf::Message *request)
+{
+    uint64_t streamId = g_nextStreamId.fetch_add(1, std::memory_order_relaxed);
 
-    // 将 Header 序列化成字符串
-    std::string headerStr;
-    if (!Header.SerializeToString(&headerStr))
+    std::string sendStr;
+    if (!PackRequest(method, request, streamId, NewTraceContext(controller), &sendStr, controller))
     {
-        // 输出日志
-        LOG(Log::error) << "SerializeToString() err";
-        controller->SetFailed("SerializeToString() err");
-        return ;
+        return nullptr;
     }
 
-    // 计算headerStr的大小，用大端序存储
-    uint32_t headerSize = htonl(headerStr.size());
+    std::string serviceName = static_cast<std::string>(method->service()->name());
+    bool probe = false;
+    auto pConn = GetConnection(serviceName, static_cast<std::string>(method->name()), controller, nullptr, "", nullptr, &probe);
+    if (pConn == nullptr)
+    {
+        return nullptr;
+    }
 
-//2.将headerSize headerStr requestStr 封装成一个发送流 sendStr 发送给框架的服务端RPCProvider
-    
-    //初始化发送流
-    std::string sendStr;
+    auto sendTime = std::chrono::steady_clock::now();
+    if (pConn->Send(sendStr) == -1)
+    {
+        RPC_LOG(error) << "send() err";
+        controller->SetFailed("send() err");
+        pConn->close();
+        RPCConnectionsPool* pConnPool = RPCConnectionsPool::GetInstance();
+        pConnPool->ReportResult(pConn->GetIp(), pConn->GetPort(), serviceName, false, 0); // 和 SendToServer 一样，发送失败算作主机的失败
+        pConnPool->ReturnConnection(pConn);
+        return nullptr;
+    }
 
-    // 填充 sendStr
-    sendStr.insert(0, reinterpret_cast<const char*>(&headerSize), 4); // 添加headerSize
-    sendStr += headerStr;
-    sendStr += requestStr;
+    // 连接的所有权交给读取器，流读完之后由读取器向熔断器报告结果，并把连接归还给连接池
+    return std::unique_ptr<RPCStreamReader>(new RPCStreamReader(std::move(pConn), streamId, controller, serviceName, probe, sendTime));
+}
+
+// 将被调用的方法和参数封装成发送流：4字节前缀长度 + headerSize(4字节) + header + request
+bool RPCChannel::PackRequest(const google::protobuf::MethodDescriptor *method, const google::protobuf::Message *request, uint64_t streamId, const RPCTraceContext& trace,
+                             std::string* sendStr, google::protobuf::RpcController *controller, size_t* requestSize)
+{
+    RPCRequestHeader header;
+    header.m_serviceName = static_cast<std::string>(method->service()->name());
+    header.m_methodName = static_cast<std::string>(method->name());
+    header.m_streamId = streamId;
+    header.m_trace = trace;
 
-    // 将已经封装好了的 sendStr 发送给框架的服务端
-    SendToServer(serviceName, methodName, sendStr, response, controller); // sendStr = headerSize (4字节)+ headerStr + requestStr
+    // 参数超过分块大小时拆成多帧发送，保证每一帧都远小于服务端的单帧上限
+    size_t size = 0;
+    sendStr->clear();
+    RPCCodec::EncodeResult result = RPCCodec::EncodeRequest(header, *request, UseBinaryHeader(), RPCChunk::GetChunkSize(),
+                                                            RPCChunk::GetMaxMessageSize(), sendStr, &size);
+    if (result == RPCCodec::kMessageTooLarge)
+    {
+        RPC_LOG(error) << "request too large, size=" << size;
+        controller->SetFailed("request too large");
+        return false;
+    }
+    if (result != RPCCodec::kEncodeOk)
+    {
+        // 输出日志
+        std::string msg(result == RPCCodec::kNameTooLong ? "PackBinaryRequest() err" : "SerializeToString() err");
+        RPC_LOG(error) << msg;
+        controller->SetFailed(msg);
+        return false;
+    }
+    if (requestSize != nullptr)
+    {
+        *requestSize = size;
+    }
+    return true;
 }
 
-// 通过网络将sendStr发送给框架的服务端
-void RPCChannel::SendToServer(const std::string& serviceName, const std::string& methodName, const std::string& sendStr, google::protobuf::Message *response, google::protobuf::RpcController *controller)
+// 为本次调用生成调用链上下文
+RPCTraceContext RPCChannel::NewTraceContext(google::protobuf::RpcController *controller)
 {
-    // 获取 zookeeper 的单例连接管理器对象
-    ZkClient* zk = ZkConnectionManager::getInstance()->GetZkClient();
+    RPCController* pController = dynamic_cast<RPCController*>(controller);
+    if (pController != nullptr && pController->GetTraceContext().m_traceId != 0) // 用户显式指定了父上下文
+    {
+        return RPCTrace::NewChild(pController->GetTraceContext());
+    }
 
-    // 从 zooKepper 的服务器上获取 RPC 框架服务端 RPCProvider 的IP和端口号
-    std::string path("/" + serviceName + "/" + methodName); // 生成查找结点所在的路径: /serviceName/methodName
-    std::string data = zk->GetData(path.data()); // 查找指定路径结点的数据
-    if (data.empty()) // 指定路径的结点不存在，即未注册所指定的服务或者方法 
+    const RPCTraceContext* pCurrent = RPCTrace::Current(); // 在 handler 里发起的下游调用
+    return RPCTrace::NewChild(pCurrent != nullptr ? *pCurrent : RPCTraceContext());
+}
+
+// 从注册中心查找 RPCProvider 的地址，并从连接池中获取一条到该地址的连接
+std::shared_ptr<RPCConnection> RPCChannel::GetConnection(const std::string& serviceName, const std::string& methodName, google::protobuf::RpcController *controller,
+                                                         RPCCallTiming* timing, const std::string& avoidEndpoint, std::string* pEndpoint, bool* pProbe)
+{
+    std::string data(m_directEndpoint);
+    if (data.empty()) // 没有指定直连地址，通过注册中心查找 RPC 框架服务端 RPCProvider 的IP和端口号
+    {
+        data = RPCRegistry::GetInstance()->Lookup(serviceName, methodName);
+        // 重试时避开上一次失败的提供者。注册中心按权重随机选择，多查几次；只有一个提供者时仍然使用它
+        for (int i = 0; i < 3 && !avoidEndpoint.empty() && data == avoidEndpoint; ++i)
+        {
+            data = RPCRegistry::GetInstance()->Lookup(serviceName, methodName);
+        }
+    }
+    if (timing != nullptr)
+    {
+        timing->Mark(RPCCallTiming::kClientLookup);
+    }
+    std::string path("/" + serviceName + "/" + methodName);
+    if (data.empty()) // 未注册所指定的服务或者方法
     {
         // 输出日志
-        std::string msg(path + " Not Exit In ZooKeeperServer");
-        LOG(Log::error) << msg;
+        std::string msg(path + " Not Exist In Registry");
+        RPC_LOG(error) << msg;
         controller->SetFailed(msg);
-        return ;
+        return nullptr;
     }
 
-    size_t pos = data.find(':');
-    if (pos == std::string::npos)
+    std::string ip;
+    uint16_t port = 0;
+    if (!RPCRegistry::ParseEndpoint(data, &ip, &port))
     {
         // 输出日志
         std::string msg(path + " Is Invalid");
-        LOG(Log::error) << msg;
+        RPC_LOG(error) << msg;
         controller->SetFailed(msg);
-        return ;
+        return nullptr;
     }
 
-    std::string ip(data.begin(), data.begin()+pos);
-    std::string port(data.begin()+pos+1, data.end());
+    if (pEndpoint != nullptr)
+    {
+        *pEndpoint = data;
+    }
 
     RPCConnectionsPool* pConnPool = RPCConnectionsPool::GetInstance();// 获取连接池单例对象
-    auto pConn = pConnPool->GetConnection(ip, stoi(port));// 获取连接
+    bool probe = false;
+    if (!pConnPool->AllowRequest(ip, port, &probe)) // 熔断器打开，快速失败，不再等待连接或者接收超时
+    {
+        std::string msg(data + " circuit open");
+        RPC_LOG(warn) << msg;
+        controller->SetFailed(msg);
+        return nullptr;
+    }
+    auto pConn = pConnPool->GetConnection(ip, port);// 获取连接
+    if (timing != nullptr)
+    {
+        timing->Mark(RPCCallTiming::kClientConnect);
+    }
     if (pConn == nullptr)
     {
-        LOG(Log::error) << "Failed to get connection from pool";
+        if (probe) // 连接数达到上限时请求没有发出去，探测名额留给下一个调用。连接失败时连接池已经报告过，熔断器重新打开
+        {
+            pConnPool->ReleaseProbe(ip, port);
+        }
+        RPC_LOG(error) << "Failed to get connection from pool";
         controller->SetFailed("Failed to get connection from pool");
-        return;
+        return nullptr;
     }
+    if (pProbe != nullptr)
+    {
+        *pProbe = probe;
+    }
+    return pConn;
+}
 
-    // 发送sendStr之前需要添加长度前缀
-    std::string str;
-
-    // 用大端序存储待发送的数据的长度
-    uint32_t sz = htonl(sendStr.size());
-    str.insert(0, reinterpret_cast<const char*>(&sz), 4);
-    str += sendStr;
-
-    // 发送 str
-    if (pConn->Send(str) == -1)
+// 通过网络将sendStr发送给框架的服务端
+int RPCChannel::SendToServer(const std::string& serviceName, const std::string& methodName, const std::string& sendStr, google::protobuf::Message *response, google::protobuf::RpcController *controller,
+                              size_t* responseSize, RPCCallTiming* timing, const std::string& avoidEndpoint, std::string* pEndpoint, bool* pSent)
+{
+    bool probe = false;
+    auto pConn = GetConnection(serviceName, methodName, controller, timing, avoidEndpoint, pEndpoint, &probe);
+    if (pConn == nullptr)
     {
-        LOG(Log::error) << "send() err";
-        controller->SetFailed("send() err");
-        pConnPool->ReturnConnection(pConn);
-        return ;
+        return RPCStats::kLocalError;
     }
+    *pSent = true; // 从这里开始，请求可能已经到达服务端
+    RPCConnectionsPool* pConnPool = RPCConnectionsPool::GetInstance();
 
-    // 阻塞等待 RPCProvider 返回函数调用的结果
-    char buf[65535] = {0};
-    ssize_t recvLen = pConn->Recv(buf, sizeof(buf));
-    if (-1 == recvLen)
+    // 发送 sendStr，并阻塞等待 RPCProvider 返回一帧完整的函数调用结果
+    int errorCode = RPCStats::kLocalError;
+    std::string recvStr;
+    MYRPC_PROBE(client_send, serviceName.c_str(), methodName.c_str(), sendStr.size());
+    auto sendTime = std::chrono::steady_clock::now();
+    int ret = pConn->SendRecvFrame(sendStr, &recvStr);
+    timing->Mark(RPCCallTiming::kClientWait);
+    if (-1 == ret)
     {
         // 输出日志
-        LOG(Log::error) << "recv() err";
-        controller->SetFailed("recv() err");
+        RPC_LOG(error) << "send()/recv() err";
+        controller->SetFailed("send()/recv() err");
+        pConn->close();
     }
-    else if (0 == recvLen)
+    else if (0 == ret)
     {
         // 输出日志
-        LOG(Log::error) << "对端连接异常断开";
+        RPC_LOG(error) << "对端连接异常断开";
         controller->SetFailed("对端连接异常断开");
+        pConn->close();
     }
     else
     {
-        // 将接收到的数据拷贝到string里
-        std::string recvStr(buf, recvLen);
-        
         MyRPC::RPCResponseWrapper wrapper;
-        if (wrapper.ParseFromString(recvStr))
+        std::vector<std::string> chunks; // 响应数据的各个分块，未分块时只有一块
+        ret = RPCChunk::CollectResponse(pConn.get(), recvStr, &wrapper, &chunks);
+        timing->Mark(RPCCallTiming::kClientWait); // 响应分块时，收齐剩余分块的时间也算作等待
+        if (ret == 1)
         {
+            for (const auto& chunk : chunks)
+            {
+                *responseSize += chunk.size();
+            }
+
             if (wrapper.success()) // RPC 调用成功
             {
+                errorCode = MyRPC::RPCResponseError::SUCCESS;
                 // 反序列化
-                response->ParseFromString(wrapper.data());
+                if (!RPCChunk::ParseFromChunks(chunks, response))
+                {
+                    RPC_LOG(error) << "ParseFromString() err";
+                    controller->SetFailed("ParseFromString() err");
+                    errorCode = MyRPC::RPCResponseError::PARSE_ERROR;
+                }
+                timing->Mark(RPCCallTiming::kClientDecode);
             }
             else // RPC 调用失败
             {
                 controller->SetFailed(wrapper.error().error_message());
+                errorCode = wrapper.error().error_code();
             }
         }
         else
         {
-            LOG(Log::error) << "ParseFromString(" << recvStr << ") err";
-            controller->SetFailed("ParseFromString() err");
+            RPC_LOG(error) << "recv response err";
+            controller->SetFailed("recv response err");
+            pConn->close();
         }
     }
 
+    MYRPC_PROBE(client_recv, serviceName.c_str(), methodName.c_str(), *responseSize, errorCode);
+
+    // 收发出错算作主机的失败，业务错误说明主机是正常的。服务端过载、正在停止或者限流时没有执行调用就回复了，
+    // 既不说明主机坏了，延迟也不代表真实调用，只交给重试逻辑，不报告给熔断器和离群检测
+    bool rejected = (errorCode == MyRPC::RPCResponseError::RESOURCE_EXHAUSTED || errorCode == MyRPC::RPCResponseError::UNAVAILABLE
+                     || errorCode == MyRPC::RPCResponseError::RATE_LIMITED);
+    if (!rejected)
+    {
+        pConnPool->ReportResult(pConn->GetIp(), pConn->GetPort(), serviceName, errorCode != RPCStats::kLocalError,
+                                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sendTime).count());
+    }
+    else if (probe)
+    {
+        pConnPool->ReleaseProbe(pConn->GetIp(), pConn->GetPort());
+    }
     pConnPool->ReturnConnection(pConn);
-}
\ No newline at end of file
+    return errorCode;
+}
@@ -0,0 +1,82 @@
+#include "RPCChunk.h"
+#include "RPCConnection.h"
+#include "RPCApplication.h"
+#include "Response.pb.h"
+#include "RPCLog.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <memory>
+
+size_t RPCChunk::GetChunkSize()
+{
+    static const size_t chunkSize = RPCApplication::GetInstance().GetConfig().LoadNumber<size_t>("chunkSize", 1024, 1) * 1024;
+    return chunkSize;
+}
+
+size_t RPCChunk::GetMaxMessageSize()
+{
+    static const size_t maxMessageSize = RPCApplication::GetInstance().GetConfig().LoadNumber<size_t>("maxMessageSize", 1024, 1) * 1024 * 1024;
+    return maxMessageSize;
+}
+
+bool RPCChunk::ParseFromChunks(const std::vector<std::string>& chunks, google::protobuf::Message* msg)
+{
+    if (chunks.size() == 1) // 没有分块，走普通路径
+    {
+        return msg->ParseFromString(chunks[0]);
+    }
+
+    // 每个分块包装成一个 ArrayInputStream，再串成一条输入流
+    std::vector<std::unique_ptr<google::protobuf::io::ArrayInputStream>> streams;
+    std::vector<google::protobuf::io::ZeroCopyInputStream*> pStreams;
+    streams.reserve(chunks.size());
+    pStreams.reserve(chunks.size());
+    for (const auto& chunk : chunks)
+    {
+        streams.emplace_back(new google::protobuf::io::ArrayInputStream(chunk.data(), chunk.size()));
+        pStreams.push_back(streams.back().get());
+    }
+
+    google::protobuf::io::ConcatenatingInputStream input(pStreams.data(), pStreams.size());
+    return msg->ParseFromZeroCopyStream(&input);
+}
+
+int RPCChunk::CollectResponse(RPCConnection* pConn, std::string& frame, MyRPC::RPCResponseWrapper* wrapper, std::vector<std::string>* chunks)
+{
+    chunks->clear();
+    if (!wrapper->ParseFromString(frame))
+    {
+        RPC_LOG(error) << "ParseFromString() err";
+        return -1;
+    }
+    chunks->emplace_back(std::move(*wrapper->mutable_data()));
+
+    size_t totalSize = chunks->back().size();
+    bool more = wrapper->more_chunks();
+    MyRPC::RPCResponseWrapper piece;
+    while (more) // 响应被分块发送，继续读取剩余分块
+    {
+        int ret = pConn->RecvFrame(&frame);
+        if (ret != 1)
+        {
+            return ret;
+        }
+
+        if (!piece.ParseFromString(frame) || piece.stream_id() != wrapper->stream_id())
+        {
+            RPC_LOG(error) << "invalid response chunk";
+            return -1;
+        }
+
+        totalSize += piece.data().size();
+        if (totalSize > GetMaxMessageSize())
+        {
+            RPC_LOG(error) << "response too large, size=" << totalSize;
+            return -1;
+        }
+
+        chunks->emplace_back(std::move(*piece.mutable_data()));
+        more = piece.more_chunks();
+    }
+    return 1;
+}
@@ -0,0 +1,72 @@
+#include "RPCClock.h"
+
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace
+{
+    // 校准的起点：同一时刻的 TSC 和 steady_clock
+    struct Anchor
+    {
+        uint64_t m_ticks;
+        uint64_t m_ns;
+    };
+
+    uint64_t SteadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const Anchor& GetAnchor()
+    {
+        static const Anchor anchor = {RPCClock::Now(), SteadyNow()};
+        return anchor;
+    }
+
+    // 动态库加载时就取好起点，第一次换算时通常已经过了足够长的时间，不需要再等待
+    [[maybe_unused]] const Anchor& g_loadAnchor = GetAnchor();
+
+    // 每个刻度对应的纳秒数
+    double NsPerTick()
+    {
+        static const double nsPerTick = []()
+        {
+            const uint64_t kMinWindowNs = 10 * 1000 * 1000; // 校准窗口至少 10ms，误差在十万分之一左右
+            const Anchor& anchor = GetAnchor();
+            uint64_t ns = SteadyNow();
+            while (ns - anchor.m_ns < kMinWindowNs)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(kMinWindowNs - (ns - anchor.m_ns)));
+                ns = SteadyNow();
+            }
+            uint64_t ticks = RPCClock::Now();
+            return ticks > anchor.m_ticks ? static_cast<double>(ns - anchor.m_ns) / (ticks - anchor.m_ticks) : 1.0;
+        }();
+        return nsPerTick;
+    }
+}
+
+bool RPCClock::DetectTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    // CPUID.80000007H:EDX[8] 表示 TSC 的频率恒定，不受变频和 C-state 影响，并且各个核之间同步
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        return (edx & (1u << 8)) != 0;
+    }
+#endif
+    return false;
+}
+
+uint64_t RPCClock::ToNs(uint64_t ticks)
+{
+    if (!UseTsc())
+    {
+        return ticks;
+    }
+    return static_cast<uint64_t>(ticks * NsPerTick());
+}
@@ -0,0 +1,357 @@
+#include "RPCCodec.h"
+#include "Header.pb.h"
+#include "Response.pb.h"
+#include "Buffer.h"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <algorithm>
+#include <cstring>
+
+// 按大端序读写二进制头部的整数字段，memcpy 会被编译成一次定长读写
+template <typename T>
+static T Load(const char* p)
+{
+    T value;
+    memcpy(&value, p, sizeof(T));
+    switch (sizeof(T))
+    {
+    case 2: return static_cast<T>(be16toh(static_cast<uint16_t>(value)));
+    case 4: return static_cast<T>(be32toh(static_cast<uint32_t>(value)));
+    default: return static_cast<T>(be64toh(static_cast<uint64_t>(value)));
+    }
+}
+
+template <typename T>
+static void Store(char* p, T value)
+{
+    switch (sizeof(T))
+    {
+    case 2: value = static_cast<T>(htobe16(static_cast<uint16_t>(value))); break;
+    case 4: value = static_cast<T>(htobe32(static_cast<uint32_t>(value))); break;
+    default: value = static_cast<T>(htobe64(static_cast<uint64_t>(value))); break;
+    }
+    memcpy(p, &value, sizeof(T));
+}
+
+RPCCodec::EncodeResult RPCCodec::EncodeRequest(const RPCRequestHeader& header, const google::protobuf::Message& request, bool binary,
+                                               size_t chunkSize, size_t maxMessageSize, std::string* sendStr, size_t* requestSize)
+{
+    std::string requestStr;
+    if (!request.SerializeToString(&requestStr))
+    {
+        return kSerializeFailed;
+    }
+    if (requestSize != nullptr)
+    {
+        *requestSize = requestStr.size();
+    }
+    if (requestStr.size() > maxMessageSize)
+    {
+        return kMessageTooLarge;
+    }
+
+    if (binary) // 二进制头部，服务端不需要反序列化 RpcHeader
+    {
+        return PackBinaryRequest(header, requestStr, chunkSize, sendStr) ? kEncodeOk : kNameTooLong;
+    }
+
+    MyRPC::RpcHeader rpcHeader;
+    rpcHeader.set_servicename(header.m_serviceName);
+    rpcHeader.set_methodname(header.m_methodName);
+    rpcHeader.set_streamid(header.m_streamId);
+    if (header.m_trace.m_traceId != 0) // 没有开启追踪时不携带调用链字段
+    {
+        rpcHeader.set_traceid(header.m_trace.m_traceId);
+        rpcHeader.set_spanid(header.m_trace.m_spanId);
+        rpcHeader.set_parentspanid(header.m_trace.m_parentSpanId);
+        rpcHeader.set_sampled(header.m_trace.m_sampled);
+    }
+    return PackRequest(rpcHeader, requestStr, chunkSize, sendStr) ? kEncodeOk : kSerializeFailed;
+}
+
+bool RPCCodec::PackRequest(MyRPC::RpcHeader& header, const std::string& requestStr, size_t chunkSize, std::string* sendStr)
+{
+    size_t chunkCnt = requestStr.empty() ? 1 : (requestStr.size() + chunkSize - 1) / chunkSize;
+    sendStr->reserve(sendStr->size() + requestStr.size() + chunkCnt * 64);
+
+    std::string headerStr;
+    for (size_t i = 0; i < chunkCnt; ++i)
+    {
+        size_t offset = i * chunkSize;
+        size_t pieceSize = std::min(chunkSize, requestStr.size() - offset);
+        if (i == 1) // 后续分块的 header 只需要分块信息
+        {
+            header.clear_servicename();
+            header.clear_methodname();
+            header.clear_traceid();
+            header.clear_spanid();
+            header.clear_parentspanid();
+            header.clear_sampled();
+        }
+        header.set_argvsize(pieceSize);
+        header.set_chunkseq(i);
+        header.set_morechunks(i + 1 < chunkCnt);
+
+        // 将 header 序列化成字符串
+        if (!header.SerializeToString(&headerStr))
+        {
+            return false;
+        }
+
+        // 前缀长度和 headerSize 都用大端序存储
+        uint32_t headerSize = htonl(headerStr.size());
+        uint32_t totalSize = htonl(4 + headerStr.size() + pieceSize);
+
+        // 填充 sendStr
+        sendStr->append(reinterpret_cast<const char*>(&totalSize), 4); // 添加前缀长度
+        sendStr->append(reinterpret_cast<const char*>(&headerSize), 4); // 添加headerSize
+        *sendStr += headerStr;
+        sendStr->append(requestStr, offset, pieceSize);
+    }
+    return true;
+}
+
+bool RPCCodec::PackBinaryRequest(const RPCRequestHeader& header, const std::string& requestStr, size_t chunkSize, std::string* sendStr)
+{
+    if (header.m_serviceName.size() > UINT16_MAX || header.m_methodName.size() > UINT16_MAX)
+    {
+        return false;
+    }
+
+    size_t chunkCnt = requestStr.empty() ? 1 : (requestStr.size() + chunkSize - 1) / chunkSize;
+    bool hasTrace = header.m_trace.m_traceId != 0; // 没有开启追踪时不携带调用链扩展
+    size_t firstExtra = header.m_serviceName.size() + header.m_methodName.size() + (hasTrace ? 4 + 24 : 0);
+    sendStr->reserve(sendStr->size() + requestStr.size() + chunkCnt * kFixedHeaderSize + firstExtra);
+
+    for (size_t i = 0; i < chunkCnt; ++i)
+    {
+        size_t offset = i * chunkSize;
+        size_t pieceSize = std::min(chunkSize, requestStr.size() - offset);
+        bool first = (i == 0); // 后续分块只需要分块信息
+        uint16_t serviceLen = first ? header.m_serviceName.size() : 0;
+        uint16_t methodLen = first ? header.m_methodName.size() : 0;
+        uint16_t extLen = (first && hasTrace) ? 4 + 24 : 0;
+        uint8_t flags = (header.m_heartbeat ? kFlagHeartbeat : 0)
+                      | (i + 1 < chunkCnt ? kFlagMoreChunks : 0)
+                      | (first && header.m_trace.m_sampled ? kFlagSampled : 0);
+
+        char fixed[kFixedHeaderSize];
+        Store<uint16_t>(fixed, kMagic);
+        fixed[2] = static_cast<char>(kVersion);
+        fixed[3] = static_cast<char>(flags);
+        Store<uint32_t>(fixed + 4, kFixedHeaderSize + serviceLen + methodLen + extLen + pieceSize);
+        Store<uint64_t>(fixed + 8, header.m_streamId);
+        Store<uint32_t>(fixed + 16, i);
+        Store<uint16_t>(fixed + 20, serviceLen);
+        Store<uint16_t>(fixed + 22, methodLen);
+        Store<uint16_t>(fixed + 24, extLen);
+        Store<uint16_t>(fixed + 26, 0);
+        Store<uint32_t>(fixed + 28, pieceSize);
+        sendStr->append(fixed, kFixedHeaderSize);
+
+        if (first)
+        {
+            *sendStr += header.m_serviceName;
+            *sendStr += header.m_methodName;
+        }
+        if (extLen != 0)
+        {
+            char trace[4 + 24];
+            Store<uint16_t>(trace, kExtTrace);
+            Store<uint16_t>(trace + 2, 24);
+            Store<uint64_t>(trace + 4, header.m_trace.m_traceId);
+            Store<uint64_t>(trace + 12, header.m_trace.m_spanId);
+            Store<uint64_t>(trace + 20, header.m_trace.m_parentSpanId);
+            sendStr->append(trace, sizeof(trace));
+        }
+        sendStr->append(requestStr, offset, pieceSize);
+    }
+    return true;
+}
+
+// 二进制头部的请求帧
+static RPCCodec::ParseResult ParseBinaryFrame(Buffer* buffer, RPCRequestHeader* header, std::string* argv)
+{
+    if (buffer->readableBytes() < RPCCodec::kFixedHeaderSize)
+    {
+        return RPCCodec::kFrameIncomplete;
+    }
+
+    const char* p = buffer->peek();
+    uint32_t frameSize = Load<uint32_t>(p + 4);
+    if (frameSize >= RPCCodec::kMaxFrameSize || frameSize < RPCCodec::kFixedHeaderSize)
+    {
+        return RPCCodec::kFrameTooLarge;
+    }
+    if (buffer->readableBytes() < frameSize)
+    {
+        return RPCCodec::kFrameIncomplete;
+    }
+
+    uint8_t version = static_cast<uint8_t>(p[2]);
+    uint8_t flags = static_cast<uint8_t>(p[3]);
+    uint16_t serviceLen = Load<uint16_t>(p + 20);
+    uint16_t methodLen = Load<uint16_t>(p + 22);
+    uint16_t extLen = Load<uint16_t>(p + 24);
+    uint32_t payloadSize = Load<uint32_t>(p + 28);
+    if (version != RPCCodec::kVersion
+        || static_cast<uint64_t>(RPCCodec::kFixedHeaderSize) + serviceLen + methodLen + extLen + payloadSize != frameSize)
+    {
+        buffer->retrieve(frameSize); // 帧边界仍然可信，只丢弃这一帧
+        return RPCCodec::kBadHeader;
+    }
+
+    header->m_streamId = Load<uint64_t>(p + 8);
+    header->m_chunkSeq = Load<uint32_t>(p + 16);
+    header->m_heartbeat = (flags & RPCCodec::kFlagHeartbeat) != 0;
+    header->m_moreChunks = (flags & RPCCodec::kFlagMoreChunks) != 0;
+    const char* cursor = p + RPCCodec::kFixedHeaderSize;
+    header->m_serviceName.assign(cursor, serviceLen);
+    cursor += serviceLen;
+    header->m_methodName.assign(cursor, methodLen);
+    cursor += methodLen;
+
+    header->m_trace = RPCTraceContext();
+    header->m_trace.m_sampled = (flags & RPCCodec::kFlagSampled) != 0;
+    const char* extEnd = cursor + extLen;
+    while (extEnd - cursor >= 4)
+    {
+        uint16_t type = Load<uint16_t>(cursor);
+        uint16_t len = Load<uint16_t>(cursor + 2);
+        cursor += 4;
+        if (len > extEnd - cursor)
+        {
+            buffer->retrieve(frameSize);
+            return RPCCodec::kBadHeader;
+        }
+        if (type == RPCCodec::kExtTrace && len >= 24)
+        {
+            header->m_trace.m_traceId = Load<uint64_t>(cursor);
+            header->m_trace.m_spanId = Load<uint64_t>(cursor + 8);
+            header->m_trace.m_parentSpanId = Load<uint64_t>(cursor + 16);
+        }
+        cursor += len;
+    }
+
+    argv->assign(extEnd, payloadSize);
+    buffer->retrieve(frameSize);
+    return RPCCodec::kFrameOk;
+}
+
+RPCCodec::ParseResult RPCCodec::ParseRequestFrame(Buffer* buffer, RPCRequestHeader* header, std::string* argv)
+{
+    if (buffer->readableBytes() == 0)
+    {
+        return kFrameIncomplete;
+    }
+    if (static_cast<uint8_t>(buffer->peek()[0]) == (kMagic >> 8)) // protobuf 头部的帧长度不超过 64MB，最高字节不会是 magic
+    {
+        return ParseBinaryFrame(buffer, header, argv);
+    }
+    if (buffer->readableBytes() <= 4)
+    {
+        return kFrameIncomplete;
+    }
+
+    uint32_t len = buffer->peekInt32(); // 读取 rpc 请求报文的长度
+    if (len >= kMaxFrameSize) // 超过 64M，防止炸弹。更大的消息需要由客户端分块发送
+    {
+        return kFrameTooLarge;
+    }
+    if (buffer->readableBytes() < 4 + len) // 不是一条完整的 rpc 请求报文
+    {
+        return kFrameIncomplete;
+    }
+
+    buffer->retrieve(4); // 消费掉 4 字节的报文长度
+    uint32_t rpcHeaderSize = (len >= 4) ? buffer->readInt32() : 0; // 获取 rpcHeader 的长度
+    if (len < 4 || rpcHeaderSize > len - 4) // 长度字段错乱，丢弃整帧
+    {
+        buffer->retrieve(len >= 4 ? len - 4 : len);
+        return kBadHeader;
+    }
+
+    // 按帧长度消费，header 无法解析时也不会在缓冲区里留下半帧
+    MyRPC::RpcHeader rpcHeader;
+    bool parsed = rpcHeader.ParseFromArray(buffer->peek(), rpcHeaderSize); // 反序列化 protobuf
+    buffer->retrieve(rpcHeaderSize);
+    *argv = buffer->retrieveAsString(len - 4 - rpcHeaderSize); // 获取参数
+    if (!parsed)
+    {
+        return kBadHeader;
+    }
+
+    header->m_serviceName = rpcHeader.servicename();
+    header->m_methodName = rpcHeader.methodname();
+    header->m_streamId = rpcHeader.streamid();
+    header->m_chunkSeq = rpcHeader.chunkseq();
+    header->m_moreChunks = rpcHeader.morechunks();
+    header->m_heartbeat = rpcHeader.heartbeat();
+    header->m_trace.m_traceId = rpcHeader.traceid();
+    header->m_trace.m_spanId = rpcHeader.spanid();
+    header->m_trace.m_parentSpanId = rpcHeader.parentspanid();
+    header->m_trace.m_sampled = rpcHeader.sampled();
+    return kFrameOk;
+}
+
+uint64_t RPCCodec::PendingFrameSize(const Buffer* buffer)
+{
+    size_t readable = buffer->readableBytes();
+    if (readable > 0 && static_cast<uint8_t>(buffer->peek()[0]) == (kMagic >> 8))
+    {
+        return readable >= 8 ? Load<uint32_t>(buffer->peek() + 4) : readable;
+    }
+    return readable >= 4 ? 4 + static_cast<uint64_t>(static_cast<uint32_t>(buffer->peekInt32())) : readable;
+}
+
+void RPCCodec::AppendResponseFrame(const std::string& wrapperStr, std::string* frame)
+{
+    frame->reserve(frame->size() + 4 + wrapperStr.size());
+
+    uint32_t len = htonl(wrapperStr.size()); // 用大端序存储帧的长度
+    frame->append(reinterpret_cast<const char*>(&len), 4);
+    *frame += wrapperStr;
+}
+
+bool RPCCodec::EncodeResponse(const google::protobuf::Message& response, uint64_t streamId, bool endOfStream, size_t chunkSize,
+                              std::string* frames, size_t* dataSize)
+{
+    std::string data;
+    if (!response.SerializeToString(&data))
+    {
+        return false;
+    }
+    if (dataSize != nullptr)
+    {
+        *dataSize = data.size();
+    }
+
+    MyRPC::RPCResponseWrapper wrapper;
+    wrapper.set_success(true);
+    wrapper.mutable_error()->set_error_code(MyRPC::RPCResponseError::SUCCESS);
+    wrapper.mutable_error()->set_error_message("");
+    wrapper.set_stream_id(streamId);
+    wrapper.set_end_of_stream(endOfStream);
+
+    size_t chunkCnt = data.empty() ? 1 : (data.size() + chunkSize - 1) / chunkSize;
+    size_t oldSize = frames->size();
+    frames->reserve(oldSize + data.size() + chunkCnt * 32);
+
+    std::string wrapperStr;
+    for (size_t i = 0; i < chunkCnt; ++i)
+    {
+        size_t offset = i * chunkSize;
+        size_t pieceSize = std::min(chunkSize, data.size() - offset);
+        wrapper.set_data(data.data() + offset, pieceSize);
+        wrapper.set_more_chunks(i + 1 < chunkCnt);
+
+        if (!wrapper.SerializeToString(&wrapperStr))
+        {
+            frames->resize(oldSize);
+            return false;
+        }
+        AppendResponseFrame(wrapperStr, frames);
+    }
+    return true;
+}
@@ -1,7 +1,9 @@
 #include "RPCConfig.h"
+#include "RPCLog.h"
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <type_traits>
 
 // 删除字符串里开头和结尾的所有空白字符
 static std::string &trim(std::string &str)
@@ -22,15 +24,24 @@ static std::string &trim(std::string &str)
     return str;
 }
 
-// 读取配置文件信息
+// 读取配置文件信息，文件打不开时退出进程
 void RPCConfig::LoadConfigFile(const std::string &filePath)
 {
-    std::ifstream input(filePath);
-    if (!input.is_open())
+    if (!TryLoadConfigFile(filePath))
     {
         std::cout << "open " << filePath << " failed" << std::endl;
         exit(EXIT_FAILURE);
     }
+}
+
+// 读取配置文件信息，文件打不开时返回 false
+bool RPCConfig::TryLoadConfigFile(const std::string &filePath)
+{
+    std::ifstream input(filePath);
+    if (!input.is_open())
+    {
+        return false;
+    }
 
     std::string line;
     while (std::getline(input, line))
@@ -66,6 +77,7 @@ void RPCConfig::LoadConfigFile(const std::string &filePath)
             m_confmap.insert(std::make_pair(key, value));
         }
     }
+    return true;
 }
 
 // 查询配置文件信息
@@ -78,4 +90,52 @@ std::string RPCConfig::Load(const std::string &key) const
     }
 
     return "";
-}
\ No newline at end of file
+}
+
+// 查询所有以 prefix 开头的配置项，返回的 key 去掉了 prefix
+std::unordered_map<std::string, std::string> RPCConfig::LoadPrefix(const std::string &prefix) const
+{
+    std::unordered_map<std::string, std::string> result;
+    for (const auto &e : m_confmap)
+    {
+        if (e.first.size() > prefix.size() && e.first.compare(0, prefix.size(), prefix) == 0)
+        {
+            result.emplace(e.first.substr(prefix.size()), e.second);
+        }
+    }
+    return result;
+}
+
+// 读取数值型配置项，非法时输出警告并返回默认值
+template <typename T>
+T RPCConfig::LoadNumber(const std::string &key, T defaultValue, T minValue, T maxValue) const
+{
+    std::string value = Load(key);
+    if (value.empty())
+    {
+        return defaultValue;
+    }
+
+    try
+    {
+        size_t pos = 0;
+        long double n = std::is_integral<T>::value ? static_cast<long double>(std::stoll(value, &pos)) : std::stold(value, &pos);
+        if (pos == value.size() && n >= static_cast<long double>(minValue) && n <= static_cast<long double>(maxValue))
+        {
+            return static_cast<T>(n);
+        }
+    }
+    catch (...)
+    {
+    }
+    RPC_LOG(warn) << "invalid config " << key << "=" << value;
+    return defaultValue;
+}
+
+template int RPCConfig::LoadNumber<int>(const std::string &, int, int, int) const;
+template unsigned RPCConfig::LoadNumber<unsigned>(const std::string &, unsigned, unsigned, unsigned) const;
+template long RPCConfig::LoadNumber<long>(const std::string &, long, long, long) const;
+template unsigned long RPCConfig::LoadNumber<unsigned long>(const std::string &, unsigned long, unsigned long, unsigned long) const;
+template long long RPCConfig::LoadNumber<long long>(const std::string &, long long, long long, long long) const;
+template unsigned long long RPCConfig::LoadNumber<unsigned long long>(const std::string &, unsigned long long, unsigned long long, unsigned long long) const;
+template double RPCConfig::LoadNumber<double>(const std::string &, double, double, double) const;
@@ -1,16 +1,69 @@
 #include "RPCConnection.h"
-#include "Log.h"
+#include "RPCUring.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+#include "Header.pb.h"
+#include "Response.pb.h"
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <cstring>
+#include <cerrno>
+
+static const uint32_t kMaxFrameSize = 64 * 1024 * 1024; // 单帧响应的最大长度，和服务端的限制保持一致
+static const size_t kRecvChunkSize = 64 * 1024; // 每次从内核读取的最大字节数
+
+// 读取配置项 clientTransport，值为 io_uring 且当前环境支持时，客户端使用 io_uring 传输
+static bool UseUring()
+{
+    static const bool useUring = []() -> bool
+    {
+        if (RPCApplication::GetInstance().GetConfig().Load("clientTransport") != "io_uring")
+        {
+            return false;
+        }
+        if (!RPCUring::IsSupported())
+        {
+            RPC_LOG(warn) << "io_uring is not supported, clientTransport fallback to blocking";
+            return false;
+        }
+        return true;
+    }();
+    return useUring;
+}
 
 RPCConnection::RPCConnection(const std::string& ip, uint16_t port)
 : m_fd(-1),
   m_ip(ip),
   m_port(port),
-  m_lastUsed(std::chrono::steady_clock::now())
+  m_connected(false),
+  m_useUring(UseUring()),
+  m_lastUsed(std::chrono::steady_clock::now()),
+  m_lastPing(m_lastUsed)
 {
 }
 
+// 读取 TCP keepalive 相关的配置项，未配置时返回默认值
+static int LoadKeepAliveConfig(const std::string& key, int defaultValue)
+{
+    return RPCApplication::GetInstance().GetConfig().LoadNumber(key, defaultValue, 1);
+}
+
+// 开启 TCP keepalive，并且缩短探测周期，让内核尽快发现对端已经失效的空闲连接
+static void SetKeepAlive(int fd)
+{
+    static const int keepIdle = LoadKeepAliveConfig("tcpKeepIdle", 60);      // 空闲多少秒后开始探测
+    static const int keepInterval = LoadKeepAliveConfig("tcpKeepInterval", 10); // 探测间隔
+    static const int keepCount = LoadKeepAliveConfig("tcpKeepCount", 3);      // 探测失败多少次后认为连接断开
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(keepIdle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(keepInterval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(keepCount));
+}
+
 RPCConnection::~RPCConnection()
 {
     close();
@@ -26,7 +79,7 @@ bool RPCConnection::Connect()
     m_fd = ::socket(AF_INET, SOCK_STREAM, 0);
     if (m_fd == -1)
     {
-        LOG(Log::error) << "socket() err";
+        RPC_LOG(error) << "socket() err";
         return false;
     }
 
@@ -36,7 +89,7 @@ bool RPCConnection::Connect()
 
     if (inet_pton(AF_INET, m_ip.data(), &servaddr.sin_addr.s_addr) == -1)
     {
-        LOG(Log::error) << "inet_pton() " << m_ip << " err";
+        RPC_LOG(error) << "inet_pton() " << m_ip << " err";
         ::close(m_fd);
         m_fd = -1;
         return false;
@@ -44,13 +97,16 @@ bool RPCConnection::Connect()
 
     if (::connect(m_fd, (struct sockaddr*)&servaddr, sizeof(servaddr)) == -1)
     {
-        LOG(Log::error) << "connect() " << m_ip << ":" << m_port << " err";
+        RPC_LOG(error) << "connect() " << m_ip << ":" << m_port << " err";
         ::close(m_fd);
         m_fd = -1;
         return false;
     }
 
+    SetKeepAlive(m_fd);
+
     m_connected = true;
+    m_lastPing = std::chrono::steady_clock::now();
     return true;
 }
 
@@ -67,6 +123,7 @@ void RPCConnection::close()
         m_fd = -1;
         m_connected = false;
     }
+    m_pending.clear();
 }
 
 int RPCConnection::Send(const std::string& data)
@@ -76,6 +133,15 @@ int RPCConnection::Send(const std::string& data)
         return -1;
     }
 
+    if (m_useUring)
+    {
+        RPCUring* pUring = RPCUring::ThreadLocal();
+        if (pUring != nullptr)
+        {
+            return pUring->Send(m_fd, data.data(), data.size());
+        }
+    }
+
     return ::send(m_fd, data.data(), data.size(), MSG_NOSIGNAL);
 }   
 
@@ -86,5 +152,164 @@ int RPCConnection::Recv(char* buffer, size_t bufferSize)
         return -1;
     }
 
+    if (m_useUring)
+    {
+        RPCUring* pUring = RPCUring::ThreadLocal();
+        if (pUring != nullptr)
+        {
+            return pUring->Recv(m_fd, buffer, bufferSize);
+        }
+    }
+
     return ::recv(m_fd, buffer, bufferSize, 0);
-}
\ No newline at end of file
+}
+
+int RPCConnection::SendRecv(const std::string& data, char* buffer, size_t bufferSize)
+{
+    if (!m_connected)
+    {
+        return -1;
+    }
+
+    if (m_useUring)
+    {
+        RPCUring* pUring = RPCUring::ThreadLocal();
+        if (pUring != nullptr)
+        {
+            return pUring->SendRecv(m_fd, data.data(), data.size(), buffer, bufferSize);
+        }
+    }
+
+    // 阻塞 I/O：先完整发送，再接收
+    if (::send(m_fd, data.data(), data.size(), MSG_NOSIGNAL) == -1)
+    {
+        return -1;
+    }
+    return ::recv(m_fd, buffer, bufferSize, 0);
+}
+
+int RPCConnection::RecvFrame(std::string* frame)
+{
+    while (true)
+    {
+        if (m_pending.size() >= 4)
+        {
+            uint32_t len = 0;
+            memcpy(&len, m_pending.data(), 4);
+            len = ntohl(len); // 长度前缀是大端序
+            if (len >= kMaxFrameSize)
+            {
+                RPC_LOG(error) << "frame too large, len=" << len;
+                return -1;
+            }
+
+            if (m_pending.size() >= 4 + len) // 已经收到完整的一帧
+            {
+                frame->assign(m_pending, 4, len);
+                m_pending.erase(0, 4 + len);
+                return 1;
+            }
+        }
+
+        // 直接读到 m_pending 的尾部，避免额外拷贝
+        size_t oldSize = m_pending.size();
+        m_pending.resize(oldSize + kRecvChunkSize);
+        int n = Recv(&m_pending[oldSize], kRecvChunkSize);
+        m_pending.resize(oldSize + (n > 0 ? n : 0));
+        if (n <= 0)
+        {
+            return n;
+        }
+    }
+}
+
+int RPCConnection::SendRecvFrame(const std::string& data, std::string* frame)
+{
+    if (!m_pending.empty()) // 还有上一次调用遗留的数据，说明连接上的帧已经错位
+    {
+        RPC_LOG(warn) << "discard " << m_pending.size() << " stale bytes on " << m_ip << ":" << m_port;
+        m_pending.clear();
+    }
+
+    m_pending.resize(kRecvChunkSize);
+    int n = SendRecv(data, &m_pending[0], kRecvChunkSize);
+    m_pending.resize(n > 0 ? n : 0);
+    if (n <= 0)
+    {
+        return n;
+    }
+    return RecvFrame(frame);
+}
+
+bool RPCConnection::Probe(bool checkSocketError)
+{
+    if (!IsConnected())
+    {
+        return false;
+    }
+
+    if (checkSocketError) // 检查套接字上是否有未处理的错误，例如 keepalive 探测失败
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0)
+        {
+            RPC_LOG(info) << "probe " << m_ip << ":" << m_port << " so_error=" << err;
+            close();
+            return false;
+        }
+    }
+
+    // 空闲连接上不应该有可读数据：读到 0 说明对端已经关闭，读到数据说明有残留的旧响应，都不能再复用
+    char c;
+    ssize_t n = ::recv(m_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return true;
+    }
+
+    RPC_LOG(info) << "probe " << m_ip << ":" << m_port << " failed, recv=" << n;
+    close();
+    return false;
+}
+
+bool RPCConnection::Ping(int timeoutMs)
+{
+    // 心跳帧：4字节前缀长度 + headerSize(4字节) + header，不携带参数
+    static const std::string pingFrame = []()
+    {
+        MyRPC::RpcHeader header;
+        header.set_heartbeat(true);
+        std::string headerStr = header.SerializeAsString();
+
+        uint32_t headerSize = htonl(headerStr.size());
+        uint32_t totalSize = htonl(4 + headerStr.size());
+        std::string frame;
+        frame.append(reinterpret_cast<const char*>(&totalSize), 4);
+        frame.append(reinterpret_cast<const char*>(&headerSize), 4);
+        frame += headerStr;
+        return frame;
+    }();
+
+    if (!IsConnected() || ::send(m_fd, pingFrame.data(), pingFrame.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(pingFrame.size()))
+    {
+        close();
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    std::string frame;
+    MyRPC::RPCResponseWrapper wrapper;
+    if (::poll(&pfd, 1, timeoutMs) != 1 || RecvFrame(&frame) != 1 || !wrapper.ParseFromString(frame) || !wrapper.heartbeat())
+    {
+        RPC_LOG(info) << "ping " << m_ip << ":" << m_port << " failed";
+        close();
+        return false;
+    }
+
+    m_lastPing = std::chrono::steady_clock::now();
+    return true;
+}
@@ -1,11 +1,52 @@
 #include "RPCConnectionsPool.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+#include "RPCRegistry.h"
+#include <vector>
+#include <algorithm>
+
+// 熔断和离群摘除的参数
+struct BreakerConfig
+{
+    int m_consecutiveFailures = 5;
+    double m_errorRate = 0.5;
+    int64_t m_openMs = 5000;
+    double m_outlierLatencyFactor = 3; // 0 表示不做离群摘除
+};
+
+static const BreakerConfig& GetBreakerConfig()
+{
+    static const BreakerConfig breaker = []()
+    {
+        const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+        BreakerConfig b;
+        b.m_consecutiveFailures = config.LoadNumber("breakerConsecutiveFailures", b.m_consecutiveFailures, 1);
+        b.m_errorRate = config.LoadNumber("breakerErrorRate", b.m_errorRate, 0.0, 1.0);
+        b.m_openMs = config.LoadNumber<long>("breakerOpenMs", b.m_openMs, 1);
+        b.m_outlierLatencyFactor = config.LoadNumber("outlierLatencyFactor", b.m_outlierLatencyFactor, 0.0);
+        return b;
+    }();
+    return breaker;
+}
+
+static const auto kBreakerWindow = std::chrono::seconds(10); // 失败率的统计窗口
+static const uint32_t kBreakerMinCalls = 20;                  // 窗口内至少这么多调用才按失败率判断
+static const uint32_t kOutlierMinSamples = 10;                // 一轮离群检测里主机至少要有的样本数
+static const uint64_t kPruneRounds = 10;                      // 每隔多少轮清理一次已经离开注册中心的主机
 
 RPCConnectionsPool::RPCConnectionsPool()
 : m_maxIdleTime(300), // 默认最大空闲时间为5分钟
   m_maxConnectionsPerHost(10), // 默认单台主机最多10个连接
-  m_stopCleaner(false),
-  m_cleanerThread([this](){ RunCleaner(); })
+  m_heartbeatInterval(30), // 默认空闲30秒发送一次心跳
+  m_heartbeatTimeout(1000), // 默认心跳超时时间为1秒
+  m_stopCleaner(false)
 {
+    const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+    m_heartbeatInterval = config.LoadNumber("heartbeatInterval", m_heartbeatInterval.load(), 0);
+    m_heartbeatTimeout = config.LoadNumber("heartbeatTimeout", m_heartbeatTimeout.load(), 1);
+
+    // 所有成员初始化完毕之后再启动清理线程
+    m_cleanerThread = std::thread([this](){ RunCleaner(); });
 }
 
 RPCConnectionsPool::~RPCConnectionsPool()
@@ -30,36 +71,60 @@ void RPCConnectionsPool::CleanIdleConnections()
     std::lock_guard<std::mutex> lock(m_mtx);
     for (auto& e : m_idleConnection)
     {
-        while (!e.second.empty())
-        {
-            e.second.pop();
-        }
+        e.second.clear();
     }
 }
 
 std::shared_ptr<RPCConnection> RPCConnectionsPool::GetConnection(const std::string& ip, uint16_t port)
 {
-    std::lock_guard<std::mutex> lock(m_mtx);
     struct ConnectionKey key({ip, port});
+    int interval = m_heartbeatInterval.load();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_heartbeatTimeout.load());
 
-    // 首先在空闲连接map表里面查找
-    auto it = m_idleConnection.find(key);
-    if (it != m_idleConnection.end() && !it->second.empty())
+    std::unique_lock<std::mutex> lock(m_mtx);
+    while (true)
     {
-        auto pConn = std::move(it->second.front());
-        it->second.pop();
+        // 首先在空闲连接map表里面查找，跳过清理线程正在检查的连接
+        bool leased = false; // 是否有空闲连接正在被检查
+        auto it = m_idleConnection.find(key);
+        if (it != m_idleConnection.end())
+        {
+            auto pos = std::find_if(it->second.begin(), it->second.end(), [](const IdleConnection& c) { return !c.m_leased; });
+            leased = (pos == it->second.end() && !it->second.empty());
+            if (pos != it->second.end())
+            {
+                auto pConn = std::move(pos->m_pConn);
+                it->second.erase(pos);
 
-        if (pConn->IsConnected())
+                // 清理线程每秒探测一遍空闲连接，这里只探测空闲时间超过心跳间隔的连接，探测时不持有锁
+                if (interval <= 0 || std::chrono::steady_clock::now() - pConn->GetLastActiveTime() < std::chrono::seconds(interval))
+                {
+                    return pConn;
+                }
+                lock.unlock();
+                bool alive = pConn->Probe();
+                lock.lock();
+                if (alive)
+                {
+                    return pConn;
+                }
+                RemoveConnection(key); // 连接已失效
+                continue;
+            }
+        }
+
+        // 空闲连接map表里面没有找到，建立新的连接
+        // 在建立新的连接之前，检查一下目标主机的连接数量是否超过上限
+        if (m_connectionCount[key] < m_maxConnectionsPerHost)
         {
-            return pConn;
+            break;
         }
-    }
 
-    // 空闲连接map表里面没有找到，建立新的连接
-    // 在建立新的连接之前，检查一下目标主机的连接数量是否超过上限
-    if (m_connectionCount[key] >= m_maxConnectionsPerHost)
-    {
-        return nullptr; // 返回空指针
+        // 名额被正在检查的空闲连接占着，等它检查完，最多等一次心跳超时
+        if (!leased || m_leaseCond.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+            return nullptr; // 返回空指针
+        }
     }
 
     // 建立新的连接
@@ -70,9 +135,48 @@ std::shared_ptr<RPCConnection> RPCConnectionsPool::GetConnection(const std::stri
         return newConn;
     }
 
+    ReportResult(ip, port, "", false, 0); // 连接失败计入熔断器
     return nullptr;
 }
 
+int RPCConnectionsPool::Prewarm(const std::string& ip, uint16_t port, int count)
+{
+    ConnectionKey key({ip, port});
+    int reserved = 0;
+    {
+        // 先占住连接名额，建立连接的过程不持有锁，多个主机可以并行预热
+        std::lock_guard<std::mutex> lock(m_mtx);
+        int target = std::min(count, m_maxConnectionsPerHost);
+        reserved = std::max(0, target - m_connectionCount[key]);
+        m_connectionCount[key] += reserved;
+    }
+
+    std::vector<std::shared_ptr<RPCConnection>> conns;
+    for (int i = 0; i < reserved; ++i)
+    {
+        auto newConn = std::make_shared<RPCConnection>(ip, port);
+        if (newConn->Connect())
+        {
+            conns.push_back(std::move(newConn));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_connectionCount[key] -= reserved - static_cast<int>(conns.size()); // 归还建立失败的名额
+    for (auto& pConn : conns)
+    {
+        pConn->UpdateLastUsedTime();
+        m_idleConnection[key].push_back(IdleConnection{std::move(pConn)});
+    }
+
+    int total = m_connectionCount[key];
+    if (total == 0)
+    {
+        m_connectionCount.erase(key);
+    }
+    return total;
+}
+
 void RPCConnectionsPool::ReturnConnection(std::shared_ptr<RPCConnection> pConn)
 {
     if (!pConn)
@@ -87,65 +191,428 @@ void RPCConnectionsPool::ReturnConnection(std::shared_ptr<RPCConnection> pConn)
         pConn->UpdateLastUsedTime();
         std::lock_guard<std::mutex> lock(m_mtx);
 
-        m_idleConnection[key].push(std::move(pConn));
+        m_idleConnection[key].push_back(IdleConnection{std::move(pConn)});
     }
     else // 当前连接无效
     {
         std::lock_guard<std::mutex> lock(m_mtx);
-        auto it = m_connectionCount.find(key);
-        if (it != m_connectionCount.end()) 
+        RemoveConnection(key); // 将连接计数-1
+    }
+}
+
+void RPCConnectionsPool::RemoveConnection(const ConnectionKey& key)
+{
+    auto it = m_connectionCount.find(key);
+    if (it != m_connectionCount.end() && --it->second <= 0)
+    {
+        // 当主机的连接数减为0，就从 空闲连接map表 和 连接计数map表 里删除该主机
+        m_connectionCount.erase(it);
+        m_idleConnection.erase(key);
+    }
+}
+
+void RPCConnectionsPool::CheckIdleConnections(ConnectionList& candidates, const std::function<bool(RPCConnection&)>& check)
+{
+    // 在空闲队列里找到 pConn，找不到时返回 false。调用前需要持有 m_mtx
+    auto find = [this](const ConnectionKey& key, const std::shared_ptr<RPCConnection>& pConn, IdleQueue::iterator* pPos) -> bool
+    {
+        auto it = m_idleConnection.find(key);
+        if (it == m_idleConnection.end())
+        {
+            return false;
+        }
+        *pPos = std::find_if(it->second.begin(), it->second.end(), [&](const IdleConnection& e) { return e.m_pConn == pConn; });
+        return *pPos != it->second.end();
+    };
+
+    for (auto& c : candidates)
+    {
+        IdleQueue::iterator pos;
+        {
+            // 连接可能已经被 GetConnection 取走，只检查仍然空闲的
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!find(c.first, c.second, &pos) || pos->m_leased)
+            {
+                continue;
+            }
+            pos->m_leased = true;
+        }
+
+        bool alive = check(*c.second);
+
         {
-            if (--it->second == 0) // 将连接计数-1
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (find(c.first, c.second, &pos)) // 租出期间连接一直留在队列里，只有关闭连接池时才会被清空
             {
-                // 当主机的连接数减为0，就从 空闲连接map表 和 连接计数map表 里删除该主机
-                m_connectionCount.erase(key);
-                m_idleConnection.erase(key);
+                if (alive)
+                {
+                    pos->m_leased = false;
+                }
+                else
+                {
+                    m_idleConnection[c.first].erase(pos);
+                    RemoveConnection(c.first);
+                }
             }
         }
+        m_leaseCond.notify_all();
     }
 }
 
 void RPCConnectionsPool::CleanTimeOutConnections()
 {
-    auto now = std::chrono::steady_clock::now();
+    // 探测时不持有锁，不阻塞其他线程获取连接
+    ConnectionList candidates;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (const auto& e : m_idleConnection)
+        {
+            for (const auto& idle : e.second)
+            {
+                candidates.emplace_back(e.first, idle.m_pConn);
+            }
+        }
+    }
 
-    for (auto& e : m_idleConnection)
+    int maxIdleTime = m_maxIdleTime;
+    CheckIdleConnections(candidates, [maxIdleTime](RPCConnection& conn)
+    {
+        // 连接超时，或者对端已经关闭、套接字出错
+        auto idleDuration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - conn.GetLastUsedTime()).count();
+        return idleDuration < maxIdleTime && conn.Probe(true);
+    });
+}
+
+void RPCConnectionsPool::SendHeartbeats()
+{
+    int interval = m_heartbeatInterval.load();
+    if (interval <= 0)
+    {
+        return;
+    }
+
+    // 找出需要发送心跳的连接，发送心跳时不持有锁，不阻塞其他线程获取连接
+    auto now = std::chrono::steady_clock::now();
+    ConnectionList candidates;
     {
-        while (!e.second.empty())
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (const auto& e : m_idleConnection)
         {
-            // 从队头连接开始，获取它的空闲时间
-            auto idleDuration = std::chrono::duration_cast<std::chrono::seconds>(now - e.second.front()->GetLastUsedTime()).count();
-            if (idleDuration >= m_maxIdleTime) // 连接超时
+            for (const auto& idle : e.second)
             {
-                ConnectionKey key = e.first;
-                e.second.pop(); // 删除超时连接
-                if (--m_connectionCount[key] == 0) // 连接计数-1，如果连接计数减为零，则删除该主机
+                if (now - idle.m_pConn->GetLastActiveTime() >= std::chrono::seconds(interval))
                 {
-                    m_connectionCount.erase(key);
-                    m_idleConnection.erase(key);
+                    candidates.emplace_back(e.first, idle.m_pConn);
                 }
             }
-            else // 最老空闲连接都未超时，说明该队列里所有的连接都没有超时
+        }
+    }
+
+    int timeoutMs = m_heartbeatTimeout.load();
+    CheckIdleConnections(candidates, [timeoutMs](RPCConnection& conn) { return conn.Ping(timeoutMs); });
+}
+
+bool RPCConnectionsPool::AllowRequest(const std::string& ip, uint16_t port, bool* pProbe)
+{
+    if (pProbe != nullptr)
+    {
+        *pProbe = false;
+    }
+    if (m_openHosts.load(std::memory_order_relaxed) == 0)
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+    auto it = m_health.find(ConnectionKey{ip, port});
+    if (it == m_health.end() || it->second.m_state == HostHealth::kClosed)
+    {
+        return true;
+    }
+
+    HostHealth& health = it->second;
+    auto now = std::chrono::steady_clock::now();
+    auto openTime = std::chrono::milliseconds(GetBreakerConfig().m_openMs);
+    if (health.m_state == HostHealth::kOpen)
+    {
+        if (now < health.m_openUntil)
+        {
+            return false;
+        }
+        health.m_state = HostHealth::kHalfOpen;
+        health.m_probing = false;
+    }
+
+    // 半开：只放行一个探测调用。探测调用既没有报告结果也没有归还名额（例如调用方线程卡住）时，过一个打开时间再放行一个
+    if (health.m_probing && now - health.m_probeStart < openTime)
+    {
+        return false;
+    }
+    health.m_probing = true;
+    health.m_probeStart = now;
+    if (pProbe != nullptr)
+    {
+        *pProbe = true;
+    }
+    return true;
+}
+
+void RPCConnectionsPool::ReleaseProbe(const std::string& ip, uint16_t port)
+{
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+    auto it = m_health.find(ConnectionKey{ip, port});
+    if (it != m_health.end() && it->second.m_state == HostHealth::kHalfOpen) // 探测失败时已经重新打开，不需要归还
+    {
+        it->second.m_probing = false;
+    }
+}
+
+void RPCConnectionsPool::ReportResult(const std::string& ip, uint16_t port, const std::string& serviceName, bool success, uint64_t latencyNs)
+{
+    const BreakerConfig& config = GetBreakerConfig();
+    auto now = std::chrono::steady_clock::now();
+    ConnectionKey key{ip, port};
+
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+    HostHealth& health = m_health[key];
+    if (now - health.m_windowStart >= kBreakerWindow)
+    {
+        health.m_windowStart = now;
+        health.m_windowCalls = 0;
+        health.m_windowFailures = 0;
+    }
+    ++health.m_windowCalls;
+
+    if (success)
+    {
+        health.m_consecutiveFailures = 0;
+        if (health.m_state == HostHealth::kHalfOpen) // 探测成功，关闭熔断器
+        {
+            health.m_state = HostHealth::kClosed;
+            health.m_trips = 0;
+            health.m_windowCalls = 0;
+            health.m_windowFailures = 0;
+            m_openHosts.fetch_sub(1, std::memory_order_relaxed);
+            ResetLatency(health); // 重新进入连接池，从探测调用开始重新统计延迟
+            RPC_LOG(info) << "circuit closed, host=" << ip << ":" << port;
+        }
+        if (!serviceName.empty())
+        {
+            auto& latency = health.m_latency[serviceName];
+            latency.first = latency.first == 0 ? latencyNs : latency.first * 0.9 + latencyNs * 0.1;
+            ++latency.second;
+        }
+        return;
+    }
+
+    ++health.m_consecutiveFailures;
+    ++health.m_windowFailures;
+    if (health.m_state == HostHealth::kHalfOpen)
+    {
+        Trip(key, health, "probe failed");
+    }
+    else if (health.m_state == HostHealth::kClosed)
+    {
+        if (health.m_consecutiveFailures >= config.m_consecutiveFailures)
+        {
+            Trip(key, health, "consecutive failures");
+        }
+        else if (health.m_windowCalls >= kBreakerMinCalls && health.m_windowFailures >= config.m_errorRate * health.m_windowCalls)
+        {
+            Trip(key, health, "error rate");
+        }
+    }
+}
+
+bool RPCConnectionsPool::IsAvailable(const std::string& endpoint)
+{
+    if (m_openHosts.load(std::memory_order_relaxed) == 0)
+    {
+        return true;
+    }
+
+    size_t pos = endpoint.find(':');
+    if (pos == std::string::npos)
+    {
+        return true;
+    }
+    ConnectionKey key{endpoint.substr(0, pos), static_cast<uint16_t>(std::atoi(endpoint.c_str() + pos + 1))};
+
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+    auto it = m_health.find(key);
+    if (it == m_health.end() || it->second.m_state == HostHealth::kClosed)
+    {
+        return true;
+    }
+    return it->second.m_state == HostHealth::kOpen && std::chrono::steady_clock::now() >= it->second.m_openUntil; // 可以开始半开探测
+}
+
+void RPCConnectionsPool::Trip(const ConnectionKey& key, HostHealth& health, const char* reason)
+{
+    if (health.m_state == HostHealth::kClosed)
+    {
+        m_openHosts.fetch_add(1, std::memory_order_relaxed);
+    }
+    int64_t openMs = GetBreakerConfig().m_openMs << std::min(health.m_trips, 3);
+    health.m_state = HostHealth::kOpen;
+    health.m_openUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(openMs);
+    health.m_probing = false;
+    ++health.m_trips;
+    ResetLatency(health); // 摘除前的延迟不代表恢复之后的情况
+    RPC_LOG(warn) << "circuit open (" << reason << "), host=" << key.ip << ":" << key.port << " for " << openMs << " ms";
+}
+
+void RPCConnectionsPool::ResetLatency(HostHealth& health)
+{
+    // 保留服务名，摘除的主机仍然计入该服务的主机数，同一服务最多摘除一半的限制才有效
+    for (auto& latency : health.m_latency)
+    {
+        latency.second = std::make_pair(0.0, 0u);
+    }
+}
+
+void RPCConnectionsPool::PruneHosts()
+{
+    // 按服务收集主机，查询注册中心时不持有锁
+    std::unordered_map<std::string, std::vector<ConnectionKey>> services;
+    {
+        std::lock_guard<std::mutex> lock(m_healthMtx);
+        for (const auto& e : m_health)
+        {
+            for (const auto& latency : e.second.m_latency)
+            {
+                services[latency.first].push_back(e.first);
+            }
+        }
+    }
+    if (services.empty())
+    {
+        return;
+    }
+
+    // 注册中心里已经没有该主机的服务，删除对应的延迟统计
+    std::vector<std::pair<ConnectionKey, std::string>> gone;
+    RPCRegistry* pRegistry = RPCRegistry::GetInstance();
+    for (const auto& service : services)
+    {
+        std::vector<std::string> endpoints = pRegistry->ListEndpoints(service.first);
+        for (const auto& key : service.second)
+        {
+            if (std::find(endpoints.begin(), endpoints.end(), key.ip + ":" + std::to_string(key.port)) == endpoints.end())
             {
-                break;
+                gone.emplace_back(key, service.first);
             }
         }
     }
+
+    // 所有服务都已经下线的主机删除整个健康状态
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+    for (const auto& e : gone)
+    {
+        auto it = m_health.find(e.first);
+        if (it == m_health.end())
+        {
+            continue;
+        }
+        it->second.m_latency.erase(e.second);
+        if (!it->second.m_latency.empty())
+        {
+            continue;
+        }
+        if (it->second.m_state != HostHealth::kClosed)
+        {
+            m_openHosts.fetch_sub(1, std::memory_order_relaxed);
+        }
+        RPC_LOG(info) << "host " << e.first.ip << ":" << e.first.port << " left the registry, health dropped";
+        m_health.erase(it);
+    }
 }
 
-void RPCConnectionsPool::RunCleaner()
+void RPCConnectionsPool::DetectOutliers()
 {
-    if (!m_stopCleaner.load())
+    double factor = GetBreakerConfig().m_outlierLatencyFactor;
+    if (factor <= 0)
     {
-        // 每分钟检查一次是否有超时连接
-        std::unique_lock<std::mutex> lock(m_mtx);
-        m_cond.wait_for(lock, std::chrono::seconds(1));
-        if (!m_stopCleaner.load())
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_healthMtx);
+
+    // 按服务收集本轮样本足够的主机
+    std::unordered_map<std::string, std::vector<std::pair<double, const ConnectionKey*>>> services;
+    std::unordered_map<std::string, size_t> hostsPerService;
+    std::unordered_map<std::string, size_t> openPerService;
+    for (auto& e : m_health)
+    {
+        for (auto& latency : e.second.m_latency)
         {
-            CleanTimeOutConnections();
+            ++hostsPerService[latency.first];
+            openPerService[latency.first] += e.second.m_state != HostHealth::kClosed ? 1 : 0;
+            if (e.second.m_state == HostHealth::kClosed && latency.second.second >= kOutlierMinSamples)
+            {
+                services[latency.first].emplace_back(latency.second.first, &e.first);
+            }
+            latency.second.second = 0; // 开始新一轮
         }
     }
-}
 
+    for (auto& service : services)
+    {
+        std::vector<std::pair<double, const ConnectionKey*>>& hosts = service.second;
+        if (hosts.size() < 3) // 主机太少，没有可比的同伴
+        {
+            continue;
+        }
+        std::vector<double> latencies;
+        for (const auto& host : hosts)
+        {
+            latencies.push_back(host.first);
+        }
+        std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+        double median = latencies[latencies.size() / 2];
 
+        size_t maxEjected = hostsPerService[service.first] / 2;
+        size_t ejected = openPerService[service.first]; // 已经摘除或者熔断的主机也算在内
+        std::sort(hosts.begin(), hosts.end(), [](const std::pair<double, const ConnectionKey*>& a, const std::pair<double, const ConnectionKey*>& b)
+                  { return a.first > b.first; });
+        for (const auto& host : hosts)
+        {
+            if (ejected >= maxEjected || host.first < factor * median || host.first - median < 1e6)
+            {
+                break;
+            }
+            HostHealth& health = m_health[*host.second];
+            if (health.m_state == HostHealth::kClosed)
+            {
+                RPC_LOG(warn) << "latency outlier, service=" << service.first << " latency=" << static_cast<uint64_t>(host.first / 1000)
+                              << "us median=" << static_cast<uint64_t>(median / 1000) << "us";
+                Trip(*host.second, health, "latency outlier");
+                ++ejected;
+            }
+        }
+    }
+}
 
+void RPCConnectionsPool::RunCleaner()
+{
+    uint64_t rounds = 0;
+    while (!m_stopCleaner.load())
+    {
+        // 每秒检查一次是否有超时或者失效的连接
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait_for(lock, std::chrono::seconds(1));
+            if (m_stopCleaner.load())
+            {
+                break;
+            }
+        }
+        CleanTimeOutConnections();
+        SendHeartbeats();
+        DetectOutliers();
+        if (++rounds % kPruneRounds == 0)
+        {
+            PruneHosts();
+        }
+    }
+}
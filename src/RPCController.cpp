@@ -1,7 +1,7 @@
 #include "RPCController.h"
 
 RPCController::RPCController()
-:m_failed(false), m_errMsg("")
+:m_failed(false), m_errMsg(""), m_retries(0)
 {
 }
 
@@ -10,6 +10,8 @@ void RPCController::Reset()
 {
     m_failed = false;
     m_errMsg.clear();
+    m_trace = RPCTraceContext();
+    m_retries = 0;
 }
 
 // 判断 RPC 调用是否失败。必须在调用完成后才能调用此方法
@@ -47,5 +49,46 @@ void RPCController::NotifyOnCancel(google::protobuf::Closure* callback)
 {
 }
 
+// 当前调用是否为客户端发起的流式调用
+bool RPCController::IsStreaming() const
+{
+    return static_cast<bool>(m_streamWriter);
+}
+
+// 向客户端发送一帧流式响应，非流式调用或者连接已断开时返回 false
+bool RPCController::Write(const google::protobuf::Message& msg)
+{
+    if (!m_streamWriter)
+    {
+        return false;
+    }
+    return m_streamWriter(msg);
+}
+
+// 由 RPCProvider 在分发流式调用前设置
+void RPCController::SetStreamWriter(std::function<bool(const google::protobuf::Message&)> writer)
+{
+    m_streamWriter = std::move(writer);
+}
+
+// 服务端：本次调用的上下文，由 RPCProvider 设置。客户端：用户设置后作为发起调用的父上下文
+const RPCTraceContext& RPCController::GetTraceContext() const
+{
+    return m_trace;
+}
 
+void RPCController::SetTraceContext(const RPCTraceContext& ctx)
+{
+    m_trace = ctx;
+}
 
+// 客户端：上一次调用重试的次数，由 RPCChannel 设置
+int RPCController::RetryCount() const
+{
+    return m_retries;
+}
+
+void RPCController::SetRetryCount(int count)
+{
+    m_retries = count;
+}
@@ -0,0 +1,304 @@
+#include "RPCLog.h"
+#include "RPCApplication.h"
+#include "AsyncLogging.h"
+#include "Log.h"
+
+#include <chrono>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<int> RPCLog::s_level(RPCLog::info);
+std::atomic<uint32_t> RPCLog::s_rateLimit(100);
+
+namespace
+{
+    // 多生产者单消费者的有界无锁队列（基于序号的环形数组）。槽里的 string 复用容量，稳定之后入队不再分配内存
+    class RPCLogQueue
+    {
+    public:
+        static constexpr size_t kCapacity = 8192; // 必须是 2 的幂
+
+        static RPCLogQueue* GetInstance()
+        {
+            static RPCLogQueue* instance = []()
+            {
+                RPCLogQueue* p = new RPCLogQueue(); // 进程退出前不释放，避免退出时其他线程还在打日志
+                std::atexit([]() { RPCLogQueue::GetInstance()->Drain(); });
+                return p;
+            }();
+            return instance;
+        }
+
+        // 队列满时丢弃，返回 false
+        bool Push(const char* data, size_t len)
+        {
+            size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Slot& slot = m_slots[pos & (kCapacity - 1)];
+                size_t seq = slot.m_seq.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        slot.m_data.assign(data, len);
+                        slot.m_seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) // 消费者还没有读走这个槽，队列已满
+                {
+                    m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    pos = m_enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // 把队列里的日志全部交给后端
+        void Drain()
+        {
+            std::lock_guard<std::mutex> lock(m_drainMtx);
+
+            bool async = AsyncLogging::exist;
+            std::ostream& os = Log::GetOutputStream();
+            if (async)
+            {
+                AsyncLogging::getInstance()->setOutput(&os);
+            }
+
+            uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0)
+            {
+                std::string msg = "RPCLog queue full, dropped " + std::to_string(dropped) + " records\n";
+                Write(async, os, msg.data(), msg.size());
+            }
+
+            while (true)
+            {
+                Slot& slot = m_slots[m_dequeuePos & (kCapacity - 1)];
+                if (slot.m_seq.load(std::memory_order_acquire) != m_dequeuePos + 1) // 队列已空
+                {
+                    break;
+                }
+                Write(async, os, slot.m_data.data(), slot.m_data.size());
+                slot.m_seq.store(m_dequeuePos + kCapacity, std::memory_order_release);
+                ++m_dequeuePos;
+            }
+
+            if (!async)
+            {
+                os.flush();
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> m_seq;
+            std::string m_data;
+        };
+
+        RPCLogQueue()
+        : m_slots(kCapacity)
+        {
+            for (size_t i = 0; i < kCapacity; ++i)
+            {
+                m_slots[i].m_seq.store(i, std::memory_order_relaxed);
+            }
+
+            // 后台线程定期把日志交给后端，打日志的线程不需要唤醒它
+            std::thread([this]()
+            {
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    Drain();
+                }
+            }).detach();
+        }
+
+        static void Write(bool async, std::ostream& os, const char* data, size_t len)
+        {
+            if (async)
+            {
+                AsyncLogging::getInstance()->Append(data, len);
+            }
+            else
+            {
+                os.write(data, len);
+            }
+        }
+
+        std::vector<Slot> m_slots;
+        std::atomic<size_t> m_enqueuePos{0};
+        size_t m_dequeuePos = 0;            // 只在持有 m_drainMtx 时访问
+        std::mutex m_drainMtx;
+        std::atomic<uint64_t> m_dropped{0};
+    };
+
+    const char* LevelName(RPCLog::Level level)
+    {
+        switch (level)
+        {
+        case RPCLog::debug: return "DEBUG ";
+        case RPCLog::info:  return "INFO  ";
+        case RPCLog::warn:  return "WARN  ";
+        default:            return "ERROR ";
+        }
+    }
+
+    // 当前线程的格式化缓冲区
+    struct LocalBuffer
+    {
+        std::string m_buf;
+        bool m_inUse = false;
+        long m_tid = syscall(SYS_gettid);
+        time_t m_cachedSecond = 0;
+        char m_cachedTime[32] = {0}; // 同一秒内复用格式化好的时间
+    };
+
+    LocalBuffer& GetLocalBuffer()
+    {
+        static thread_local LocalBuffer buffer;
+        return buffer;
+    }
+
+    // 追加 "YYYY-mm-dd HH:MM:SS.uuuuuu "
+    void AppendTime(LocalBuffer& local, std::string* buf)
+    {
+        struct timeval tv;
+        gettimeofday(&tv, nullptr);
+        if (tv.tv_sec != local.m_cachedSecond)
+        {
+            struct tm tmTime;
+            localtime_r(&tv.tv_sec, &tmTime);
+            strftime(local.m_cachedTime, sizeof(local.m_cachedTime), "%Y-%m-%d %H:%M:%S", &tmTime);
+            local.m_cachedSecond = tv.tv_sec;
+        }
+        char usec[16];
+        int n = snprintf(usec, sizeof(usec), ".%06ld ", static_cast<long>(tv.tv_usec));
+        buf->append(local.m_cachedTime);
+        buf->append(usec, n);
+    }
+}
+
+void RPCLog::LoadConfig()
+{
+    const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+    std::string level = config.Load("logLevel");
+    if (level == "debug") SetLevel(debug);
+    else if (level == "info") SetLevel(info);
+    else if (level == "warn") SetLevel(warn);
+    else if (level == "error") SetLevel(error);
+
+    SetRateLimit(config.LoadNumber<unsigned>("logRateLimit", RateLimit()));
+}
+
+void RPCLog::Flush()
+{
+    RPCLogQueue::GetInstance()->Drain();
+}
+
+bool RPCLogSite::Admit()
+{
+    uint32_t limit = RPCLog::RateLimit();
+    if (limit == 0)
+    {
+        return true;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t second = static_cast<uint64_t>(ts.tv_sec);
+    uint64_t window = m_window.load(std::memory_order_relaxed);
+    if (window != second && m_window.compare_exchange_strong(window, second, std::memory_order_relaxed))
+    {
+        m_count.store(0, std::memory_order_relaxed); // 进入新的一秒，重新计数
+    }
+
+    if (m_count.fetch_add(1, std::memory_order_relaxed) < limit)
+    {
+        return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+RPCLogRecord::RPCLogRecord(RPCLog::Level level, const char* file, int line, const char* func, RPCLogSite* site)
+: m_site(site)
+{
+    LocalBuffer& local = GetLocalBuffer();
+    m_nested = local.m_inUse; // 格式化参数时又打了日志，不能复用线程局部的缓冲区
+    m_buf = m_nested ? &m_own : &local.m_buf;
+    local.m_inUse = true;
+
+    m_buf->clear();
+    AppendTime(local, m_buf);
+    m_buf->append(LevelName(level));
+    AppendInteger(static_cast<long long>(local.m_tid));
+    const char* base = strrchr(file, '/');
+    *this << ' ' << (base == nullptr ? file : base + 1) << ':' << line << ' ' << func << " - ";
+}
+
+RPCLogRecord::~RPCLogRecord()
+{
+    uint64_t suppressed = m_site->TakeSuppressed();
+    if (suppressed != 0)
+    {
+        *this << " (suppressed " << suppressed << " similar messages)";
+    }
+    m_buf->push_back('\n');
+
+    RPCLogQueue::GetInstance()->Push(m_buf->data(), m_buf->size());
+
+    if (!m_nested)
+    {
+        GetLocalBuffer().m_inUse = false;
+    }
+}
+
+RPCLogRecord& RPCLogRecord::AppendInteger(long long v)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), v);
+    m_buf->append(digits, result.ptr - digits);
+    return *this;
+}
+
+RPCLogRecord& RPCLogRecord::AppendInteger(unsigned long long v)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), v);
+    m_buf->append(digits, result.ptr - digits);
+    return *this;
+}
+
+RPCLogRecord& RPCLogRecord::operator<<(double v)
+{
+    char digits[32];
+    int n = snprintf(digits, sizeof(digits), "%g", v);
+    m_buf->append(digits, n);
+    return *this;
+}
+
+RPCLogRecord& RPCLogRecord::operator<<(const void* p)
+{
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%p", p);
+    m_buf->append(digits, n);
+    return *this;
+}
@@ -0,0 +1,186 @@
+#include "RPCMemoryBudget.h"
+#include "RPCApplication.h"
+#include "Stats.pb.h"
+#include "RPCLog.h"
+
+// 读取上限配置项，不能为负数
+static long long LoadLimitConfig(const std::string& key, long long defaultValue)
+{
+    return RPCApplication::GetInstance().GetConfig().LoadNumber(key, defaultValue, 0LL);
+}
+
+RPCMemoryBudget* RPCMemoryBudget::GetInstance()
+{
+    static RPCMemoryBudget instance;
+    return &instance;
+}
+
+RPCMemoryBudget::RPCMemoryBudget()
+: m_connectionLimit(LoadLimitConfig("maxConnectionMemoryMB", 64) * 1024 * 1024),
+  m_totalLimit(LoadLimitConfig("maxTotalMemoryMB", 1024) * 1024 * 1024),
+  m_inFlightCallLimit(LoadLimitConfig("maxInFlightCalls", 0))
+{
+    for (auto& used : m_used)
+    {
+        used.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t RPCMemoryBudget::Used(Category category) const
+{
+    if (category != kCategoryCount)
+    {
+        return m_used[category].load(std::memory_order_relaxed);
+    }
+
+    uint64_t total = 0;
+    for (const auto& used : m_used)
+    {
+        total += used.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+bool RPCMemoryBudget::AdmitFrame(const RPCConnMemory& conn, uint64_t frameBytes)
+{
+    // 输入缓冲区里已经有这帧的一部分，收完之后 input 变成 frameBytes
+    uint64_t input = conn.Used(kInput);
+    uint64_t growth = frameBytes > input ? frameBytes - input : 0;
+    if (conn.Used() + growth <= m_connectionLimit && Used() + growth <= m_totalLimit)
+    {
+        return true;
+    }
+    m_rejectedFrames.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool RPCMemoryBudget::AdmitReassembly(const RPCConnMemory& conn, uint64_t reassemblyBytes)
+{
+    uint64_t current = conn.Used(kReassembly);
+    uint64_t growth = reassemblyBytes > current ? reassemblyBytes - current : 0;
+    if (conn.Used() + growth <= m_connectionLimit && Used() + growth <= m_totalLimit)
+    {
+        return true;
+    }
+    m_rejectedFrames.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool RPCMemoryBudget::AdmitCall(const RPCConnMemory& conn)
+{
+    bool admit = Used() <= m_totalLimit                                // 进程还有余量
+              && conn.Used(kOutput) <= m_connectionLimit                // 客户端在正常读取响应
+              && (m_inFlightCallLimit == 0 || InFlightCalls() < m_inFlightCallLimit);
+    if (!admit)
+    {
+        m_rejectedCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+    return admit;
+}
+
+void RPCMemoryBudget::Fill(MyRPC::MemoryStats* stats) const
+{
+    stats->set_input_bytes(Used(kInput));
+    stats->set_reassembly_bytes(Used(kReassembly));
+    stats->set_in_flight_bytes(Used(kInFlight));
+    stats->set_output_bytes(Used(kOutput));
+    stats->set_total_bytes(Used());
+    stats->set_total_limit_bytes(m_totalLimit);
+    stats->set_connection_limit_bytes(m_connectionLimit);
+    stats->set_in_flight_calls(InFlightCalls());
+    stats->set_connections(m_connections.load(std::memory_order_relaxed));
+    stats->set_rejected_frames(m_rejectedFrames.load(std::memory_order_relaxed));
+    stats->set_rejected_calls(m_rejectedCalls.load(std::memory_order_relaxed));
+}
+
+RPCConnMemory::RPCConnMemory()
+{
+    for (auto& used : m_used)
+    {
+        used.store(0, std::memory_order_relaxed);
+    }
+    RPCMemoryBudget::GetInstance()->m_connections.fetch_add(1, std::memory_order_relaxed);
+}
+
+RPCConnMemory::~RPCConnMemory()
+{
+    RPCMemoryBudget* pBudget = RPCMemoryBudget::GetInstance();
+    for (int i = 0; i < RPCMemoryBudget::kCategoryCount; ++i)
+    {
+        pBudget->m_used[i].fetch_sub(m_used[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    pBudget->m_inFlightCalls.fetch_sub(m_calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    pBudget->m_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RPCConnMemory::Set(RPCMemoryBudget::Category category, uint64_t bytes)
+{
+    uint64_t old = m_used[category].exchange(bytes, std::memory_order_relaxed);
+    RPCMemoryBudget::GetInstance()->m_used[category].fetch_add(bytes - old, std::memory_order_relaxed); // 无符号回绕，等价于加上差值
+    if (category == RPCMemoryBudget::kOutput && bytes < old)
+    {
+        // 先加锁再通知：等待的线程在锁里检查条件，不会错过这次唤醒
+        std::lock_guard<std::mutex> lock(m_outputMtx);
+        m_outputCond.notify_all();
+    }
+}
+
+void RPCConnMemory::Add(RPCMemoryBudget::Category category, uint64_t bytes)
+{
+    m_used[category].fetch_add(bytes, std::memory_order_relaxed);
+    RPCMemoryBudget::GetInstance()->m_used[category].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void RPCConnMemory::Sub(RPCMemoryBudget::Category category, uint64_t bytes)
+{
+    m_used[category].fetch_sub(bytes, std::memory_order_relaxed);
+    RPCMemoryBudget::GetInstance()->m_used[category].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+uint64_t RPCConnMemory::Used(RPCMemoryBudget::Category category) const
+{
+    if (category != RPCMemoryBudget::kCategoryCount)
+    {
+        return m_used[category].load(std::memory_order_relaxed);
+    }
+
+    uint64_t total = 0;
+    for (const auto& used : m_used)
+    {
+        total += used.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void RPCConnMemory::CallStarted()
+{
+    m_calls.fetch_add(1, std::memory_order_relaxed);
+    RPCMemoryBudget::GetInstance()->m_inFlightCalls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RPCConnMemory::CallFinished()
+{
+    m_calls.fetch_sub(1, std::memory_order_relaxed);
+    RPCMemoryBudget::GetInstance()->m_inFlightCalls.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RPCConnMemory::Release()
+{
+    m_closed.store(true, std::memory_order_release);
+    Set(RPCMemoryBudget::kInput, 0);
+    Set(RPCMemoryBudget::kReassembly, 0);
+    Set(RPCMemoryBudget::kOutput, 0);
+
+    std::lock_guard<std::mutex> lock(m_outputMtx); // output 原来就是 0 时 Set 不通知，这里唤醒还在等待的流
+    m_outputCond.notify_all();
+}
+
+bool RPCConnMemory::WaitOutput(uint64_t bytes, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(m_outputMtx);
+    m_outputCond.wait_for(lock, timeout, [this, bytes]()
+    {
+        return Closed() || m_used[RPCMemoryBudget::kOutput].load(std::memory_order_relaxed) <= bytes;
+    });
+    return !Closed() && m_used[RPCMemoryBudget::kOutput].load(std::memory_order_relaxed) <= bytes;
+}
@@ -1,12 +1,43 @@
 #include "RPCProvider.h"
 #include "RPCApplication.h"
-#include "Header.pb.h"
 #include "Response.pb.h"
 #include "RPCController.h"
-#include "ZooKeeperUtil.h"
+#include "RPCRegistry.h"
+#include "RPCChunk.h"
+#include "RPCCodec.h"
+#include "RPCStats.h"
+#include "RPCStatsService.h"
+#include "RPCProbes.h"
 
 #include "TcpServer.h"
-#include "Log.h"
+#include "ThreadPool.h"
+#include "RPCLog.h"
+#include "RPCRateLimiter.h"
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstring>
+
+static RPCProvider* g_pSignalProvider = nullptr; // 收到停止信号时通知的提供者
+
+RPCProvider::RPCProvider()
+{
+    sem_init(&m_shutdownSem, 0, 0);
+}
+
+RPCProvider::~RPCProvider()
+{
+    if (g_pSignalProvider == this)
+    {
+        g_pSignalProvider = nullptr;
+    }
+    m_pStreamPool.reset(); // 先停止工作线程，流式调用的 handler 还在使用本对象
+    sem_destroy(&m_shutdownSem);
+}
 
 // 框架暴露给外部的接口，用来发布（注册） RPC 远程调用服务
 void RPCProvider::NotifyService(google::protobuf::Service *gService)
@@ -16,6 +47,13 @@ void RPCProvider::NotifyService(google::protobuf::Service *gService)
     // 获取待注册的服务对象的描述信息
     const google::protobuf::ServiceDescriptor *serviceDesc = gService->GetDescriptor();
 
+    // 内置统计服务的名字是保留的
+    if (serviceDesc->name() == MyRPC::RPCStatsService::descriptor()->name() && gService != m_pStatsService.get())
+    {
+        RPC_LOG(error) << "service name " << static_cast<std::string>(serviceDesc->name()) << " is reserved";
+        return;
+    }
+
     // 将service对象的所有方法都记录到 serviceInfo
     int methodCnt = serviceDesc->method_count();
     for (int i = 0; i < methodCnt; ++i)
@@ -31,165 +69,687 @@ void RPCProvider::NotifyService(google::protobuf::Service *gService)
     m_serviceMap.insert(std::make_pair(serviceDesc->name(), std::move(serviceInfo)));
 }
 
+// 进程累计使用的 CPU 时间（纳秒）
+static uint64_t ProcessCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// 后台线程定期把负载写回注册中心，配置项 loadReportInterval（秒）为 0 时不发布
+static void StartLoadReporter(RPCRegistry* pRegistry)
+{
+    int interval = RPCApplication::GetInstance().GetConfig().LoadNumber("loadReportInterval", 5, 0);
+    if (interval <= 0)
+    {
+        return;
+    }
+
+    std::thread([pRegistry, interval]()
+    {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        uint64_t lastCpuNs = ProcessCpuNs();
+        auto lastWall = std::chrono::steady_clock::now();
+        double published = RPCRegistry::EffectiveWeight(1, RPCRegistry::LoadReport()); // 刚注册时的清单里没有负载
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(interval));
+
+            uint64_t cpuNs = ProcessCpuNs();
+            auto wall = std::chrono::steady_clock::now();
+            uint64_t wallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(wall - lastWall).count();
+            RPCMemoryBudget* pBudget = RPCMemoryBudget::GetInstance();
+            RPCRegistry::LoadReport load;
+            load.m_inFlightCalls = static_cast<uint32_t>(std::max<int64_t>(0, pBudget->InFlightCalls()));
+            load.m_queuedBytes = pBudget->Used(RPCMemoryBudget::kInput) + pBudget->Used(RPCMemoryBudget::kReassembly) + pBudget->Used(RPCMemoryBudget::kOutput);
+            load.m_cpuPermille = static_cast<uint32_t>(std::min<uint64_t>(1000, (cpuNs - lastCpuNs) * 1000 / std::max<uint64_t>(1, wallNs * cores)));
+            lastCpuNs = cpuNs;
+            lastWall = wall;
+
+            // 折算后的权重变化不到 10% 时不发布：每次写结点都会让所有客户端重新读取清单，负载的小幅波动不值得
+            double factor = RPCRegistry::EffectiveWeight(1, load);
+            if (std::fabs(factor - published) < 0.1 * published)
+            {
+                continue;
+            }
+            pRegistry->ReportLoad(load);
+            published = factor;
+            RPC_LOG(debug) << "load reported, inflight=" << load.m_inFlightCalls << " queued=" << load.m_queuedBytes << " cpu=" << load.m_cpuPermille;
+        }
+    }).detach();
+}
+
+
 // 启动 RPC 服务结点，开始提供远程网络调用服务
 void RPCProvider::Run()
 {
+    auto runStart = std::chrono::steady_clock::now();
     std::string ip = RPCApplication::GetInstance().GetConfig().Load("rpcAddr");
     uint16_t port = std::stoi(RPCApplication::GetInstance().GetConfig().Load("rpcPort").data());
 
-    TcpServer tcpServer(ip, port, 4); // 定义TcpServer 对象，设置服务器ip、端口和子线程个数
+    m_pTcpServer.reset(new TcpServer(ip, port, 4)); // 创建TcpServer 对象，设置服务器ip、端口和子线程个数
+    m_pStreamPool.reset(new ThreadPool(RPCApplication::GetInstance().GetConfig().LoadNumber<size_t>("streamThreads", 4, 1), "WORK"));
 
     // 设置通信的回调函数
-    tcpServer.sethandlemessage([this](std::shared_ptr<Connection> pConn, Buffer *buffer)
+    m_pTcpServer->sethandlemessage([this](std::shared_ptr<Connection> pConn, Buffer *buffer)
                                 { OnMessage(pConn, buffer); });
+    m_pTcpServer->sethandlesendcomplete([this](std::shared_ptr<Connection> pConn)
+                                    { OnSendComplete(pConn); });
+    m_pTcpServer->sethandledeleteconnectioncb([this](int fd)
+                                    { OnConnectionClosed(fd); });
+
+    // 和用户服务一起发布内置的统计服务，配置项 statsService = off 时不发布
+    if (RPCApplication::GetInstance().GetConfig().Load("statsService") != "off" && m_pStatsService == nullptr)
+    {
+        m_pStatsService.reset(new RPCStatsService());
+        NotifyService(m_pStatsService.get());
+    }
 
-    // 向 zkServer 上发布服务    
-    ZkClient zk; // 定义 zkClient 对象，通过该对象和 zkServer 通信
-    zk.Start(); // 连接 zkServer 服务器
+    // 限流规则在注册之前生效，配置了 rateLimitFile 时后台监视文件的修改
+    RPCRateLimiter::GetInstance()->Start();
 
+    // 向注册中心发布服务（由配置项 registry 选择 zookeeper 或者进程内的静态注册中心）
+    RPCRegistry* pRegistry = RPCRegistry::GetInstance();
+    std::string endpoint(ip + ":" + std::to_string(port)); // 提供者地址："IP:Port"
+    RPCRegistry::ServiceMethods& services = m_registered;
     for (const auto& e1 : m_serviceMap)
     {
-        std::string servicePath("/" + e1.first); // 服务结点所在路径: /serviceName
-        zk.Create(servicePath.data(), nullptr, 0, 0); // 服务结点需要作为父节点，所以创建为永久性结点
+        std::vector<std::string>& methods = services[e1.first];
         for (const auto& e2 : e1.second.m_methodMap)
         {
-            std::string methodPath(servicePath + "/" + e2.first); // 方法结点路径：/serviceName/methodName
-            std::string nodeData(ip + ":" + std::to_string(port)); // 方法结点里的数据："IP:Port"
-            zk.Create(methodPath.data(), nodeData.data(), nodeData.size(), ZOO_EPHEMERAL); // 方法结点创建为临时性结点
+            methods.push_back(e2.first);
         }
     }
+    auto registerStart = std::chrono::steady_clock::now();
+    int failed = pRegistry->Register(services, endpoint);
+    m_endpoint = endpoint;
+    StartLoadReporter(pRegistry);
+
+    // SIGTERM / SIGINT 触发优雅停止。SA_RESETHAND：停止期间再收到一次信号时按默认行为立即退出
+    g_pSignalProvider = this;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &RPCProvider::OnStopSignal;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    m_drainThread = std::thread([this]() { DrainLoop(); });
 
     // 启动服务器
-    tcpServer.start();
+    auto now = std::chrono::steady_clock::now();
+    RPC_LOG(info) << "RPCProvider serving on " << endpoint << ", startup " << std::chrono::duration_cast<std::chrono::milliseconds>(now - runStart).count()
+                  << " ms (register " << std::chrono::duration_cast<std::chrono::milliseconds>(now - registerStart).count()
+                  << " ms, " << services.size() << " services, failed=" << failed << ")";
+    m_pTcpServer->start();
+
+    // 服务器已经关闭。不是由停止线程关闭时唤醒它退出
+    m_stopped.store(true);
+    sem_post(&m_shutdownSem);
+    m_drainThread.join();
+}
+
+void RPCProvider::Shutdown()
+{
+    sem_post(&m_shutdownSem);
+}
+
+void RPCProvider::OnStopSignal(int signo)
+{
+    if (g_pSignalProvider != nullptr)
+    {
+        sem_post(&g_pSignalProvider->m_shutdownSem); // 信号处理函数里只能调用异步信号安全的函数
+    }
+}
+
+void RPCProvider::DrainLoop()
+{
+    while (sem_wait(&m_shutdownSem) == -1 && errno == EINTR)
+    {
+    }
+    if (m_stopped.load())
+    {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    RPC_LOG(info) << "RPCProvider " << m_endpoint << " draining";
+
+    // 1.从注册中心撤销，2.等待客户端看到变化，这段时间里仍然正常处理请求
+    RPCRegistry::GetInstance()->Deregister(m_registered, m_endpoint);
+    std::this_thread::sleep_for(std::chrono::milliseconds(RPCApplication::GetInstance().GetConfig().LoadNumber<long>("drainDelayMs", 2000, 0)));
+
+    // 3.之后到达的请求回复 UNAVAILABLE，4.等待正在执行的调用结束、响应发送完毕
+    m_draining.store(true);
+    RPCMemoryBudget* pBudget = RPCMemoryBudget::GetInstance();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RPCApplication::GetInstance().GetConfig().LoadNumber<long>("drainTimeoutMs", 10000, 0));
+    while ((pBudget->InFlightCalls() > 0 || pBudget->Used(RPCMemoryBudget::kOutput) > 0) && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // 5.关闭服务器，Run() 返回
+    RPC_LOG(info) << "RPCProvider " << m_endpoint << " drained in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                  << " ms, unfinished calls=" << pBudget->InFlightCalls();
+    m_pTcpServer->stop();
 }
 
 /**
- * 客户端框架发送过来的 一条完整的rpc请求 的数据格式：4字节前缀长度 + rpcHeaderSize(4字节) + rpcHeader + 参数
+ * 客户端框架发送过来的 一条完整的rpc请求 的数据格式：4字节前缀长度 + rpcHeaderSize(4字节) + rpcHeader + 参数，
+ * 或者二进制头部 + 服务名 + 方法名 + 扩展 + 参数（见 RPCCodec.h），两种格式可以在同一条连接上混用
+ * 返回给客户端的每一帧响应的数据格式：4字节前缀长度 + RPCResponseWrapper
  */
 
-void RPCProvider::OnMessage(std::shared_ptr<Connection> pConn, Buffer* buffer)
+// 返回连接的内存记账，第一次调用时创建
+std::shared_ptr<RPCConnMemory> RPCProvider::GetConnMemory(const std::shared_ptr<Connection> &pConn, bool create, size_t *pPeerSlot)
 {
-    while (buffer->readableBytes() > 4)
     {
-        uint32_t len = buffer->peekInt32(); // 读取 rpc 请求报文的长度
-        if (buffer->readableBytes() >= 4 + len) // 缓冲区里有完整的 rpc 请求报文
+        std::shared_lock<std::shared_mutex> lock(m_connMemoryMtx);
+        auto it = m_connMemory.find(pConn->fd());
+        if (it != m_connMemory.end() && it->second.m_pConn.lock() == pConn)
         {
-            buffer->retrieve(4); // 消费掉 4 字节的报文长度
-            uint32_t rpcHeaderSize = buffer->readInt32(); // 获取 rpcHeader 的长度
-            std::string rpcHeaderStr = buffer->retrieveAsString(rpcHeaderSize); // 获取 rpcHeader 的字符串形式
-            MyRPC::RpcHeader rpcHeader;// rpcHeader由三部分组成: serviceName, methodName, argvSize。
-            if (!rpcHeader.ParseFromString(rpcHeaderStr)) // 反序列化 protobuf
+            if (pPeerSlot != nullptr)
             {
-                LOG(Log::error) << "ParseFromString() err";
-                SendErrorResponse(pConn, MyRPC::RPCResponseError::PARSE_ERROR, "反序列化错误");
-                return ;
+                *pPeerSlot = it->second.m_peerSlot;
             }
+            return it->second.m_pMemory;
+        }
+    }
+    if (!create)
+    {
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_connMemoryMtx);
+    // 关闭回调没有到达的连接（例如被服务器按超时清理）在这里兜底释放，记录留到套接字被复用时再替换
+    for (auto& e : m_connMemory)
+    {
+        if (e.second.m_pMemory != nullptr && e.second.m_pConn.expired())
+        {
+            e.second.m_pMemory.reset();
+        }
+    }
+
+    auto result = m_connMemory.emplace(pConn->fd(), ConnMemoryEntry());
+    ConnMemoryEntry& entry = result.first->second;
+    if (entry.m_pConn.lock() != pConn)
+    {
+        entry = ConnMemoryEntry();
+        entry.m_skipClose = !result.second; // 套接字被复用，上一条连接的关闭回调还会到达
+        entry.m_pConn = pConn;
+        entry.m_pMemory = std::make_shared<RPCConnMemory>();
+        entry.m_peerSlot = RPCRateLimiter::PeerSlot(pConn->fd()); // 每条连接只取一次对端地址
+    }
+    if (pPeerSlot != nullptr)
+    {
+        *pPeerSlot = entry.m_peerSlot;
+    }
+    return entry.m_pMemory;
+}
+
+// 连接已经关闭，它缓存的字节不会再被处理。不释放的话停止时会一直等这些响应发完，准入也会把它们算在内
+void RPCProvider::OnConnectionClosed(int fd)
+{
+    std::shared_ptr<RPCConnMemory> pMemory;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_connMemoryMtx);
+        auto it = m_connMemory.find(fd);
+        if (it == m_connMemory.end())
+        {
+            return;
+        }
+        if (it->second.m_skipClose) // 上一条使用这个套接字的连接的关闭回调
+        {
+            it->second.m_skipClose = false;
+            return;
+        }
+        pMemory = std::move(it->second.m_pMemory);
+        m_connMemory.erase(it);
+    }
+    if (pMemory != nullptr)
+    {
+        pMemory->Release(); // 还在执行的调用持有记账对象，发送响应时看到连接已经关闭
+    }
 
-            std::string serviceName = rpcHeader.servicename(); // 获取服务名称
-            std::string methodName = rpcHeader.methodname(); // 获取方法名称
-            uint32_t argvSize = rpcHeader.argvsize(); // 获取参数大小
+    std::lock_guard<std::mutex> lock(m_chunkMtx);
+    for (auto it = m_chunkedRequests.begin(); it != m_chunkedRequests.end();)
+    {
+        std::shared_ptr<Connection> pConn = it->second.m_pConn.lock();
+        it = pConn == nullptr || pConn->fd() == fd ? m_chunkedRequests.erase(it) : std::next(it);
+    }
+}
 
-            std::string argvStr = buffer->retrieveAsString(argvSize); // 获取参数
+// 发送缓冲区已经清空，连接上堆积的响应归零
+void RPCProvider::OnSendComplete(std::shared_ptr<Connection> pConn)
+{
+    std::shared_ptr<RPCConnMemory> pMemory = GetConnMemory(pConn, false);
+    if (pMemory != nullptr)
+    {
+        pMemory->Set(RPCMemoryBudget::kOutput, 0);
+    }
+}
 
-            // 在 m_serviceMap 里面查找服务
-            auto servicePos = m_serviceMap.find(serviceName);
-            if (servicePos == m_serviceMap.end())
+void RPCProvider::OnMessage(std::shared_ptr<Connection> pConn, Buffer* buffer)
+{
+    uint64_t receivedTicks = RPCClock::Now(); // 缓冲区里的请求从这时开始排队
+    size_t peerSlot = 0;
+    std::shared_ptr<RPCConnMemory> pMemory = GetConnMemory(pConn, true, &peerSlot);
+    RPCMemoryBudget* pBudget = RPCMemoryBudget::GetInstance();
+    RPCRequestHeader rpcHeader; // 由 serviceName, methodName, streamId, 分块信息和调用链组成。在循环里复用，服务名和方法名不用每帧分配
+    while (true)
+    {
+        std::string argvStr;
+        RPCCodec::ParseResult result = RPCCodec::ParseRequestFrame(buffer, &rpcHeader, &argvStr);
+        if (result == RPCCodec::kFrameIncomplete) // 不是一条完整的 rpc 请求报文
+        {
+            // 长度字段已经到达时就检查能否缓存这一帧，超过上限的连接立即断开，而不是等它把缓冲区撑满
+            size_t readable = buffer->readableBytes();
+            uint64_t frameBytes = RPCCodec::PendingFrameSize(buffer);
+            if (!pBudget->AdmitFrame(*pMemory, frameBytes))
             {
-                std::string msg("未注册" + serviceName + "服务");
-                LOG(Log::error) << msg;
-                SendErrorResponse(pConn, MyRPC::RPCResponseError::SERVICE_NOT_FOUND, msg);
-                return ;
+                RPC_LOG(warn) << "connection memory over limit, frame=" << frameBytes << " buffered=" << pMemory->Used();
+                SendErrorResponse(pConn, MyRPC::RPCResponseError::RESOURCE_EXHAUSTED, "服务端缓存超过上限");
+                pConn->closeconnection();
+                pMemory->Set(RPCMemoryBudget::kInput, 0);
+                return;
             }
+            pMemory->Set(RPCMemoryBudget::kInput, readable);
+            return;
+        }
+        if (result == RPCCodec::kFrameTooLarge) // 超过 64M，则关闭连接，防止炸弹。更大的消息需要由客户端分块发送
+        {
+            RPC_LOG(error) << "有炸弹包!";
+            pConn->closeconnection(); // 断开和对端的连接
+            pMemory->Set(RPCMemoryBudget::kInput, 0);
+            return;
+        }
+        if (result == RPCCodec::kBadHeader)
+        {
+            RPC_LOG(error) << "ParseFromString() err";
+            SendErrorResponse(pConn, MyRPC::RPCResponseError::PARSE_ERROR, "反序列化错误");
+            continue; // 这一帧已经被丢弃，帧边界仍然可信，继续处理后面的请求
+        }
 
-            // 在 m_servceMap 里面查找方法
-            auto methodPos = servicePos->second.m_methodMap.find(methodName);
-            if (methodPos == servicePos->second.m_methodMap.end())
+        MYRPC_PROBE(request_received, pConn.get(), rpcHeader.m_serviceName.c_str(), rpcHeader.m_methodName.c_str(),
+                    argvStr.size(), rpcHeader.m_chunkSeq);
+
+        if (rpcHeader.m_heartbeat) // 客户端连接池发来的心跳帧，直接回复
+        {
+            SendHeartbeatResponse(pConn);
+            continue;
+        }
+
+        if (rpcHeader.m_chunkSeq != 0 || rpcHeader.m_moreChunks) // 分块传输的大请求，收齐之后才分发
+        {
+            ChunkedRequest request;
+            int ret = AppendChunk(pConn, *pMemory, rpcHeader, std::move(argvStr), receivedTicks, &request);
+            if (ret == 0) // 还有分块没有到达
             {
-                std::string msg("未定义" + methodName + "方法");
-                LOG(Log::error) << msg;
-                SendErrorResponse(pConn, MyRPC::RPCResponseError::METHOD_NOT_FOUND, msg);
-                return ;
+                continue;
             }
-
-            // 调用指定服务的指定方法
-            google::protobuf::Service* pService = servicePos->second.m_pservice; // 获取Service 句柄
-            const google::protobuf::MethodDescriptor *pMethodDesc = methodPos->second; // 获取 MethodDescriptor 句柄
-            std::unique_ptr<google::protobuf::Message> pRequest(pService->GetRequestPrototype(pMethodDesc).New()); // 获取相应的request
-            if (!pRequest->ParseFromString(argvStr)) // 反序列化 protobuf
+            if (ret < 0)
             {
-                LOG(Log::error) << "ParseFromString() err";
-                SendErrorResponse(pConn, MyRPC::RPCResponseError::PARSE_ERROR, "反序列化错误");
+                if (ret == -2)
+                {
+                    SendErrorResponse(pConn, MyRPC::RPCResponseError::RESOURCE_EXHAUSTED, "服务端缓存超过上限", rpcHeader.m_streamId);
+                }
+                else
+                {
+                    SendErrorResponse(pConn, MyRPC::RPCResponseError::INVALID_ARGUMENT, "分块请求无效或者过大", rpcHeader.m_streamId);
+                }
+                pConn->closeconnection(); // 连接上的帧已经错位，断开连接
+                pMemory->Set(RPCMemoryBudget::kInput, 0);
                 return ;
             }
+            Dispatch(pConn, pMemory, peerSlot, request.m_serviceName, request.m_methodName, request.m_streamId, request.m_trace, request.m_receivedTicks, request.m_chunks);
+            continue;
+        }
 
-            std::unique_ptr<google::protobuf::Message> pResponse(pService->GetResponsePrototype(pMethodDesc).New()); // 获取相应的response
+        std::vector<std::string> argvChunks(1);
+        argvChunks[0].swap(argvStr);
+        Dispatch(pConn, pMemory, peerSlot, rpcHeader.m_serviceName, rpcHeader.m_methodName, rpcHeader.m_streamId, rpcHeader.m_trace, receivedTicks, argvChunks);
+    }
+}
 
-            google::protobuf::Closure* done = google::protobuf::NewCallback<RPCProvider, 
-                                                                            std::shared_ptr<Connection>, 
-                                                                            google::protobuf::Message *>
-                                            (this, &RPCProvider::SendRpcResponse, pConn, pResponse.get());
+// 记录大请求的一个分块。返回值：1 已收齐（结果存入 complete），0 还有分块未到，-1 出错
+int RPCProvider::AppendChunk(std::shared_ptr<Connection> pConn, RPCConnMemory &memory, const RPCRequestHeader &header, std::string piece, uint64_t receivedTicks, ChunkedRequest *complete)
+{
+    std::lock_guard<std::mutex> lock(m_chunkMtx);
 
-            pService->CallMethod(pMethodDesc, nullptr, pRequest.get(), pResponse.get(), done);
-        }
-        else if (len >= 64 * 1024 * 1024) // 超过 64M，则关闭连接，防止炸弹
+    if (header.m_chunkSeq == 0)
+    {
+        // 顺便清理连接已经断开、但是没有收齐的请求
+        for (auto it = m_chunkedRequests.begin(); it != m_chunkedRequests.end();)
         {
-            LOG(Log::error) << "有炸弹包!";
-            pConn->closeconnection(); // 断开和对端的连接
-            return;
+            it = it->second.m_pConn.expired() ? m_chunkedRequests.erase(it) : std::next(it);
         }
-        else // 不是一条完整的rpcHeader
+
+        ChunkedRequest& request = m_chunkedRequests[pConn.get()];
+        request = ChunkedRequest();
+        request.m_pConn = pConn;
+        request.m_serviceName = header.m_serviceName;
+        request.m_methodName = header.m_methodName;
+        request.m_streamId = header.m_streamId;
+        request.m_trace = header.m_trace;
+        request.m_receivedTicks = receivedTicks;
+    }
+
+    auto it = m_chunkedRequests.find(pConn.get());
+    if (it == m_chunkedRequests.end() || it->second.m_pConn.lock() != pConn || header.m_chunkSeq != it->second.m_nextSeq)
+    {
+        RPC_LOG(error) << "unexpected chunk, seq=" << header.m_chunkSeq;
+        if (it != m_chunkedRequests.end())
         {
-            return;
+            m_chunkedRequests.erase(it);
         }
+        memory.Set(RPCMemoryBudget::kReassembly, 0);
+        return -1;
+    }
+
+    ChunkedRequest& request = it->second;
+    request.m_totalSize += piece.size();
+    if (request.m_totalSize > RPCChunk::GetMaxMessageSize())
+    {
+        RPC_LOG(error) << "request too large, size=" << request.m_totalSize;
+        m_chunkedRequests.erase(it);
+        memory.Set(RPCMemoryBudget::kReassembly, 0);
+        return -1;
+    }
+    if (!RPCMemoryBudget::GetInstance()->AdmitReassembly(memory, request.m_totalSize))
+    {
+        RPC_LOG(warn) << "chunked request over memory limit, size=" << request.m_totalSize;
+        m_chunkedRequests.erase(it);
+        memory.Set(RPCMemoryBudget::kReassembly, 0);
+        return -2;
+    }
+
+    request.m_chunks.emplace_back(std::move(piece));
+    ++request.m_nextSeq;
+    if (header.m_moreChunks)
+    {
+        memory.Set(RPCMemoryBudget::kReassembly, request.m_totalSize);
+        return 0;
     }
+
+    *complete = std::move(request);
+    m_chunkedRequests.erase(it);
+    memory.Set(RPCMemoryBudget::kReassembly, 0); // 收齐之后由分发计入 inflight
+    return 1;
 }
 
-// 回调函数，将response发送回客户端
-void RPCProvider::SendRpcResponse(std::shared_ptr<Connection> pConn, google::protobuf::Message *response)
+// 查找服务和方法，反序列化参数并调用 handler。出错时给客户端返回错误信息
+void RPCProvider::Dispatch(std::shared_ptr<Connection> pConn, const std::shared_ptr<RPCConnMemory> &pMemory, size_t peerSlot, const std::string &serviceName, const std::string &methodName,
+                           uint64_t streamId, const RPCTraceContext &trace, uint64_t receivedTicks, const std::vector<std::string> &argvChunks)
 {
-    MyRPC::RPCResponseWrapper wrapper;
-    wrapper.set_success(true);
-    wrapper.mutable_error()->set_error_code(MyRPC::RPCResponseError::SUCCESS);
-    wrapper.mutable_error()->set_error_message("");
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startTicks = RPCClock::Now();
+    size_t bytesIn = 0;
+    for (const auto& chunk : argvChunks)
+    {
+        bytesIn += chunk.size();
+    }
+
+    // 分发失败的调用也计入统计，找不到的服务和方法统一记为 <unknown>，避免名字不受控制地增长
+    RPCStats* pStats = RPCStats::GetInstance();
+    auto reject = [&](const google::protobuf::MethodDescriptor *pMethod, int errorCode, const std::string &msg)
+    {
+        RPC_LOG(error) << msg;
+        SendErrorResponse(pConn, errorCode, msg, streamId);
+        pStats->OnStart(RPCStats::kServer, pMethod);
+        pStats->OnFinish(RPCStats::kServer, pMethod, errorCode, bytesIn, 0,
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    };
+
+    // 正在停止，客户端可以换一个提供者重试
+    if (m_draining.load(std::memory_order_relaxed))
+    {
+        reject(nullptr, MyRPC::RPCResponseError::UNAVAILABLE, "服务端正在停止");
+        return;
+    }
+
+    // 进程缓存的数据、连接上堆积的响应或者正在执行的调用数超过上限时，不执行 handler
+    if (!RPCMemoryBudget::GetInstance()->AdmitCall(*pMemory))
+    {
+        reject(nullptr, MyRPC::RPCResponseError::RESOURCE_EXHAUSTED, "服务端繁忙，请稍后重试");
+        return;
+    }
+
+    // 在 m_serviceMap 里面查找服务
+    auto servicePos = m_serviceMap.find(serviceName);
+    if (servicePos == m_serviceMap.end())
+    {
+        reject(nullptr, MyRPC::RPCResponseError::SERVICE_NOT_FOUND, "未注册" + serviceName + "服务");
+        return;
+    }
 
-    std::string responseStr;
-    if (response->SerializeToString(&responseStr))
+    // 在 m_servceMap 里面查找方法
+    auto methodPos = servicePos->second.m_methodMap.find(methodName);
+    if (methodPos == servicePos->second.m_methodMap.end())
     {
-        // 将responseData塞进 wrapper的data字段
-        wrapper.set_data(responseStr);
+        reject(nullptr, MyRPC::RPCResponseError::METHOD_NOT_FOUND, "未定义" + methodName + "方法");
+        return;
+    }
+
+    // 调用指定服务的指定方法
+    google::protobuf::Service* pService = servicePos->second.m_pservice; // 获取Service 句柄
+    const google::protobuf::MethodDescriptor *pMethodDesc = methodPos->second; // 获取 MethodDescriptor 句柄
+
+    // 超过该方法或者该客户端 IP 的限流，拒绝的调用计入该方法的统计
+    if (!RPCRateLimiter::GetInstance()->Admit(serviceName, methodName, peerSlot))
+    {
+        reject(pMethodDesc, MyRPC::RPCResponseError::RATE_LIMITED, serviceName + "." + methodName + " 超过限流");
+        return;
+    }
+
+    std::unique_ptr<CallContext> pCtx(new CallContext());
+    pCtx->m_pConn = pConn;
+    pCtx->m_streamId = streamId;
+    pCtx->m_pMethod = pMethodDesc;
+    pCtx->m_start = start;
+    pCtx->m_bytesIn = bytesIn;
+    pCtx->m_timing = RPCCallTiming(receivedTicks);
+    pCtx->m_timing.Mark(RPCCallTiming::kServerQueue, startTicks);
+    pCtx->m_pRequest.reset(pService->GetRequestPrototype(pMethodDesc).New()); // 获取相应的request
+    if (!RPCChunk::ParseFromChunks(argvChunks, pCtx->m_pRequest.get())) // 反序列化 protobuf，分块的参数直接从分块链上解析
+    {
+        reject(pMethodDesc, MyRPC::RPCResponseError::PARSE_ERROR, "反序列化错误");
+        return;
+    }
+    MYRPC_PROBE(request_decoded, pCtx.get(), serviceName.c_str(), methodName.c_str(), bytesIn);
+
+    pCtx->m_timing.Mark(RPCCallTiming::kServerDecode);
 
-        std::string wrapperStr; 
-        if (wrapper.SerializeToString(&wrapperStr))
+    // 被采样的调用记录排队和反序列化两个阶段
+    pCtx->m_handlerStartNs = RPCTrace::NowNs();
+    uint64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+    RPCTrace::Record(trace, "server.queue", pMethodDesc, startNs - pCtx->m_timing.PhaseNs(RPCCallTiming::kServerQueue), startNs);
+    RPCTrace::Record(trace, "server.decode", pMethodDesc, startNs, pCtx->m_handlerStartNs);
+    pCtx->m_controller.SetTraceContext(trace);
+
+    // 请求参数从这里开始计入正在执行的调用，OnCallDone 时释放
+    pCtx->m_pMemory = pMemory;
+    pMemory->Add(RPCMemoryBudget::kInFlight, bytesIn);
+    pMemory->CallStarted();
+
+    pCtx->m_pResponse.reset(pService->GetResponsePrototype(pMethodDesc).New()); // 获取相应的response
+
+    if (streamId != 0) // 流式调用，handler 可以通过 controller->Write() 逐帧发送响应。Write 会阻塞，handler 在工作线程里执行
+    {
+        CallContext* pRawCtx = pCtx.get(); // handler 只能在 done 之前写流，此时上下文一定有效
+        pCtx->m_controller.SetStreamWriter([this, pRawCtx](const google::protobuf::Message& msg)
+                                           { return SendStreamFrame(pRawCtx, msg); });
+    }
+
+    pStats->OnStart(RPCStats::kServer, pMethodDesc);
+
+    // 调用上下文的所有权交给 done 回调，由 OnCallDone 释放
+    CallContext* pRawCtx = pCtx.release();
+    google::protobuf::Closure* done = google::protobuf::NewCallback<RPCProvider, CallContext *>
+                                    (this, &RPCProvider::OnCallDone, pRawCtx);
+
+    if (streamId != 0)
+    {
+        m_pStreamPool->AddTask([this, pService, pRawCtx, done, trace]() { CallHandler(pService, pRawCtx, done, trace); });
+        return;
+    }
+    CallHandler(pService, pRawCtx, done, trace);
+}
+
+// 执行 handler
+void RPCProvider::CallHandler(google::protobuf::Service *pService, CallContext *pCtx, google::protobuf::Closure *done, const RPCTraceContext &trace)
+{
+    // handler 执行期间通过 RPCChannel 发起的下游调用自动继承调用链。handler 可能同步执行 done 释放上下文，所以用 trace 而不是上下文里的副本
+    const google::protobuf::MethodDescriptor *pMethodDesc = pCtx->m_pMethod;
+    RPCTraceScope traceScope(trace.m_traceId != 0 ? &trace : nullptr);
+    MYRPC_PROBE(dispatch_start, pCtx, pMethodDesc->service()->name().data(), pMethodDesc->name().data());
+    pService->CallMethod(pMethodDesc, &pCtx->m_controller, pCtx->m_pRequest.get(), pCtx->m_pResponse.get(), done);
+    MYRPC_PROBE(dispatch_end, pCtx, pMethodDesc->service()->name().data(), pMethodDesc->name().data()); // 上下文可能已经释放，这里只用它的地址
+}
+
+// done 回调，handler 执行完毕后发送响应并释放调用上下文
+void RPCProvider::OnCallDone(CallContext* pCtx)
+{
+    std::unique_ptr<CallContext> guard(pCtx);
+    pCtx->m_timing.Mark(RPCCallTiming::kServerHandler);
+    const RPCTraceContext& trace = pCtx->m_controller.GetTraceContext();
+    uint64_t handlerEndNs = trace.m_sampled ? RPCTrace::NowNs() : 0;
+    RPCTrace::Record(trace, "server.handler", pCtx->m_pMethod, pCtx->m_handlerStartNs, handlerEndNs);
+
+    int errorCode = MyRPC::RPCResponseError::SUCCESS;
+    if (pCtx->m_streamStalled) // 客户端长时间没有读取，流没有发完
+    {
+        errorCode = MyRPC::RPCResponseError::RESOURCE_EXHAUSTED;
+        SendErrorResponse(pCtx->m_pConn, errorCode, "客户端长时间没有读取流式响应", pCtx->m_streamId);
+        pCtx->m_timing.Mark(RPCCallTiming::kServerSend);
+    }
+    else if (pCtx->m_controller.Failed()) // handler 通过 controller->SetFailed() 报告了错误
+    {
+        errorCode = MyRPC::RPCResponseError::INTERNAL_ERROR;
+        SendErrorResponse(pCtx->m_pConn, errorCode, pCtx->m_controller.ErrorText(), pCtx->m_streamId);
+        pCtx->m_timing.Mark(RPCCallTiming::kServerSend);
+    }
+    else
+    {
+        pCtx->m_bytesOut += SendRpcResponse(pCtx->m_pConn, pCtx->m_pResponse.get(), pCtx->m_streamId, &pCtx->m_timing);
+        if (trace.m_sampled)
         {
-            pConn->send(wrapperStr);
+            uint64_t encodedNs = handlerEndNs + pCtx->m_timing.PhaseNs(RPCCallTiming::kServerEncode);
+            RPCTrace::Record(trace, "server.encode", pCtx->m_pMethod, handlerEndNs, encodedNs);
+            RPCTrace::Record(trace, "server.send", pCtx->m_pMethod, encodedNs, encodedNs + pCtx->m_timing.PhaseNs(RPCCallTiming::kServerSend));
         }
-        else // 序列化失败
+    }
+
+    RPCStats::GetInstance()->OnFinish(RPCStats::kServer, pCtx->m_pMethod, errorCode, pCtx->m_bytesIn, pCtx->m_bytesOut,
+                                      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pCtx->m_start).count());
+    pCtx->m_pMemory->Sub(RPCMemoryBudget::kInFlight, pCtx->m_bytesIn);
+    pCtx->m_pMemory->CallFinished();
+    pCtx->m_timing.Finish(false, pCtx->m_pMethod, errorCode);
+    MYRPC_PROBE(call_done, pCtx, errorCode, pCtx->m_bytesOut);
+}
+
+// 回调函数，将response发送回客户端。流式调用时该响应作为流的最后一帧（trailer）
+size_t RPCProvider::SendRpcResponse(std::shared_ptr<Connection> pConn, google::protobuf::Message *response, uint64_t streamId, RPCCallTiming *timing)
+{
+    // 序列化 response 塞进 wrapper 的 data 字段，过大时分块
+    std::string frames;
+    size_t responseSize = 0;
+    if (!RPCCodec::EncodeResponse(*response, streamId, streamId != 0, RPCChunk::GetChunkSize(), &frames, &responseSize))
+    {
+        RPC_LOG(error) << "SerializeToString() err"; // 序列化失败
+        return 0;
+    }
+    if (timing != nullptr)
+    {
+        timing->Mark(RPCCallTiming::kServerEncode);
+    }
+    SendFrames(pConn, frames);
+    if (timing != nullptr)
+    {
+        timing->Mark(RPCCallTiming::kServerSend);
+    }
+    MYRPC_PROBE(response_enqueued, pConn.get(), streamId, responseSize);
+    return responseSize;
+}
+
+// 发送一帧流式响应，在工作线程里执行
+bool RPCProvider::SendStreamFrame(CallContext *pCtx, const google::protobuf::Message &msg)
+{
+    // 网络库的 send 只是把数据追加到发送缓冲区。连接上还没有发出的响应超过一个分块时，等 I/O 线程把它们写进内核
+    // （OnSendComplete 把 output 清零）再继续，服务端为这个流缓存的数据不超过一个分块加一条消息
+    static const std::chrono::milliseconds timeout(RPCApplication::GetInstance().GetConfig().LoadNumber<long>("streamWriteTimeoutMs", 30000, 1));
+    if (!pCtx->m_pMemory->WaitOutput(RPCChunk::GetChunkSize(), timeout))
+    {
+        if (!pCtx->m_pMemory->Closed())
         {
-            LOG(Log::error) << "SerializeToString() err";
+            RPC_LOG(warn) << "stream " << pCtx->m_streamId << " write timed out, buffered=" << pCtx->m_pMemory->Used(RPCMemoryBudget::kOutput);
+            pCtx->m_streamStalled = true;
         }
+        return false;
     }
-    else // 序列化失败
+
+    std::string frames;
+    size_t msgSize = 0;
+    if (!RPCCodec::EncodeResponse(msg, pCtx->m_streamId, false, RPCChunk::GetChunkSize(), &frames, &msgSize))
     {
-        LOG(Log::error) << "SerializeToString() err";
+        RPC_LOG(error) << "SerializeToString() err";
+        return false;
     }
+    SendFrames(pCtx->m_pConn, frames);
+    pCtx->m_bytesOut += msgSize;
+    return true;
 }
 
-
 // RPC调用过程中出现问题，导致调用失败，给框架的客户端返回失败信息
-void RPCProvider::SendErrorResponse(std::shared_ptr<Connection> pConn, int error_code, const std::string &error_msg)
+void RPCProvider::SendErrorResponse(std::shared_ptr<Connection> pConn, int error_code, const std::string &error_msg, uint64_t streamId)
 {
     MyRPC::RPCResponseWrapper wrapper;
     wrapper.set_success(false);
     wrapper.mutable_error()->set_error_code(error_code);
     wrapper.mutable_error()->set_error_message(error_msg);
+    wrapper.set_stream_id(streamId);
+    wrapper.set_end_of_stream(streamId != 0);
 
     std::string wrapperStr;
     if (wrapper.SerializeToString(&wrapperStr))
     {
-        pConn->send(wrapperStr);
+        SendFrame(pConn, wrapperStr);
     }
     else // 序列化失败，一般不会发生
     {
-        LOG(Log::warn) << "SerializeToString() err";
+        RPC_LOG(warn) << "SerializeToString() err";
+    }
+}
+
+// 回复客户端的心跳帧（PONG）
+void RPCProvider::SendHeartbeatResponse(std::shared_ptr<Connection> pConn)
+{
+    static const std::string pongStr = []()
+    {
+        MyRPC::RPCResponseWrapper wrapper;
+        wrapper.set_success(true);
+        wrapper.set_heartbeat(true);
+        return wrapper.SerializeAsString();
+    }();
+    SendFrame(pConn, pongStr);
+}
+
+// 给响应加上 4 字节长度前缀后发送
+void RPCProvider::SendFrame(std::shared_ptr<Connection> pConn, const std::string &wrapperStr)
+{
+    std::string frame;
+    RPCCodec::AppendResponseFrame(wrapperStr, &frame);
+    SendFrames(pConn, frame);
+}
+
+// 发送已经加上长度前缀的响应帧
+void RPCProvider::SendFrames(std::shared_ptr<Connection> pConn, const std::string &frames)
+{
+    // 发送缓冲区清空之前，这些字节都算作连接上堆积的响应
+    std::shared_ptr<RPCConnMemory> pMemory = GetConnMemory(pConn, false);
+    if (pMemory != nullptr)
+    {
+        pMemory->Add(RPCMemoryBudget::kOutput, frames.size());
     }
+    pConn->send(frames);
 }
\ No newline at end of file
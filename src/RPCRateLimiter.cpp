@@ -0,0 +1,255 @@
+#include "RPCRateLimiter.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+static const size_t kIpSlots = 1024; // 每条按 IP 的限制的桶数
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 客户端 IP 对应的桶。取不到地址时所有这样的连接共用 0 号桶
+size_t RPCRateLimiter::PeerSlot(int fd)
+{
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+    {
+        return 0;
+    }
+
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+    if (addr.ss_family == AF_INET)
+    {
+        bytes = reinterpret_cast<const unsigned char*>(&reinterpret_cast<sockaddr_in*>(&addr)->sin_addr);
+        size = sizeof(in_addr);
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        bytes = reinterpret_cast<const unsigned char*>(&reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr);
+        size = sizeof(in6_addr);
+    }
+
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash % kIpSlots;
+}
+
+RPCRateLimiter* RPCRateLimiter::GetInstance()
+{
+    static RPCRateLimiter instance;
+    return &instance;
+}
+
+bool RPCRateLimiter::TryAcquire(Bucket& bucket, const Limit& limit, int64_t nowNs)
+{
+    int64_t tat = bucket.m_tat.load(std::memory_order_relaxed);
+    while (true)
+    {
+        int64_t next = std::max(tat, nowNs) + limit.m_intervalNs;
+        if (next - nowNs > limit.m_burstNs) // 攒下的令牌已经用完
+        {
+            return false;
+        }
+        if (bucket.m_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+bool RPCRateLimiter::Admit(const std::string& serviceName, const std::string& methodName, size_t peerSlot)
+{
+    if (!m_enabled.load(std::memory_order_acquire))
+    {
+        return true;
+    }
+
+    // 每个线程缓存一份规则表，版本号没有变化时直接使用
+    struct RulesCache
+    {
+        uint64_t m_generation = 0;
+        std::shared_ptr<const Rules> m_pRules;
+    };
+    static thread_local RulesCache cache;
+    if (cache.m_generation != m_generation.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        cache.m_pRules = m_pRules;
+        cache.m_generation = m_generation.load(std::memory_order_relaxed);
+    }
+    const Rules* pRules = cache.m_pRules.get();
+    if (pRules == nullptr)
+    {
+        return true;
+    }
+
+    int64_t now = NowNs();
+    size_t slot = peerSlot % kIpSlots;
+    if (pRules->m_pPerIp != nullptr && !TryAcquire(pRules->m_pPerIp[slot], pRules->m_perIp, now))
+    {
+        return false;
+    }
+
+    auto servicePos = pRules->m_methods.find(serviceName);
+    if (servicePos == pRules->m_methods.end())
+    {
+        return true;
+    }
+    auto methodPos = servicePos->second.find(methodName);
+    if (methodPos == servicePos->second.end())
+    {
+        return true;
+    }
+    const MethodRule& rule = methodPos->second;
+    if (rule.m_pTotal != nullptr && !TryAcquire(*rule.m_pTotal, rule.m_total, now))
+    {
+        return false;
+    }
+    return rule.m_pPerIp == nullptr || TryAcquire(rule.m_pPerIp[slot], rule.m_perIp, now);
+}
+
+bool RPCRateLimiter::ParseLimit(const std::string& key, const std::string& value, Limit* limit)
+{
+    double qps = 0;
+    double burst = 0;
+    try
+    {
+        size_t comma = value.find(',');
+        qps = std::stod(value.substr(0, comma));
+        burst = comma == std::string::npos ? std::max(1.0, qps) : std::stod(value.substr(comma + 1));
+    }
+    catch (...)
+    {
+        RPC_LOG(warn) << "invalid config " << key << "=" << value;
+        return false;
+    }
+    if (qps <= 0)
+    {
+        return false;
+    }
+
+    limit->m_intervalNs = std::max<int64_t>(1, static_cast<int64_t>(1e9 / qps));
+    limit->m_burstNs = static_cast<int64_t>(std::max(1.0, burst)) * limit->m_intervalNs;
+    return true;
+}
+
+void RPCRateLimiter::Apply(const RPCConfig& config)
+{
+    std::shared_ptr<Rules> pRules = std::make_shared<Rules>();
+    size_t count = 0;
+
+    auto addMethodRule = [&](const std::string& prefix, bool perIp)
+    {
+        for (const auto& e : config.LoadPrefix(prefix))
+        {
+            size_t dot = e.first.find('.');
+            Limit limit;
+            if (dot == std::string::npos || dot == 0 || dot + 1 == e.first.size())
+            {
+                RPC_LOG(warn) << "invalid config " << prefix << e.first << "=" << e.second;
+                continue;
+            }
+            if (!ParseLimit(prefix + e.first, e.second, &limit))
+            {
+                continue;
+            }
+
+            MethodRule& rule = pRules->m_methods[e.first.substr(0, dot)][e.first.substr(dot + 1)];
+            if (perIp)
+            {
+                rule.m_perIp = limit;
+                rule.m_pPerIp.reset(new Bucket[kIpSlots]);
+            }
+            else
+            {
+                rule.m_total = limit;
+                rule.m_pTotal.reset(new Bucket());
+            }
+            ++count;
+        }
+    };
+    addMethodRule("rateLimit.", false);
+    addMethodRule("rateLimitPerIp.", true);
+
+    std::string value = config.Load("rateLimitPerIp");
+    if (!value.empty() && ParseLimit("rateLimitPerIp", value, &pRules->m_perIp))
+    {
+        pRules->m_pPerIp.reset(new Bucket[kIpSlots]);
+        ++count;
+    }
+
+    // 旧的规则表在最后一个缓存它的线程换成新表时释放
+    if (count == 0)
+    {
+        pRules.reset();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pRules = std::move(pRules);
+        m_generation.fetch_add(1, std::memory_order_release);
+    }
+    m_enabled.store(count != 0, std::memory_order_release);
+    RPC_LOG(info) << "rate limits applied, rules=" << count;
+}
+
+// 文件的修改时间和上次读取时不同时重新读取，applied 存放上次读取时的修改时间
+static void ReloadIfChanged(RPCRateLimiter* pLimiter, const std::string& path, struct timespec* applied)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return;
+    }
+    if (st.st_mtim.tv_sec == applied->tv_sec && st.st_mtim.tv_nsec == applied->tv_nsec)
+    {
+        return;
+    }
+
+    RPCConfig config;
+    if (!config.TryLoadConfigFile(path))
+    {
+        RPC_LOG(warn) << "open " << path << " failed";
+        return;
+    }
+    pLimiter->Apply(config);
+    *applied = st.st_mtim;
+}
+
+void RPCRateLimiter::Start()
+{
+    std::call_once(m_started, [this]()
+    {
+        const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+        std::string path = config.Load("rateLimitFile");
+        if (path.empty())
+        {
+            Apply(config);
+            return;
+        }
+
+        // 先同步读取一次，开始接收请求时限制已经生效
+        struct timespec applied = {-1, 0};
+        ReloadIfChanged(this, path, &applied);
+        std::thread([this, path, applied]() mutable
+        {
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                ReloadIfChanged(this, path, &applied);
+            }
+        }).detach();
+    });
+}
@@ -0,0 +1,68 @@
+#include "RPCRegistry.h"
+#include "ZkRegistry.h"
+#include "RPCStaticRegistry.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+
+#include <memory>
+#include <algorithm>
+#include <charconv>
+
+// 根据配置项 registry 创建注册中心
+static RPCRegistry* CreateRegistry()
+{
+    const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+    std::string type = config.Load("registry");
+    if (type == "static" || type == "none")
+    {
+        RPCStaticRegistry* pRegistry = new RPCStaticRegistry();
+        std::string file = config.Load("registryFile");
+        if (!file.empty())
+        {
+            int entries = pRegistry->LoadFile(file);
+            RPC_LOG(info) << "static registry loaded " << entries << " entries from " << file;
+        }
+        return pRegistry;
+    }
+
+    if (!type.empty() && type != "zookeeper")
+    {
+        RPC_LOG(warn) << "unknown registry " << type << ", use zookeeper";
+    }
+    return new ZkRegistry();
+}
+
+double RPCRegistry::EffectiveWeight(uint32_t weight, const LoadReport& load)
+{
+    double headroom = std::max(0.1, 1.0 - load.m_cpuPermille / 1000.0);
+    double pressure = 1.0 + load.m_inFlightCalls / 64.0 + load.m_queuedBytes / (1024.0 * 1024.0);
+    return weight * headroom / pressure;
+}
+
+bool RPCRegistry::ParseEndpoint(const std::string& endpoint, std::string* ip, uint16_t* port)
+{
+    size_t pos = endpoint.rfind(':');
+    if (pos == std::string::npos || pos == 0)
+    {
+        return false;
+    }
+
+    const char* begin = endpoint.data() + pos + 1;
+    const char* end = endpoint.data() + endpoint.size();
+    unsigned long value = 0;
+    auto result = std::from_chars(begin, end, value);
+    if (begin == end || result.ec != std::errc() || result.ptr != end || value == 0 || value > UINT16_MAX)
+    {
+        return false;
+    }
+
+    ip->assign(endpoint, 0, pos);
+    *port = static_cast<uint16_t>(value);
+    return true;
+}
+
+RPCRegistry* RPCRegistry::GetInstance()
+{
+    static std::unique_ptr<RPCRegistry> instance(CreateRegistry());
+    return instance.get();
+}
@@ -0,0 +1,32 @@
+#include "RPCRetryBudget.h"
+
+#include <algorithm>
+
+RPCRetryBudget::RPCRetryBudget(double ratio, int64_t capTokens)
+: m_deposit(static_cast<int64_t>(ratio * kTokenUnit)),
+  m_cap(capTokens * kTokenUnit),
+  m_tokens(capTokens * kTokenUnit)
+{
+}
+
+void RPCRetryBudget::Deposit()
+{
+    int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+    while (tokens < m_cap
+           && !m_tokens.compare_exchange_weak(tokens, std::min(tokens + m_deposit, m_cap), std::memory_order_relaxed))
+    {
+    }
+}
+
+bool RPCRetryBudget::Withdraw()
+{
+    int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+    while (tokens >= kTokenUnit)
+    {
+        if (m_tokens.compare_exchange_weak(tokens, tokens - kTokenUnit, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,164 @@
+#include "RPCStaticRegistry.h"
+#include "RPCLog.h"
+#include "RPCConnectionsPool.h"
+
+#include <fstream>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include <mutex>
+
+// 删除字符串开头和结尾的空白字符
+static std::string Trim(const std::string& str)
+{
+    auto begin = std::find_if(str.begin(), str.end(), [](char ch) { return !std::isspace(static_cast<unsigned char>(ch)); });
+    auto end = std::find_if(str.rbegin(), str.rend(), [](char ch) { return !std::isspace(static_cast<unsigned char>(ch)); }).base();
+    return begin < end ? std::string(begin, end) : std::string();
+}
+
+int RPCStaticRegistry::LoadFile(const std::string& filePath)
+{
+    std::ifstream input(filePath);
+    if (!input.is_open())
+    {
+        RPC_LOG(error) << "open registry file " << filePath << " failed";
+        return -1;
+    }
+
+    int entries = 0;
+    std::string line;
+    while (std::getline(input, line))
+    {
+        line = Trim(line.substr(0, line.find('#'))); // 去掉注释
+        size_t pos = line.find('=');
+        if (line.empty() || pos == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string key = Trim(line.substr(0, pos));
+        std::vector<std::string> endpoints;
+        std::istringstream values(line.substr(pos + 1));
+        std::string endpoint;
+        while (std::getline(values, endpoint, ','))
+        {
+            endpoint = Trim(endpoint);
+            std::string ip;
+            uint16_t port = 0;
+            if (ParseEndpoint(endpoint, &ip, &port))
+            {
+                endpoints.push_back(endpoint);
+            }
+            else if (!endpoint.empty())
+            {
+                RPC_LOG(warn) << "invalid endpoint " << endpoint << " in registry entry: " << line;
+            }
+        }
+
+        if (key.empty() || endpoints.empty())
+        {
+            RPC_LOG(warn) << "invalid registry entry: " << line;
+            continue;
+        }
+        Add(key, endpoints);
+        ++entries;
+    }
+    return entries;
+}
+
+void RPCStaticRegistry::Add(const std::string& key, const std::vector<std::string>& endpoints)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+    std::vector<std::string>& list = m_endpoints[key];
+    for (const auto& endpoint : endpoints)
+    {
+        if (std::find(list.begin(), list.end(), endpoint) == list.end())
+        {
+            list.push_back(endpoint);
+        }
+    }
+}
+
+int RPCStaticRegistry::Register(const ServiceMethods& services, const std::string& endpoint)
+{
+    for (const auto& service : services)
+    {
+        for (const auto& method : service.second)
+        {
+            Add(service.first + "/" + method, {endpoint});
+        }
+    }
+    return 0;
+}
+
+int RPCStaticRegistry::Deregister(const ServiceMethods& services, const std::string& endpoint)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+    for (const auto& service : services)
+    {
+        for (const auto& method : service.second)
+        {
+            auto it = m_endpoints.find(service.first + "/" + method);
+            if (it == m_endpoints.end())
+            {
+                continue;
+            }
+            std::vector<std::string>& endpoints = it->second;
+            endpoints.erase(std::remove(endpoints.begin(), endpoints.end(), endpoint), endpoints.end());
+            if (endpoints.empty())
+            {
+                m_endpoints.erase(it);
+            }
+        }
+    }
+    return 0;
+}
+
+std::string RPCStaticRegistry::Lookup(const std::string& serviceName, const std::string& methodName)
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    auto it = m_endpoints.find(serviceName + "/" + methodName);
+    if (it == m_endpoints.end())
+    {
+        it = m_endpoints.find(serviceName);
+    }
+    if (it == m_endpoints.end() || it->second.empty())
+    {
+        return "";
+    }
+
+    const std::vector<std::string>& list = it->second;
+    if (list.size() == 1)
+    {
+        return list.front();
+    }
+
+    // 轮流选择，跳过熔断器打开的地址；都不可用时仍然返回轮到的地址，由熔断器快速失败
+    uint64_t start = m_next.fetch_add(1, std::memory_order_relaxed);
+    RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        const std::string& endpoint = list[(start + i) % list.size()];
+        if (pPool->IsAvailable(endpoint))
+        {
+            return endpoint;
+        }
+    }
+    return list[start % list.size()];
+}
+
+std::vector<std::string> RPCStaticRegistry::ListEndpoints(const std::string& serviceName)
+{
+    std::set<std::string> addrs;
+    std::string prefix(serviceName + "/");
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    for (const auto& e : m_endpoints)
+    {
+        if (e.first == serviceName || e.first.compare(0, prefix.size(), prefix) == 0)
+        {
+            addrs.insert(e.second.begin(), e.second.end());
+        }
+    }
+    return std::vector<std::string>(addrs.begin(), addrs.end());
+}
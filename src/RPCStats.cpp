@@ -0,0 +1,288 @@
+#include "RPCStats.h"
+#include "Stats.pb.h"
+#include "RPCMemoryBudget.h"
+#include "ZkConnectionManager.h"
+
+#include <algorithm>
+#include <sstream>
+#include <map>
+
+RPCStats* RPCStats::GetInstance()
+{
+    static RPCStats instance;
+    return &instance;
+}
+
+void RPCStats::MethodMetrics::Merge(const MethodMetrics& other)
+{
+    m_started += other.m_started;
+    m_finished += other.m_finished;
+    for (int i = 0; i < kErrorSlots; ++i)
+    {
+        m_errors[i] += other.m_errors[i];
+    }
+    m_bytesIn += other.m_bytesIn;
+    m_bytesOut += other.m_bytesOut;
+    m_latency.Merge(other.m_latency);
+}
+
+void RPCStats::PhaseMetrics::Merge(const PhaseMetrics& other)
+{
+    for (int i = 0; i < RPCCallTiming::kPhaseCount; ++i)
+    {
+        if (other.m_phases[i] == nullptr)
+        {
+            continue;
+        }
+        if (m_phases[i] == nullptr)
+        {
+            m_phases[i].reset(new RPCHistogram());
+        }
+        m_phases[i]->Merge(*other.m_phases[i]);
+    }
+}
+
+RPCStats::ShardHolder::~ShardHolder()
+{
+    if (m_pShard == nullptr)
+    {
+        return;
+    }
+
+    RPCStats* pStats = RPCStats::GetInstance();
+    std::lock_guard<std::mutex> lock(pStats->m_mtx);
+    pStats->m_shards.erase(std::remove(pStats->m_shards.begin(), pStats->m_shards.end(), m_pShard), pStats->m_shards.end());
+    for (int side = 0; side < 2; ++side)
+    {
+        for (const auto& e : m_pShard->m_metrics[side])
+        {
+            pStats->m_retired[side][e.first].Merge(e.second);
+        }
+    }
+    pStats->m_retiredPhases.Merge(m_pShard->m_phases);
+    delete m_pShard;
+    m_pShard = nullptr;
+}
+
+RPCStats::Shard* RPCStats::LocalShard()
+{
+    static thread_local ShardHolder holder;
+    if (holder.m_pShard == nullptr)
+    {
+        holder.m_pShard = new Shard();
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_shards.push_back(holder.m_pShard);
+    }
+    return holder.m_pShard;
+}
+
+void RPCStats::OnStart(Side side, const google::protobuf::MethodDescriptor* method)
+{
+    Shard* pShard = LocalShard();
+    std::lock_guard<std::mutex> lock(pShard->m_mtx);
+    ++pShard->m_metrics[side][method].m_started;
+}
+
+void RPCStats::OnFinish(Side side, const google::protobuf::MethodDescriptor* method, int errorCode,
+                        size_t bytesIn, size_t bytesOut, uint64_t latencyNs)
+{
+    Shard* pShard = LocalShard();
+    std::lock_guard<std::mutex> lock(pShard->m_mtx);
+    MethodMetrics& metrics = pShard->m_metrics[side][method];
+    ++metrics.m_finished;
+    if (errorCode != 0)
+    {
+        ++metrics.m_errors[std::min(std::max(errorCode, kLocalError) + 1, kErrorSlots - 1)];
+    }
+    metrics.m_bytesIn += bytesIn;
+    metrics.m_bytesOut += bytesOut;
+    metrics.m_latency.Record(latencyNs);
+}
+
+void RPCStats::OnPhases(const RPCCallTiming& timing)
+{
+    Shard* pShard = LocalShard();
+    std::lock_guard<std::mutex> lock(pShard->m_mtx);
+    for (int i = 0; i < RPCCallTiming::kPhaseCount; ++i)
+    {
+        RPCCallTiming::Phase phase = static_cast<RPCCallTiming::Phase>(i);
+        if (!timing.Marked(phase))
+        {
+            continue;
+        }
+        std::unique_ptr<RPCHistogram>& pHistogram = pShard->m_phases.m_phases[i];
+        if (pHistogram == nullptr)
+        {
+            pHistogram.reset(new RPCHistogram());
+        }
+        pHistogram->Record(timing.PhaseNs(phase));
+    }
+}
+
+// 合并所有分片。调用可能在一个线程开始、在另一个线程结束，所以正在进行的调用数只有合并之后才有意义
+void RPCStats::Collect(MetricsMap merged[2], PhaseMetrics* phases)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (int side = 0; side < 2; ++side)
+    {
+        for (const auto& e : m_retired[side])
+        {
+            merged[side][e.first].Merge(e.second);
+        }
+    }
+    phases->Merge(m_retiredPhases);
+
+    for (Shard* pShard : m_shards)
+    {
+        std::lock_guard<std::mutex> shardLock(pShard->m_mtx);
+        for (int side = 0; side < 2; ++side)
+        {
+            for (const auto& e : pShard->m_metrics[side])
+            {
+                merged[side][e.first].Merge(e.second);
+            }
+        }
+        phases->Merge(pShard->m_phases);
+    }
+}
+
+void RPCStats::Snapshot(MyRPC::StatsResponse* response, const std::string& prefix)
+{
+    MetricsMap merged[2];
+    PhaseMetrics phases;
+    Collect(merged, &phases);
+
+    for (int side = 0; side < 2; ++side)
+    {
+        // 按方法名排序，方便对比两次拉取的结果
+        std::map<std::string, const MethodMetrics*> sorted;
+        for (const auto& e : merged[side])
+        {
+            std::string name = e.first == nullptr ? std::string("<unknown>") : static_cast<std::string>(e.first->full_name());
+            if (name.compare(0, prefix.size(), prefix) == 0)
+            {
+                sorted[name] = &e.second;
+            }
+        }
+
+        for (const auto& e : sorted)
+        {
+            const MethodMetrics& metrics = *e.second;
+            MyRPC::MethodStats* pStats = response->add_methods();
+            pStats->set_method(e.first);
+            pStats->set_client(side == kClient);
+            pStats->set_requests(metrics.m_finished);
+            uint64_t errors = 0;
+            for (int i = 0; i < kErrorSlots; ++i)
+            {
+                if (metrics.m_errors[i] != 0)
+                {
+                    (*pStats->mutable_error_codes())[i - 1] = metrics.m_errors[i];
+                    errors += metrics.m_errors[i];
+                }
+            }
+            pStats->set_errors(errors);
+            pStats->set_in_flight(static_cast<int64_t>(metrics.m_started - metrics.m_finished));
+            pStats->set_bytes_in(metrics.m_bytesIn);
+            pStats->set_bytes_out(metrics.m_bytesOut);
+            pStats->set_latency_mean_us(static_cast<uint64_t>(metrics.m_latency.Mean()) / 1000);
+            pStats->set_latency_p50_us(metrics.m_latency.Percentile(0.50) / 1000);
+            pStats->set_latency_p90_us(metrics.m_latency.Percentile(0.90) / 1000);
+            pStats->set_latency_p99_us(metrics.m_latency.Percentile(0.99) / 1000);
+            pStats->set_latency_p999_us(metrics.m_latency.Percentile(0.999) / 1000);
+            pStats->set_latency_max_us(metrics.m_latency.Max() / 1000);
+        }
+    }
+
+    for (int i = 0; i < RPCCallTiming::kPhaseCount; ++i)
+    {
+        const RPCHistogram* pHistogram = phases.m_phases[i].get();
+        if (pHistogram == nullptr)
+        {
+            continue;
+        }
+        MyRPC::PhaseStats* pPhase = response->add_phases();
+        pPhase->set_phase(RPCCallTiming::PhaseName(static_cast<RPCCallTiming::Phase>(i)));
+        pPhase->set_client(i < RPCCallTiming::kServerPhaseBegin);
+        pPhase->set_count(pHistogram->Count());
+        pPhase->set_mean_ns(static_cast<uint64_t>(pHistogram->Mean()));
+        pPhase->set_p50_ns(pHistogram->Percentile(0.50));
+        pPhase->set_p90_ns(pHistogram->Percentile(0.90));
+        pPhase->set_p99_ns(pHistogram->Percentile(0.99));
+        pPhase->set_max_ns(pHistogram->Max());
+    }
+
+    RPCMemoryBudget::GetInstance()->Fill(response->mutable_memory());
+    ZkConnectionManager::getInstance()->Fill(response->mutable_registry());
+}
+
+std::string RPCStats::DumpText(const std::string& prefix)
+{
+    MyRPC::StatsResponse response;
+    Snapshot(&response, prefix);
+    return FormatText(response);
+}
+
+std::string RPCStats::FormatText(const MyRPC::StatsResponse& response)
+{
+    std::ostringstream out;
+    for (const auto& s : response.methods())
+    {
+        out << (s.client() ? "client " : "server ") << s.method()
+            << " requests=" << s.requests()
+            << " errors=" << s.errors()
+            << " inflight=" << s.in_flight()
+            << " in=" << s.bytes_in() << "B"
+            << " out=" << s.bytes_out() << "B"
+            << " latency(us): mean=" << s.latency_mean_us()
+            << " p50=" << s.latency_p50_us()
+            << " p90=" << s.latency_p90_us()
+            << " p99=" << s.latency_p99_us()
+            << " p999=" << s.latency_p999_us()
+            << " max=" << s.latency_max_us();
+        if (s.errors() != 0)
+        {
+            std::map<int32_t, uint64_t> codes(s.error_codes().begin(), s.error_codes().end());
+            out << " codes:";
+            for (const auto& e : codes)
+            {
+                out << " " << e.first << "=" << e.second;
+            }
+        }
+        out << "\n";
+    }
+    for (const auto& s : response.phases())
+    {
+        out << (s.client() ? "client " : "server ") << "phase " << s.phase()
+            << " count=" << s.count()
+            << " latency(ns): mean=" << s.mean_ns()
+            << " p50=" << s.p50_ns()
+            << " p90=" << s.p90_ns()
+            << " p99=" << s.p99_ns()
+            << " max=" << s.max_ns()
+            << "\n";
+    }
+    if (response.has_memory() && response.memory().connections() != 0)
+    {
+        const MyRPC::MemoryStats& m = response.memory();
+        out << "memory total=" << m.total_bytes() << "B/" << m.total_limit_bytes() << "B"
+            << " input=" << m.input_bytes() << "B"
+            << " reassembly=" << m.reassembly_bytes() << "B"
+            << " inflight=" << m.in_flight_bytes() << "B"
+            << " output=" << m.output_bytes() << "B"
+            << " calls=" << m.in_flight_calls()
+            << " connections=" << m.connections()
+            << " rejected(frames/calls)=" << m.rejected_frames() << "/" << m.rejected_calls()
+            << "\n";
+    }
+    if (response.has_registry() && (response.registry().connected() || response.registry().unavailable_ms() != 0))
+    {
+        const MyRPC::RegistryStats& r = response.registry();
+        out << "registry connected=" << (r.connected() ? "yes" : "no")
+            << " expirations=" << r.session_expirations()
+            << " reconnects=" << r.reconnects()
+            << " unavailable=" << r.unavailable_ms() << "ms"
+            << "\n";
+    }
+    return out.str();
+}
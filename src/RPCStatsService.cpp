@@ -0,0 +1,15 @@
+#include "RPCStatsService.h"
+#include "RPCStats.h"
+
+void RPCStatsService::GetStats(google::protobuf::RpcController *controller,
+                               const MyRPC::StatsRequest *request,
+                               MyRPC::StatsResponse *response,
+                               google::protobuf::Closure *done)
+{
+    RPCStats::GetInstance()->Snapshot(response, request->method_prefix());
+    if (request->text())
+    {
+        response->set_text(RPCStats::FormatText(*response));
+    }
+    done->Run();
+}
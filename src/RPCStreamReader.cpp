@@ -0,0 +1,179 @@
+#include "RPCStreamReader.h"
+#include "RPCConnection.h"
+#include "RPCConnectionsPool.h"
+#include "RPCChunk.h"
+#include "Response.pb.h"
+#include "RPCLog.h"
+
+#include <algorithm>
+
+RPCStreamReader::RPCStreamReader(std::shared_ptr<RPCConnection> pConn, uint64_t streamId, google::protobuf::RpcController *controller,
+                                 const std::string& serviceName, bool probe, std::chrono::steady_clock::time_point sendTime)
+: m_pConn(std::move(pConn)),
+  m_streamId(streamId),
+  m_controller(controller),
+  m_finished(false),
+  m_ip(m_pConn->GetIp()),
+  m_port(m_pConn->GetPort()),
+  m_serviceName(serviceName),
+  m_probe(probe),
+  m_reported(false),
+  m_sendTime(sendTime),
+  m_latencyNs(0)
+{
+}
+
+RPCStreamReader::~RPCStreamReader()
+{
+    if (!m_finished && m_pConn)
+    {
+        // 流还没有读完，连接上残留着未读的帧，不能再复用
+        m_pConn->close();
+    }
+    // 调用方提前放弃了流：已经收到过响应说明主机正常，一帧都没有收到时不知道结果，只归还探测名额
+    Report(true, m_latencyNs == 0);
+    Release();
+}
+
+bool RPCStreamReader::Read(google::protobuf::Message *msg)
+{
+    std::string data;
+    if (NextFrame(&data) != 1)
+    {
+        return false;
+    }
+
+    if (!msg->ParseFromString(data))
+    {
+        RPC_LOG(error) << "ParseFromString() err";
+        m_controller->SetFailed("ParseFromString() err");
+        return false;
+    }
+    return true;
+}
+
+bool RPCStreamReader::Finish(google::protobuf::Message *response)
+{
+    std::string data;
+    while (NextFrame(&data) == 1) // 丢弃剩余的数据帧
+    {
+    }
+
+    if (m_controller->Failed())
+    {
+        return false;
+    }
+
+    if (response != nullptr && !response->ParseFromString(m_trailer))
+    {
+        RPC_LOG(error) << "ParseFromString() err";
+        m_controller->SetFailed("ParseFromString() err");
+        return false;
+    }
+    return true;
+}
+
+int RPCStreamReader::NextFrame(std::string* data)
+{
+    if (m_finished)
+    {
+        return 0;
+    }
+
+    int ret = m_pConn->RecvFrame(&m_frame);
+    if (ret != 1)
+    {
+        std::string msg(ret == 0 ? "对端连接异常断开" : "recv() err");
+        RPC_LOG(error) << msg;
+        m_controller->SetFailed(msg);
+        m_pConn->close();
+        m_finished = true;
+        Report(false);
+        Release();
+        return -1;
+    }
+    if (m_latencyNs == 0)
+    {
+        m_latencyNs = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_sendTime).count());
+    }
+
+    MyRPC::RPCResponseWrapper wrapper;
+    std::vector<std::string> chunks; // 单帧响应过大时会被分块发送
+    ret = RPCChunk::CollectResponse(m_pConn.get(), m_frame, &wrapper, &chunks);
+    if (ret != 1 || wrapper.stream_id() != m_streamId)
+    {
+        RPC_LOG(error) << "invalid stream frame, streamId=" << m_streamId;
+        m_controller->SetFailed("invalid stream frame");
+        m_pConn->close();
+        m_finished = true;
+        Report(false);
+        Release();
+        return -1;
+    }
+
+    if (!wrapper.success()) // 服务端返回错误，错误帧同时也是流的最后一帧
+    {
+        m_controller->SetFailed(wrapper.error().error_message());
+        m_finished = true;
+        // 和 SendToServer 一样：业务错误说明主机是正常的，过载、正在停止或者限流的拒绝不报告
+        int errorCode = wrapper.error().error_code();
+        Report(true, errorCode == MyRPC::RPCResponseError::RESOURCE_EXHAUSTED || errorCode == MyRPC::RPCResponseError::UNAVAILABLE
+                     || errorCode == MyRPC::RPCResponseError::RATE_LIMITED);
+        Release();
+        return -1;
+    }
+
+    std::string joined; // 流式响应的单帧通常很小，分块时直接拼接
+    for (auto& chunk : chunks)
+    {
+        if (joined.empty())
+        {
+            joined.swap(chunk);
+        }
+        else
+        {
+            joined.append(chunk);
+        }
+    }
+
+    if (wrapper.end_of_stream()) // 读到 trailer，流正常结束
+    {
+        m_trailer.swap(joined);
+        m_finished = true;
+        Report(true);
+        Release();
+        return 0;
+    }
+
+    data->swap(joined);
+    return 1;
+}
+
+void RPCStreamReader::Report(bool success, bool rejected)
+{
+    if (m_reported)
+    {
+        return;
+    }
+    m_reported = true;
+
+    RPCConnectionsPool* pConnPool = RPCConnectionsPool::GetInstance();
+    if (rejected)
+    {
+        if (m_probe)
+        {
+            pConnPool->ReleaseProbe(m_ip, m_port);
+        }
+        return;
+    }
+    pConnPool->ReportResult(m_ip, m_port, m_serviceName, success, m_latencyNs);
+}
+
+void RPCStreamReader::Release()
+{
+    if (m_pConn)
+    {
+        RPCConnectionsPool::GetInstance()->ReturnConnection(std::move(m_pConn));
+        m_pConn.reset();
+    }
+}
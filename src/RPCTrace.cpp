@@ -0,0 +1,298 @@
+#include "RPCTrace.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+    // 一个 span 阶段
+    struct SpanEvent
+    {
+        const char* m_name;
+        const google::protobuf::MethodDescriptor* m_method;
+        uint64_t m_traceId;
+        uint64_t m_spanId;
+        uint64_t m_parentSpanId;
+        uint64_t m_startNs;
+        uint64_t m_durNs;
+    };
+
+    // 单生产者单消费者的环形缓冲区：所属线程写入，后台线程读取
+    struct SpanRing
+    {
+        static constexpr size_t kCapacity = 4096;
+
+        SpanEvent m_events[kCapacity];
+        std::atomic<size_t> m_head{0};       // 下一个写入位置，只由所属线程修改
+        std::atomic<size_t> m_tail{0};       // 下一个读取位置，只由后台线程修改
+        std::atomic<bool> m_retired{false};  // 所属线程已经退出，读完之后可以释放
+        long m_tid = 0;
+
+        bool Push(const SpanEvent& event)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) == kCapacity) // 缓冲区已满，丢弃
+            {
+                return false;
+            }
+            m_events[head % kCapacity] = event;
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    std::atomic<bool> g_tracerStarted(false); // 是否记录过 span，没有记录过时不创建追踪文件
+
+    // 把 span 从各线程的缓冲区写入文件的后台任务。进程退出前不会释放
+    class RPCTracer
+    {
+    public:
+        static RPCTracer* GetInstance()
+        {
+            static RPCTracer* instance = []()
+            {
+                RPCTracer* p = new RPCTracer();
+                std::atexit([]() { RPCTracer::GetInstance()->Flush(); }); // 进程正常退出时写出剩余的 span
+                g_tracerStarted.store(true, std::memory_order_release);
+                return p;
+            }();
+            return instance;
+        }
+
+        void Push(const SpanEvent& event)
+        {
+            if (!LocalRing()->Push(event))
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // 读出所有缓冲区里的 span 写入文件，并释放已经退出的线程的缓冲区
+        void Flush()
+        {
+            std::lock_guard<std::mutex> fileLock(m_fileMtx);
+            std::vector<SpanRing*> rings;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                rings = m_rings;
+            }
+
+            for (SpanRing* pRing : rings)
+            {
+                bool retired = pRing->m_retired.load(std::memory_order_acquire); // 先读标志，保证之后读到的是全部 span
+                size_t tail = pRing->m_tail.load(std::memory_order_relaxed);
+                size_t head = pRing->m_head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail)
+                {
+                    Write(pRing->m_tid, pRing->m_events[tail % SpanRing::kCapacity]);
+                }
+                pRing->m_tail.store(tail, std::memory_order_release);
+
+                if (retired)
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    m_rings.erase(std::find(m_rings.begin(), m_rings.end(), pRing));
+                    delete pRing;
+                }
+            }
+
+            uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0)
+            {
+                RPC_LOG(warn) << "trace buffer full, dropped " << dropped << " spans";
+            }
+            if (m_file != nullptr)
+            {
+                fflush(m_file);
+            }
+        }
+
+    private:
+        // 线程退出时标记缓冲区，由后台线程读完之后释放
+        struct RingHolder
+        {
+            SpanRing* m_pRing = nullptr;
+            ~RingHolder()
+            {
+                if (m_pRing != nullptr)
+                {
+                    m_pRing->m_retired.store(true, std::memory_order_release);
+                }
+            }
+        };
+
+        RPCTracer()
+        : m_pid(getpid())
+        {
+            std::string path = RPCApplication::GetInstance().GetConfig().Load("traceFile");
+            if (path.empty())
+            {
+                path = "myrpc_trace_" + std::to_string(m_pid) + ".json";
+            }
+
+            // Chrome Trace Event 的 JSON 数组格式允许省略结尾的 ]，所以可以一直追加
+            m_file = fopen(path.c_str(), "w");
+            if (m_file == nullptr)
+            {
+                RPC_LOG(error) << "open trace file " << path << " failed";
+            }
+            else
+            {
+                fputs("[\n", m_file);
+            }
+
+            std::thread([this]()
+            {
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    Flush();
+                }
+            }).detach();
+        }
+
+        SpanRing* LocalRing()
+        {
+            static thread_local RingHolder holder;
+            if (holder.m_pRing == nullptr)
+            {
+                holder.m_pRing = new SpanRing();
+                holder.m_pRing->m_tid = syscall(SYS_gettid);
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_rings.push_back(holder.m_pRing);
+            }
+            return holder.m_pRing;
+        }
+
+        void Write(long tid, const SpanEvent& event)
+        {
+            if (m_file == nullptr)
+            {
+                return;
+            }
+
+            std::string method = event.m_method == nullptr ? std::string() : static_cast<std::string>(event.m_method->full_name());
+            fprintf(m_file,
+                    "{\"name\":\"%s\",\"cat\":\"rpc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,"
+                    "\"args\":{\"method\":\"%s\",\"trace_id\":\"%016llx\",\"span_id\":\"%016llx\",\"parent_span_id\":\"%016llx\"}},\n",
+                    event.m_name, event.m_startNs / 1000.0, event.m_durNs / 1000.0, m_pid, tid, method.c_str(),
+                    static_cast<unsigned long long>(event.m_traceId),
+                    static_cast<unsigned long long>(event.m_spanId),
+                    static_cast<unsigned long long>(event.m_parentSpanId));
+        }
+
+        int m_pid;
+        std::mutex m_mtx;              // 保护 m_rings
+        std::vector<SpanRing*> m_rings; // 所有线程的缓冲区
+        std::mutex m_fileMtx;          // 同一时间只有一个线程写文件
+        FILE* m_file = nullptr;
+        std::atomic<uint64_t> m_dropped{0};
+    };
+
+    // 读取配置项 traceSampleRate，取值 [0, 1]，默认 0 即只传递上游的调用链，不主动开启
+    double SampleRate()
+    {
+        static const double rate = RPCApplication::GetInstance().GetConfig().LoadNumber("traceSampleRate", 0.0, 0.0, 1.0);
+        return rate;
+    }
+
+    std::mt19937_64& LocalRandom()
+    {
+        static thread_local std::mt19937_64 rng(std::random_device{}() ^ RPCTrace::NowNs());
+        return rng;
+    }
+
+    // 生成非 0 的随机 ID
+    uint64_t NewId()
+    {
+        uint64_t id = 0;
+        while (id == 0)
+        {
+            id = LocalRandom()();
+        }
+        return id;
+    }
+}
+
+const RPCTraceContext*& RPCTrace::CurrentSlot()
+{
+    static thread_local const RPCTraceContext* current = nullptr;
+    return current;
+}
+
+const RPCTraceContext* RPCTrace::Current()
+{
+    return CurrentSlot();
+}
+
+RPCTraceContext RPCTrace::NewChild(const RPCTraceContext& parent)
+{
+    RPCTraceContext ctx;
+    if (parent.m_traceId != 0)
+    {
+        ctx.m_traceId = parent.m_traceId;
+        ctx.m_parentSpanId = parent.m_spanId;
+        ctx.m_sampled = parent.m_sampled;
+        ctx.m_spanId = NewId();
+        return ctx;
+    }
+
+    double rate = SampleRate();
+    if (rate <= 0) // 没有开启追踪，请求里不携带调用链信息
+    {
+        return ctx;
+    }
+
+    ctx.m_traceId = NewId();
+    ctx.m_spanId = NewId();
+    ctx.m_sampled = std::uniform_real_distribution<double>(0.0, 1.0)(LocalRandom()) < rate;
+    return ctx;
+}
+
+uint64_t RPCTrace::NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RPCTrace::Record(const RPCTraceContext& ctx, const char* name, const google::protobuf::MethodDescriptor* method,
+                      uint64_t startNs, uint64_t endNs)
+{
+    if (!ctx.m_sampled)
+    {
+        return;
+    }
+
+    SpanEvent event{name, method, ctx.m_traceId, ctx.m_spanId, ctx.m_parentSpanId, startNs, endNs > startNs ? endNs - startNs : 0};
+    RPCTracer::GetInstance()->Push(event);
+}
+
+void RPCTrace::Flush()
+{
+    if (g_tracerStarted.load(std::memory_order_acquire))
+    {
+        RPCTracer::GetInstance()->Flush();
+    }
+}
+
+RPCTraceScope::RPCTraceScope(const RPCTraceContext* ctx)
+: m_prev(RPCTrace::CurrentSlot())
+{
+    RPCTrace::CurrentSlot() = ctx;
+}
+
+RPCTraceScope::~RPCTraceScope()
+{
+    RPCTrace::CurrentSlot() = m_prev;
+}
@@ -0,0 +1,247 @@
+#include "RPCUring.h"
+#include "RPCLog.h"
+
+#include <sys/socket.h>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <algorithm>
+
+#ifdef MYRPC_HAVE_LIBURING
+namespace
+{
+    const __u64 kSendTag = 1; // send 请求的 user_data
+    const __u64 kRecvTag = 2; // recv 请求的 user_data
+    const unsigned kRingEntries = 8; // 同步调用模型下，每个线程同时最多只有一组 send + recv
+}
+#endif
+
+RPCUring::RPCUring()
+: m_inited(false),
+  m_recvBuf(nullptr)
+{
+}
+
+RPCUring::~RPCUring()
+{
+#ifdef MYRPC_HAVE_LIBURING
+    if (m_inited)
+    {
+        io_uring_queue_exit(&m_ring);
+    }
+#endif
+    delete[] m_recvBuf;
+}
+
+bool RPCUring::IsSupported()
+{
+#ifdef MYRPC_HAVE_LIBURING
+    // 创建一个临时 ring，探测内核是否支持需要的操作码
+    static const bool supported = []() -> bool
+    {
+        struct io_uring ring;
+        if (io_uring_queue_init(2, &ring, 0) < 0)
+        {
+            RPC_LOG(warn) << "io_uring_queue_init() err, fallback to blocking I/O";
+            return false;
+        }
+
+        bool ok = false;
+        struct io_uring_probe* probe = io_uring_get_probe_ring(&ring);
+        if (probe != nullptr)
+        {
+            ok = io_uring_opcode_supported(probe, IORING_OP_SEND) &&
+                 io_uring_opcode_supported(probe, IORING_OP_READ_FIXED);
+            io_uring_free_probe(probe);
+        }
+        io_uring_queue_exit(&ring);
+
+        if (!ok)
+        {
+            RPC_LOG(warn) << "io_uring opcode not supported, fallback to blocking I/O";
+        }
+        return ok;
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+RPCUring* RPCUring::ThreadLocal()
+{
+    if (!IsSupported())
+    {
+        return nullptr;
+    }
+
+    thread_local std::unique_ptr<RPCUring> pUring;
+    thread_local bool failed = false;
+    if (!pUring && !failed)
+    {
+        pUring.reset(new RPCUring());
+        if (!pUring->Init())
+        {
+            pUring.reset();
+            failed = true; // 当前线程初始化失败，后续调用直接走阻塞 I/O
+        }
+    }
+    return pUring.get();
+}
+
+bool RPCUring::Init()
+{
+#ifdef MYRPC_HAVE_LIBURING
+    if (io_uring_queue_init(kRingEntries, &m_ring, 0) < 0)
+    {
+        RPC_LOG(error) << "io_uring_queue_init() err";
+        return false;
+    }
+    m_inited = true;
+
+    m_recvBuf = new char[kRecvBufferSize];
+    struct iovec iov;
+    iov.iov_base = m_recvBuf;
+    iov.iov_len = kRecvBufferSize;
+    if (io_uring_register_buffers(&m_ring, &iov, 1) < 0) // 注册固定缓冲区，省去每次 I/O 时内核对用户页的映射
+    {
+        RPC_LOG(error) << "io_uring_register_buffers() err";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef MYRPC_HAVE_LIBURING
+void RPCUring::Reap(int count, int* results)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        struct io_uring_cqe* cqe = nullptr;
+        int ret = io_uring_wait_cqe(&m_ring, &cqe);
+        if (ret < 0)
+        {
+            results[0] = results[1] = ret;
+            return;
+        }
+        results[cqe->user_data == kSendTag ? 0 : 1] = cqe->res;
+        io_uring_cqe_seen(&m_ring, cqe);
+    }
+}
+#endif
+
+int RPCUring::SendRecv(int fd, const char* data, size_t len, char* buf, size_t bufSize)
+{
+#ifdef MYRPC_HAVE_LIBURING
+    size_t recvLen = std::min(bufSize, kRecvBufferSize);
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    io_uring_prep_send(sqe, fd, data, len, MSG_NOSIGNAL | MSG_WAITALL);
+    sqe->flags |= IOSQE_IO_LINK; // send 成功完成后才会执行后面的 recv
+    io_uring_sqe_set_data64(sqe, kSendTag);
+
+    sqe = io_uring_get_sqe(&m_ring);
+    io_uring_prep_read_fixed(sqe, fd, m_recvBuf, recvLen, 0, 0);
+    io_uring_sqe_set_data64(sqe, kRecvTag);
+
+    // 一次系统调用完成提交和等待
+    int ret = io_uring_submit_and_wait(&m_ring, 2);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+
+    int results[2] = {0, 0};
+    Reap(2, results);
+
+    if (results[0] < 0)
+    {
+        errno = -results[0];
+        return -1;
+    }
+    if (static_cast<size_t>(results[0]) < len) // 短写会断开链接，剩余部分用单独的请求补齐
+    {
+        size_t sent = results[0];
+        while (sent < len)
+        {
+            int n = Send(fd, data + sent, len - sent);
+            if (n <= 0)
+            {
+                return -1;
+            }
+            sent += n;
+        }
+        return Recv(fd, buf, bufSize);
+    }
+
+    if (results[1] < 0)
+    {
+        errno = -results[1];
+        return -1;
+    }
+    memcpy(buf, m_recvBuf, results[1]); // 固定缓冲区由线程共用，拷贝到调用方，见 RPCUring.h 的已知限制
+    return results[1];
+#else
+    return -1;
+#endif
+}
+
+int RPCUring::Send(int fd, const char* data, size_t len)
+{
+#ifdef MYRPC_HAVE_LIBURING
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    io_uring_prep_send(sqe, fd, data, len, MSG_NOSIGNAL | MSG_WAITALL);
+    io_uring_sqe_set_data64(sqe, kSendTag);
+
+    int ret = io_uring_submit_and_wait(&m_ring, 1);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+
+    int results[2] = {0, 0};
+    Reap(1, results);
+    if (results[0] < 0)
+    {
+        errno = -results[0];
+        return -1;
+    }
+    return results[0];
+#else
+    return -1;
+#endif
+}
+
+int RPCUring::Recv(int fd, char* buf, size_t bufSize)
+{
+#ifdef MYRPC_HAVE_LIBURING
+    size_t recvLen = std::min(bufSize, kRecvBufferSize);
+
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    io_uring_prep_read_fixed(sqe, fd, m_recvBuf, recvLen, 0, 0);
+    io_uring_sqe_set_data64(sqe, kRecvTag);
+
+    int ret = io_uring_submit_and_wait(&m_ring, 1);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+
+    int results[2] = {0, 0};
+    Reap(1, results);
+    if (results[1] < 0)
+    {
+        errno = -results[1];
+        return -1;
+    }
+    memcpy(buf, m_recvBuf, results[1]); // 固定缓冲区由线程共用，拷贝到调用方，见 RPCUring.h 的已知限制
+    return results[1];
+#else
+    return -1;
+#endif
+}
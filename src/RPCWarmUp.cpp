@@ -0,0 +1,115 @@
+#include "RPCWarmUp.h"
+#include "RPCConnectionsPool.h"
+#include "RPCRegistry.h"
+#include "RPCLog.h"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <chrono>
+#include <thread>
+#include <set>
+#include <atomic>
+
+RPCWarmUpResult RPCWarmUp::Run(const std::vector<std::string>& services, int connectionsPerHost)
+{
+    auto start = std::chrono::steady_clock::now();
+    RPCWarmUpResult result;
+
+    // 1.解析所有服务的提供者地址，同一个地址只预热一次
+    std::set<std::string> endpoints;
+    for (const auto& fullName : services)
+    {
+        WarmDescriptors(fullName);
+
+        size_t dot = fullName.rfind('.');
+        std::string serviceName = (dot == std::string::npos) ? fullName : fullName.substr(dot + 1); // 注册中心里的服务名不带包名
+        std::vector<std::string> addrs = ResolveService(serviceName);
+        if (addrs.empty())
+        {
+            RPC_LOG(warn) << "warm up: no provider for " << serviceName;
+            ++result.m_failures;
+            continue;
+        }
+        ++result.m_services;
+        endpoints.insert(addrs.begin(), addrs.end());
+    }
+    result.m_endpoints = endpoints.size();
+
+    // 2.每个地址一个线程，并行建立连接
+    std::atomic<int> connections(0);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (const auto& addr : endpoints)
+    {
+        threads.emplace_back([&, addr]()
+        {
+            std::string ip;
+            uint16_t port = 0;
+            if (!RPCRegistry::ParseEndpoint(addr, &ip, &port))
+            {
+                RPC_LOG(warn) << "warm up skipped invalid endpoint " << addr;
+                ++failures;
+                return;
+            }
+            int cnt = RPCConnectionsPool::GetInstance()->Prewarm(ip, port, connectionsPerHost);
+            connections += cnt;
+            if (cnt == 0)
+            {
+                ++failures;
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    result.m_connections = connections.load();
+    result.m_failures += failures.load();
+    result.m_elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    RPC_LOG(info) << "warm up finished: services=" << result.m_services
+                   << " endpoints=" << result.m_endpoints
+                   << " connections=" << result.m_connections
+                   << " failures=" << result.m_failures
+                   << " elapsed=" << result.m_elapsedMs << "ms";
+    return result;
+}
+
+std::shared_future<RPCWarmUpResult> RPCWarmUp::RunAsync(const std::vector<std::string>& services,
+                                                        int connectionsPerHost,
+                                                        std::function<void(const RPCWarmUpResult&)> callback)
+{
+    return std::async(std::launch::async, [services, connectionsPerHost, callback]()
+    {
+        RPCWarmUpResult result = Run(services, connectionsPerHost);
+        if (callback)
+        {
+            callback(result);
+        }
+        return result;
+    }).share();
+}
+
+std::vector<std::string> RPCWarmUp::ResolveService(const std::string& serviceName)
+{
+    // 使用 zookeeper 时顺便建立了会话，之后的调用不再需要等待会话建立
+    return RPCRegistry::GetInstance()->ListEndpoints(serviceName);
+}
+
+void RPCWarmUp::WarmDescriptors(const std::string& fullName)
+{
+    const google::protobuf::ServiceDescriptor* pService =
+        google::protobuf::DescriptorPool::generated_pool()->FindServiceByName(fullName);
+    if (pService == nullptr) // 不带包名或者不是本进程编译进来的服务
+    {
+        return;
+    }
+
+    google::protobuf::MessageFactory* pFactory = google::protobuf::MessageFactory::generated_factory();
+    for (int i = 0; i < pService->method_count(); ++i)
+    {
+        pFactory->GetPrototype(pService->method(i)->input_type());
+        pFactory->GetPrototype(pService->method(i)->output_type());
+    }
+}
@@ -1,4 +1,16 @@
 #include "ZkConnectionManager.h"
+#include "Stats.pb.h"
+#include "RPCLog.h"
+#include "RPCApplication.h"
+
+#include <thread>
+#include <chrono>
+
+// steady_clock 的当前时间（纳秒）
+static int64_t SteadyNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 ZkConnectionManager* ZkConnectionManager::getInstance()
 {
@@ -6,24 +18,153 @@ ZkConnectionManager* ZkConnectionManager::getInstance()
     return &instance;
 }
 
-ZkClient* ZkConnectionManager::GetZkClient()
+// 建立会话时等待握手的最长时间
+static int ConnectTimeoutMs()
+{
+    static const int timeoutMs = RPCApplication::GetInstance().GetConfig().LoadNumber("zookeeperConnectTimeoutMs", 10000, 1);
+    return timeoutMs;
+}
+
+std::shared_ptr<ZkClient> ZkConnectionManager::GetZkClient()
+{
+    std::shared_ptr<ZkClient> pCurrent = std::atomic_load(&m_pZkClient);
+    if (pCurrent != nullptr && m_isConnected.load() && !pCurrent->Expired())
+    {
+        return pCurrent;
+    }
+
+    // 其他线程正在建立会话时等它完成，最多等一个连接超时
+    std::unique_lock<std::timed_mutex> connectLock(m_connectMtx, std::defer_lock);
+    if (!connectLock.try_lock_for(std::chrono::milliseconds(ConnectTimeoutMs())))
+    {
+        return nullptr;
+    }
+    pCurrent = std::atomic_load(&m_pZkClient);
+    if (pCurrent != nullptr && m_isConnected.load() && !pCurrent->Expired()) // 等待期间其他线程已经建立了会话
+    {
+        return pCurrent;
+    }
+
+    // 握手期间其他线程仍然可以拿到旧的客户端，旧客户端在最后一个使用者放开时关闭
+    std::shared_ptr<ZkClient> pClient = std::make_shared<ZkClient>([this](ZkClient* p, int state){ OnStateChange(p, state); });
+    if (!pClient->Start(ConnectTimeoutMs()))
+    {
+        return nullptr;
+    }
+    std::atomic_store(&m_pZkClient, pClient);
+    m_pCurrent.store(pClient.get());
+    m_isConnected.store(true);
+    connectLock.unlock();
+    if (pCurrent != nullptr) // 替换了过期的会话
+    {
+        OnAvailable();
+        RPC_LOG(info) << "zookeeper session recovered";
+    }
+
+    // 每个新会话都通知监听者：之前连接超时没有写进 zookeeper 的结点也在这里补上
+    std::vector<std::function<void(const std::shared_ptr<ZkClient>&)>> listeners;
+    {
+        std::lock_guard<std::mutex> lock(m_listenerMtx);
+        listeners = m_listeners;
+    }
+    for (const auto& listener : listeners)
+    {
+        listener(pClient);
+    }
+    return pClient;
+}
+
+std::shared_ptr<ZkClient> ZkConnectionManager::TryGetZkClient()
+{
+    if (Available())
+    {
+        return std::atomic_load(&m_pZkClient);
+    }
+    if (m_pCurrent.load() == nullptr || !m_isConnected.load()) // 没有会话或者会话已经过期；断线重连由 zookeeper 客户端库自己处理
+    {
+        ConnectInBackground();
+    }
+    return nullptr;
+}
+
+bool ZkConnectionManager::Available() const
+{
+    std::shared_ptr<ZkClient> pCurrent = std::atomic_load(&m_pZkClient);
+    return pCurrent != nullptr && m_isConnected.load() && !pCurrent->Expired() && m_unavailableSince.load() == 0;
+}
+
+void ZkConnectionManager::ConnectInBackground()
 {
-    if (!m_PZkClient || !m_isConnected.load())
+    if (!m_recovering.exchange(true))
     {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        if (!m_PZkClient || !m_isConnected.load())
+        std::thread([this]()
         {
-            m_PZkClient.reset(new ZkClient());
-            m_PZkClient->Start();
-            m_isConnected.store(true);
-        }
-    } 
-    return m_PZkClient.get();
+            GetZkClient();
+            m_recovering.store(false);
+        }).detach();
+    }
+}
+
+void ZkConnectionManager::AddRecoveryListener(std::function<void(const std::shared_ptr<ZkClient>&)> listener)
+{
+    std::lock_guard<std::mutex> lock(m_listenerMtx);
+    m_listeners.push_back(std::move(listener));
+}
+
+void ZkConnectionManager::OnStateChange(ZkClient* pClient, int state)
+{
+    if (pClient != m_pCurrent.load()) // 正在建立的新会话或者已经替换掉的旧会话
+    {
+        return;
+    }
+
+    if (state == ZOO_CONNECTED_STATE) // 同一会话断线后重连成功，临时结点和 watcher 都还在
+    {
+        OnAvailable();
+        return;
+    }
+
+    int64_t expected = 0;
+    m_unavailableSince.compare_exchange_strong(expected, SteadyNs());
+    if (state != ZOO_EXPIRED_SESSION_STATE)
+    {
+        return;
+    }
+
+    // 会话过期，不能在 I/O 线程里关闭句柄，由后台线程建立新会话并通知监听者
+    m_expirations.fetch_add(1, std::memory_order_relaxed);
+    m_isConnected.store(false);
+    ConnectInBackground();
+}
+
+void ZkConnectionManager::OnAvailable()
+{
+    int64_t since = m_unavailableSince.exchange(0);
+    if (since != 0)
+    {
+        uint64_t unavailableNs = SteadyNs() - since;
+        m_unavailableNs.fetch_add(unavailableNs, std::memory_order_relaxed);
+        m_reconnects.fetch_add(1, std::memory_order_relaxed);
+        RPC_LOG(info) << "zookeeper available again after " << unavailableNs / 1000000 << " ms";
+    }
+}
+
+void ZkConnectionManager::Fill(MyRPC::RegistryStats* stats) const
+{
+    stats->set_session_expirations(m_expirations.load(std::memory_order_relaxed));
+    stats->set_reconnects(m_reconnects.load(std::memory_order_relaxed));
+    uint64_t unavailableNs = m_unavailableNs.load(std::memory_order_relaxed);
+    int64_t since = m_unavailableSince.load();
+    if (since != 0) // 正在不可用，算上到现在为止的时间
+    {
+        unavailableNs += SteadyNs() - since;
+    }
+    stats->set_unavailable_ms(unavailableNs / 1000000);
+    stats->set_connected(since == 0 && m_pCurrent.load() != nullptr);
 }
 
 ZkConnectionManager::ZkConnectionManager()
-: m_PZkClient(nullptr),
-  m_isConnected(false)
+: m_isConnected(false)
 {
 }
 
@@ -0,0 +1,467 @@
+#include "ZkRegistry.h"
+#include "ZkConnectionManager.h"
+#include "Registry.pb.h"
+#include "RPCApplication.h"
+#include "RPCLog.h"
+#include "RPCConnectionsPool.h"
+
+#include <set>
+#include <algorithm>
+#include <random>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#include <chrono>
+
+// 提供者的负载均衡权重，写进服务清单
+static uint32_t LoadProviderWeight()
+{
+    return RPCApplication::GetInstance().GetConfig().LoadNumber<unsigned>("providerWeight", 100, 1);
+}
+
+ZkRegistry::ZkRegistry()
+{
+    ZkConnectionManager::getInstance()->AddRecoveryListener([this](const std::shared_ptr<ZkClient>& zk){ OnSessionRecovered(zk); });
+
+    const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+    std::string path = config.Load("registrySnapshot");
+    if (path.empty())
+    {
+        return;
+    }
+    LoadSnapshot(path);
+
+    int interval = config.LoadNumber("registrySnapshotInterval", 30, 1);
+
+    // 注册中心和进程一样长寿，写快照的线程不需要退出
+    std::thread([this, path, interval]()
+    {
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(interval));
+            SaveSnapshot(path);
+        }
+    }).detach();
+}
+
+// 本进程所在的可用区和机架，以及跨可用区的阈值
+struct Locality
+{
+    std::string m_zone;
+    std::string m_rack;
+    double m_spillRatio = 0.5;
+};
+
+static const Locality& GetLocality()
+{
+    static const Locality locality = []()
+    {
+        const RPCConfig& config = RPCApplication::GetInstance().GetConfig();
+        Locality l;
+        l.m_zone = config.Load("zone");
+        l.m_rack = config.Load("rack");
+        l.m_spillRatio = config.LoadNumber("zoneSpillRatio", l.m_spillRatio, 0.0, 1.0);
+        return l;
+    }();
+    return locality;
+}
+
+int ZkRegistry::Register(const ServiceMethods& services, const std::string& endpoint)
+{
+    std::shared_ptr<ZkClient> zk = ZkConnectionManager::getInstance()->GetZkClient(); // 第一次使用时连接 zkServer
+
+    MyRPC::ServiceManifest manifest;
+    manifest.set_endpoint(endpoint);
+    manifest.set_weight(LoadProviderWeight());
+    manifest.set_zone(GetLocality().m_zone);
+    manifest.set_rack(GetLocality().m_rack);
+    manifest.set_features(MyRPC::FEATURE_CHUNK | MyRPC::FEATURE_STREAM | MyRPC::FEATURE_HEARTBEAT | MyRPC::FEATURE_TRACE
+                          | MyRPC::FEATURE_BINARY_HEADER);
+
+    // zookeeper 按发送顺序处理同一会话的请求，所以父结点排在前面，子结点的创建请求可以不等父结点的结果就发出
+    std::vector<ZkClient::Node> parents;
+    std::vector<ZkClient::Node> instances;
+    for (const auto& service : services)
+    {
+        std::string servicePath("/" + service.first); // 服务结点所在路径: /serviceName
+        parents.push_back({servicePath, "", 0}); // 服务结点需要作为父节点，所以创建为永久性结点
+
+        manifest.clear_methods();
+        for (const auto& method : service.second)
+        {
+            manifest.add_methods(method);
+        }
+        std::string data;
+        manifest.SerializeToString(&data);
+        instances.push_back({servicePath + "/" + endpoint, std::move(data), ZOO_EPHEMERAL}); // 实例结点创建为临时性结点，数据为服务清单
+    }
+    parents.insert(parents.end(), instances.begin(), instances.end());
+    {
+        std::lock_guard<std::mutex> lock(m_publishMtx);
+        for (const auto& instance : instances)
+        {
+            m_published.emplace_back(instance.m_path, instance.m_data);
+        }
+    }
+
+    // 连接不上时结点留在本地列表里，会话建立后由 OnSessionRecovered 重新创建
+    int failed = zk != nullptr ? zk->CreateAll(parents) : static_cast<int>(parents.size());
+    RPC_LOG(info) << "registered " << services.size() << " services to zookeeper, failed=" << failed;
+    return failed;
+}
+
+int ZkRegistry::Deregister(const ServiceMethods& services, const std::string& endpoint)
+{
+    std::shared_ptr<ZkClient> zk = ZkConnectionManager::getInstance()->GetZkClient();
+
+    // 先从本地列表里去掉，会话恢复和发布负载时不会再写这些结点
+    std::vector<std::string> paths;
+    {
+        std::lock_guard<std::mutex> lock(m_publishMtx);
+        for (const auto& service : services)
+        {
+            std::string path("/" + service.first + "/" + endpoint);
+            auto it = std::find_if(m_published.begin(), m_published.end(),
+                                   [&](const std::pair<std::string, std::string>& published){ return published.first == path; });
+            if (it != m_published.end())
+            {
+                m_published.erase(it);
+            }
+            paths.push_back(path);
+        }
+    }
+
+    int failed = 0;
+    for (const auto& path : paths)
+    {
+        failed += zk != nullptr && zk->Delete(path.data()) ? 0 : 1;
+    }
+    RPC_LOG(info) << "deregistered " << paths.size() << " services from zookeeper, failed=" << failed;
+    return failed;
+}
+
+void ZkRegistry::ReportLoad(const LoadReport& load)
+{
+    std::shared_ptr<ZkClient> zk = ZkConnectionManager::getInstance()->GetZkClient();
+    if (zk == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_publishMtx);
+    for (auto& published : m_published)
+    {
+        MyRPC::ServiceManifest manifest;
+        manifest.ParseFromString(published.second);
+        MyRPC::LoadReport* pLoad = manifest.mutable_load();
+        pLoad->set_in_flight_calls(load.m_inFlightCalls);
+        pLoad->set_queued_bytes(load.m_queuedBytes);
+        pLoad->set_cpu_permille(load.m_cpuPermille);
+        manifest.SerializeToString(&published.second);
+        zk->Set(published.first.data(), published.second);
+    }
+}
+
+void ZkRegistry::OnSessionRecovered(const std::shared_ptr<ZkClient>& zk)
+{
+    Invalidate(""); // 旧会话上的 watcher 已经失效
+
+    // 旧会话的临时结点已经被删除，按最新的清单（包括最近一次发布的负载）重新创建
+    std::vector<ZkClient::Node> parents;
+    std::vector<ZkClient::Node> instances;
+    {
+        std::lock_guard<std::mutex> lock(m_publishMtx);
+        for (const auto& published : m_published)
+        {
+            parents.push_back({published.first.substr(0, published.first.rfind('/')), "", 0});
+            instances.push_back({published.first, published.second, ZOO_EPHEMERAL});
+        }
+    }
+    if (instances.empty()) // 只查找服务的客户端
+    {
+        return;
+    }
+    parents.insert(parents.end(), instances.begin(), instances.end());
+
+    int failed = zk->CreateAll(parents);
+    RPC_LOG(info) << "re-registered " << instances.size() << " services on new session, failed=" << failed;
+}
+
+bool ZkRegistry::ParseInstance(const std::string& data, Instance* instance)
+{
+    MyRPC::ServiceManifest manifest;
+    std::string ip;
+    uint16_t port = 0;
+    if (data.empty() || !manifest.ParseFromString(data) || !ParseEndpoint(manifest.endpoint(), &ip, &port))
+    {
+        return false;
+    }
+
+    instance->m_endpoint = manifest.endpoint();
+    instance->m_methods.insert(manifest.methods().begin(), manifest.methods().end());
+    LoadReport load;
+    load.m_inFlightCalls = manifest.load().in_flight_calls();
+    load.m_queuedBytes = manifest.load().queued_bytes();
+    load.m_cpuPermille = manifest.load().cpu_permille();
+    instance->m_capacity = manifest.weight() != 0 ? manifest.weight() : 100;
+    instance->m_weight = EffectiveWeight(instance->m_capacity, load);
+    instance->m_zone = manifest.zone();
+    instance->m_rack = manifest.rack();
+    instance->m_manifest = data;
+    return true;
+}
+
+void ZkRegistry::Refresh(const std::string& serviceName)
+{
+    uint64_t generation = 0;
+    bool hasOld = false; // 有快照或者上一次读取的数据可以用
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mtx);
+        auto it = m_services.find(serviceName);
+        if (it != m_services.end())
+        {
+            if (it->second.m_valid)
+            {
+                return;
+            }
+            generation = it->second.m_generation;
+            hasOld = !it->second.m_instances.empty();
+        }
+    }
+
+    // 有旧数据时不等待建立会话，也不在断线期间发请求，直接继续用旧数据
+    ZkConnectionManager* pManager = ZkConnectionManager::getInstance();
+    std::shared_ptr<ZkClient> zk = hasOld ? pManager->TryGetZkClient() : pManager->GetZkClient();
+    std::vector<Instance> instances;
+    int result = ZOK;
+    if (zk != nullptr)
+    {
+        std::string servicePath("/" + serviceName);
+        for (const auto& child : zk->GetChildren(servicePath.data(), &ZkRegistry::OnWatch, this, &result)) // 实例上线或者下线时让缓存失效
+        {
+            std::string instancePath(servicePath + "/" + child);
+            Instance instance;
+            if (!ParseInstance(zk->GetData(instancePath.data(), &ZkRegistry::OnWatch, this), &instance)) // 清单更新时让缓存失效
+            {
+                RPC_LOG(warn) << "invalid service manifest, path=" << instancePath;
+                continue;
+            }
+            instances.push_back(std::move(instance));
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+    ServiceEntry& entry = m_services[serviceName];
+    if (zk == nullptr || (result != ZOK && result != ZNONODE)) // zookeeper 不可用，保留旧数据
+    {
+        if (!entry.m_stale && !entry.m_instances.empty())
+        {
+            RPC_LOG(warn) << "registry unavailable, use stale endpoints of " << serviceName;
+        }
+        entry.m_stale = !entry.m_instances.empty();
+        return;
+    }
+    entry.m_instances.swap(instances);
+    entry.m_stale = false;
+    entry.m_valid = (entry.m_generation == generation) && !entry.m_instances.empty(); // 服务还没有实例时下一次查找再读
+    m_dirty = true;
+}
+
+int ZkRegistry::LoadSnapshot(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    MyRPC::RegistrySnapshot snapshot;
+    if (!in || !snapshot.ParseFromIstream(&in))
+    {
+        return -1;
+    }
+
+    int loaded = 0;
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+    for (const auto& service : snapshot.services())
+    {
+        ServiceEntry& entry = m_services[service.name()];
+        for (const auto& data : service.manifests())
+        {
+            Instance instance;
+            if (ParseInstance(data, &instance))
+            {
+                entry.m_instances.push_back(std::move(instance));
+            }
+        }
+        entry.m_stale = !entry.m_instances.empty();
+        loaded += entry.m_stale ? 1 : 0;
+    }
+
+    int64_t ageMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+                  - static_cast<int64_t>(snapshot.saved_at_ms());
+    RPC_LOG(info) << "registry snapshot loaded " << loaded << " services from " << path << ", age " << ageMs / 1000 << " s";
+    return loaded;
+}
+
+void ZkRegistry::SaveSnapshot(const std::string& path)
+{
+    MyRPC::RegistrySnapshot snapshot;
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mtx);
+        if (!m_dirty)
+        {
+            return;
+        }
+        m_dirty = false;
+        for (const auto& service : m_services)
+        {
+            if (service.second.m_instances.empty())
+            {
+                continue;
+            }
+            MyRPC::ServiceSnapshot* pService = snapshot.add_services();
+            pService->set_name(service.first);
+            for (const auto& instance : service.second.m_instances)
+            {
+                pService->add_manifests(instance.m_manifest);
+            }
+        }
+    }
+    snapshot.set_saved_at_ms(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+    std::string tmpPath(path + ".tmp");
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out || !snapshot.SerializeToOstream(&out) || !out.flush())
+        {
+            RPC_LOG(error) << "write registry snapshot " << tmpPath << " failed";
+            return;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        RPC_LOG(error) << "rename registry snapshot to " << path << " failed";
+    }
+}
+
+std::string ZkRegistry::Lookup(const std::string& serviceName, const std::string& methodName)
+{
+    Refresh(serviceName);
+
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    auto it = m_services.find(serviceName);
+    if (it == m_services.end())
+    {
+        return "";
+    }
+
+    // 熔断器打开的实例不参与选择，它们的容量仍然计入本可用区，所以本可用区坏掉太多实例时会跨可用区。
+    // 所有实例都不可用时忽略熔断状态，由熔断器快速失败
+    RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+    std::vector<char> available(it->second.m_instances.size(), 0);
+    bool anyAvailable = false;
+    for (size_t i = 0; i < available.size(); ++i)
+    {
+        const Instance& instance = it->second.m_instances[i];
+        available[i] = instance.m_methods.count(methodName) != 0 && pPool->IsAvailable(instance.m_endpoint);
+        anyAvailable = anyAvailable || available[i];
+    }
+
+    // 同可用区的实例还有足够的余量时只在本可用区里选择
+    const Locality& locality = GetLocality();
+    double localWeight = 0;
+    double localCapacity = 0;
+    const Instance* pLast = nullptr;
+    for (size_t i = 0; i < available.size(); ++i)
+    {
+        const Instance& instance = it->second.m_instances[i];
+        if (instance.m_methods.count(methodName) == 0)
+        {
+            continue;
+        }
+        pLast = &instance;
+        if (!locality.m_zone.empty() && instance.m_zone == locality.m_zone)
+        {
+            localWeight += (available[i] || !anyAvailable) ? instance.m_weight : 0;
+            localCapacity += instance.m_capacity;
+        }
+    }
+    if (pLast == nullptr)
+    {
+        return "";
+    }
+    bool localOnly = localCapacity > 0 && localWeight >= locality.m_spillRatio * localCapacity;
+
+    // 在候选实例里按权重随机选择，繁忙的实例分到的流量按比例减少，同机架的实例权重加倍
+    auto weightOf = [&](size_t i)
+    {
+        const Instance& instance = it->second.m_instances[i];
+        if (instance.m_methods.count(methodName) == 0 || (anyAvailable && !available[i]) || (localOnly && instance.m_zone != locality.m_zone))
+        {
+            return 0.0;
+        }
+        bool sameRack = !locality.m_rack.empty() && instance.m_rack == locality.m_rack && instance.m_zone == locality.m_zone;
+        return sameRack ? instance.m_weight * 2 : instance.m_weight;
+    };
+
+    double totalWeight = 0;
+    for (size_t i = 0; i < available.size(); ++i)
+    {
+        totalWeight += weightOf(i);
+    }
+
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+    double point = std::uniform_real_distribution<double>(0, totalWeight)(rng);
+    for (size_t i = 0; i < available.size(); ++i)
+    {
+        const Instance& instance = it->second.m_instances[i];
+        double weight = weightOf(i);
+        if (weight > 0)
+        {
+            pLast = &instance;
+            point -= weight;
+            if (point < 0)
+            {
+                return instance.m_endpoint;
+            }
+        }
+    }
+    return pLast->m_endpoint; // 浮点误差时落在最后一个候选实例上
+}
+
+std::vector<std::string> ZkRegistry::ListEndpoints(const std::string& serviceName)
+{
+    Refresh(serviceName);
+
+    std::set<std::string> addrs;
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    auto it = m_services.find(serviceName);
+    if (it != m_services.end())
+    {
+        for (const auto& instance : it->second.m_instances)
+        {
+            addrs.insert(instance.m_endpoint);
+        }
+    }
+    return std::vector<std::string>(addrs.begin(), addrs.end());
+}
+
+void ZkRegistry::OnWatch(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
+{
+    static_cast<ZkRegistry*>(watcherCtx)->Invalidate(path != nullptr ? path : "");
+}
+
+void ZkRegistry::Invalidate(const std::string& path)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+    if (path.size() <= 1) // 会话事件，不知道哪些结点变了
+    {
+        for (auto& service : m_services)
+        {
+            service.second.m_valid = false;
+            ++service.second.m_generation;
+        }
+        return;
+    }
+
+    // 第一次读取还没有完成时服务可能不在表里，也要记下这次失效
+    size_t end = path.find('/', 1);
+    ServiceEntry& entry = m_services[path.substr(1, end == std::string::npos ? std::string::npos : end - 1)];
+    entry.m_valid = false;
+    ++entry.m_generation;
+}
@@ -1,16 +1,24 @@
 #include "ZooKeeperUtil.h"
 #include "RPCApplication.h"
-#include "Log.h"
+#include "RPCLog.h"
 
-#include <semaphore.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cerrno>
+#include <ctime>
 
-ZkClient::ZkClient()
-: m_zhandle(nullptr, deleter)
+ZkClient::ZkClient(StateCallback onState)
+: m_onState(std::move(onState)),
+  m_zhandle(nullptr, deleter)
 {
+    sem_init(&m_isReady, 0, 0);
 }
 
 ZkClient::~ZkClient()
 {
+    m_zhandle.reset(); // 先关闭句柄，保证 I/O 线程不会再访问信号量
+    sem_destroy(&m_isReady);
 }
 /**
  * @brief 全局回调函数 运行在与 zkServer 通信的IO线程内
@@ -30,46 +38,82 @@ ZkClient::~ZkClient()
  *              ZOO_CONNECTED_STATE 已连接（正常）
  *              
  * @param path 触发事件的节点路径。
- * @param watcherCtx 在 zookeeper_init 时传进去的 watcherCtx 参数，用来把“自定义数据”带进回调。
+ * @param watcherCtx 在 zookeeper_init 时传进去的 watcherCtx 参数，这里是 ZkClient 对象。
  */
 void watcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
 {
-    if (type == ZOO_SESSION_EVENT) // 触发回调的事件类型是 会话状态发生改变
+    if (type != ZOO_SESSION_EVENT) // 只关心会话状态的变化
     {
-        if (state == ZOO_CONNECTED_STATE) // 事件状态为已连接
+        return;
+    }
+
+    ZkClient* pClient = static_cast<ZkClient*>(watcherCtx);
+    if (state == ZOO_CONNECTED_STATE) // 事件状态为已连接，断线后重连成功也会再收到一次
+    {
+        int value = 0;
+        if (sem_getvalue(&pClient->m_isReady, &value) == 0 && value == 0)
         {
-            sem_t* pIsReady = (sem_t*)(watcherCtx);
-            sem_post(pIsReady); // 将信号量加1
+            sem_post(&pClient->m_isReady); // 将信号量加1，唤醒 Start
         }
     }
+    else if (state == ZOO_EXPIRED_SESSION_STATE) // 会话过期，句柄失效，需要建立新会话
+    {
+        RPC_LOG(error) << "zookeeper session expired";
+        pClient->m_expired.store(true, std::memory_order_release);
+    }
+    else if (state == ZOO_CONNECTING_STATE) // 连接断开，zookeeper 客户端库正在重连，会话可能还有效
+    {
+        RPC_LOG(warn) << "zookeeper connection lost, reconnecting";
+    }
+
+    if (pClient->m_onState)
+    {
+        pClient->m_onState(pClient, state);
+    }
 }
 
 
-void ZkClient::Start()
+bool ZkClient::Start(int timeoutMs)
 {
     std::string zkAddr = std::move(RPCApplication::GetInstance().GetConfig().Load("zookeeperAddr"));
     std::string zkPort = RPCApplication::GetInstance().GetConfig().Load("zookeeperPort");
     std::string host = zkAddr + ":" + zkPort;
 
-    sem_t isReady;
-    sem_init(&isReady, 0, 0); 
-
     /*
     zookeeper_init() 会创建一个网络I/O线程，watcher回调函数也在该线程里执行。该线程的创建是一个异步的过程。
     zookeeper_init() 返回一个 zkClient 的句柄，通过该句柄就可以和 zkServer 通信。
     */
-    zhandle_t* pZhandle = zookeeper_init(host.data(), watcher, 30000, nullptr, (void*)&isReady, 0);
+    zhandle_t* pZhandle = zookeeper_init(host.data(), watcher, 30000, nullptr, this, 0);
     if (pZhandle == nullptr) // 初始化句柄失败
     {
-        LOG(Log::error) << "zookeeper_init() err";
+        RPC_LOG(error) << "zookeeper_init() err";
         exit(EXIT_FAILURE);
     }
 
-    // 等待 和 zkServer 服务器连接成功
-    sem_wait(&isReady);
-    
+    // 等待 和 zkServer 服务器连接成功，最多等待 timeoutMs
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int ret = 0;
+    while ((ret = sem_timedwait(&m_isReady, &deadline)) == -1 && errno == EINTR)
+    {
+    }
+    if (ret == -1)
+    {
+        RPC_LOG(error) << "connect to zkServer " << host << " timed out after " << timeoutMs << " ms";
+        zookeeper_close(pZhandle); // 等待 I/O 线程退出，之后不会再访问信号量
+        return false;
+    }
+
     m_zhandle.reset(pZhandle);
-    LOG(Log::info) << "Connect to zkServer Successfully";
+    RPC_LOG(info) << "Connect to zkServer Successfully";
+    return true;
 }
 
 void ZkClient::Create(const char *path, const char *data, int dataLen, int state)
@@ -92,27 +136,152 @@ void ZkClient::Create(const char *path, const char *data, int dataLen, int state
         int res = zoo_create(m_zhandle.get(), path, data, dataLen, &ZOO_OPEN_ACL_UNSAFE, state, path_buffer, bufferLen);
         if (res == ZOK)
         {
-            LOG(Log::info) << "Create New ZNode Successfully... path=" << path; 
+            RPC_LOG(info) << "Create New ZNode Successfully... path=" << path; 
         }
         else
         {
-            LOG(Log::error) << "Create New ZNode Failed... path=" << path << " flag=" << res; 
+            RPC_LOG(error) << "Create New ZNode Failed... path=" << path << " flag=" << res; 
         }
     }
 }
 
-std::string ZkClient::GetData(const char *path)
+namespace
 {
-    char buffer[256] = {0};
-    int bufferLen = sizeof(buffer);
-    int res = zoo_get(m_zhandle.get(), path, 0, buffer, &bufferLen, nullptr);
+// 一次 CreateAll 的等待状态。超时返回后迟到的回调仍然会访问它，所以由每个请求共同持有
+struct CreateBatch
+{
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+    int m_pending = 0;
+    int m_failed = 0;
+};
+
+// 一个 zoo_acreate 请求的回调参数
+struct CreateRequest
+{
+    std::shared_ptr<CreateBatch> m_pBatch;
+    std::string m_path;
+};
+
+// zoo_acreate 的完成回调，运行在 zookeeper 的完成线程里
+void CreateCompletion(int rc, const char *value, const void *data)
+{
+    std::unique_ptr<const CreateRequest> pRequest(static_cast<const CreateRequest*>(data));
+    bool failed = (rc != ZOK && rc != ZNODEEXISTS); // 已经存在的结点视为成功
+    if (failed)
+    {
+        RPC_LOG(error) << "Create New ZNode Failed... path=" << pRequest->m_path << " flag=" << rc;
+    }
+
+    CreateBatch& batch = *pRequest->m_pBatch;
+    std::lock_guard<std::mutex> lock(batch.m_mtx);
+    batch.m_failed += failed ? 1 : 0;
+    if (--batch.m_pending == 0)
+    {
+        batch.m_cond.notify_one();
+    }
+}
+}
+
+int ZkClient::CreateAll(const std::vector<Node>& nodes)
+{
+    auto pBatch = std::make_shared<CreateBatch>();
+    {
+        std::lock_guard<std::mutex> lock(pBatch->m_mtx);
+        pBatch->m_pending = static_cast<int>(nodes.size());
+    }
+
+    for (const auto& node : nodes)
+    {
+        CreateRequest* pRequest = new CreateRequest{pBatch, node.m_path};
+        const char* data = node.m_data.empty() ? nullptr : node.m_data.data();
+        int res = zoo_acreate(m_zhandle.get(), node.m_path.data(), data, static_cast<int>(node.m_data.size()), &ZOO_OPEN_ACL_UNSAFE,
+                              node.m_state, CreateCompletion, pRequest);
+        if (res != ZOK) // 请求没有发出，不会有回调
+        {
+            RPC_LOG(error) << "zoo_acreate err... path=" << node.m_path << " flag=" << res;
+            delete pRequest;
+            std::lock_guard<std::mutex> lock(pBatch->m_mtx);
+            ++pBatch->m_failed;
+            --pBatch->m_pending;
+        }
+    }
+
+    // 最多等待一个会话超时，没有返回的请求按失败计算
+    std::unique_lock<std::mutex> lock(pBatch->m_mtx);
+    if (!pBatch->m_cond.wait_for(lock, std::chrono::milliseconds(zoo_recv_timeout(m_zhandle.get())), [&]{ return pBatch->m_pending == 0; }))
+    {
+        RPC_LOG(error) << "CreateAll timeout, pending=" << pBatch->m_pending;
+        return pBatch->m_failed + pBatch->m_pending;
+    }
+    return pBatch->m_failed;
+}
+
+bool ZkClient::Delete(const char *path)
+{
+    int res = zoo_delete(m_zhandle.get(), path, -1); // -1 表示不检查版本
+    if (res != ZOK && res != ZNONODE)
+    {
+        RPC_LOG(error) << "zoo_delete err... path=" << path << " flag=" << res;
+        return false;
+    }
+    return true;
+}
+
+bool ZkClient::Set(const char *path, const std::string &data)
+{
+    int res = zoo_set(m_zhandle.get(), path, data.data(), static_cast<int>(data.size()), -1); // -1 表示不检查版本
+    if (res != ZOK)
+    {
+        RPC_LOG(error) << "zoo_set err... path=" << path << " flag=" << res;
+        return false;
+    }
+    return true;
+}
+
+std::string ZkClient::GetData(const char *path, watcher_fn watcher, void *watcherCtx)
+{
+    // 结点数据可能是二进制的服务清单，按实际长度返回。缓冲区放不下时按 stat 里的长度重新读取
+    std::string buffer(256, '\0');
+    while (true)
+    {
+        int bufferLen = static_cast<int>(buffer.size());
+        struct Stat stat;
+        int res = zoo_wget(m_zhandle.get(), path, watcher, watcherCtx, &buffer[0], &bufferLen, &stat);
+        if (res != ZOK)
+        {
+            RPC_LOG(info) << "zoo_get err... path=" << path << " flag=" << res;
+            return "";
+        }
+        if (stat.dataLength <= static_cast<int32_t>(buffer.size()))
+        {
+            buffer.resize(bufferLen > 0 ? bufferLen : 0); // 结点数据为空时 bufferLen 为 -1
+            return buffer;
+        }
+        buffer.assign(stat.dataLength, '\0');
+    }
+}
+
+std::vector<std::string> ZkClient::GetChildren(const char *path, watcher_fn watcher, void *watcherCtx, int *pResult)
+{
+    std::vector<std::string> children;
+    struct String_vector strings;
+    int res = zoo_wget_children(m_zhandle.get(), path, watcher, watcherCtx, &strings);
+    if (pResult != nullptr)
+    {
+        *pResult = res;
+    }
     if (res == ZOK)
     {
-        return std::string(buffer);
+        for (int i = 0; i < strings.count; ++i)
+        {
+            children.emplace_back(strings.data[i]);
+        }
+        deallocate_String_vector(&strings);
     }
     else
     {
-        LOG(Log::info) << "zoo_get err... path=" << path << " flag=" << res;
-        return "";
+        RPC_LOG(info) << "zoo_get_children err... path=" << path << " flag=" << res;
     }
-}
\ No newline at end of file
+    return children;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "RPCConfig.h"
+#include "RPCWarmUp.h"
 
 class RPCApplication
 {
@@ -12,6 +13,9 @@ public:
 
     // 返回 config 配置类静态成员对象
     const RPCConfig& GetConfig();
+
+    // 获取 Init 时根据配置项 warmupServices 自动发起的预热任务，未配置预热时返回无效的 future
+    static std::shared_future<RPCWarmUpResult> GetWarmUpFuture();
 private:
     RPCApplication() = default;
     RPCApplication(const RPCApplication&) = delete;
@@ -19,4 +23,5 @@ private:
     RPCApplication& operator=(const RPCApplication&) = delete;
     RPCApplication& operator=(const RPCApplication&&) = delete;
     static RPCConfig config; // 读取配置文件的实例类
+    static std::shared_future<RPCWarmUpResult> warmUpFuture; // Init 时发起的后台预热任务
 };
\ No newline at end of file
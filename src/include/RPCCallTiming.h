@@ -0,0 +1,76 @@
+#pragma once
+
+#include "RPCClock.h"
+
+#include <google/protobuf/descriptor.h>
+#include <cstdint>
+
+/**
+ * 一次调用各个阶段的耗时
+ *
+ * 阶段是首尾相接的：Mark(phase) 把上一次 Mark（或者构造）到现在的时间记到 phase 上，同一阶段可以多次 Mark 累加。
+ * 调用结束时 Finish() 把各阶段计入 RPCStats 的阶段直方图；总耗时超过配置项 slowCallThresholdMs，
+ * 或者按 slowCallSampleRate 的比例被抽中时，把各阶段的耗时输出到日志，用来定位慢调用的时间花在了哪里。
+ *
+ * 客户端阶段：encode（序列化请求）-> lookup（查找服务地址）-> connect（从连接池取连接）
+ *             -> wait（发送请求并等待响应，包含网络和服务端处理）-> decode（反序列化响应）
+ * 服务端阶段：queue（收到请求到开始分发）-> decode（反序列化参数）-> handler（执行 handler 到 done）
+ *             -> encode（序列化响应）-> send（写入发送缓冲区）
+ */
+class RPCCallTiming
+{
+public:
+    enum Phase
+    {
+        kClientEncode = 0,
+        kClientLookup,
+        kClientConnect,
+        kClientWait,
+        kClientDecode,
+        kServerQueue,
+        kServerDecode,
+        kServerHandler,
+        kServerEncode,
+        kServerSend,
+        kPhaseCount,
+    };
+
+    static constexpr int kClientPhaseBegin = kClientEncode;
+    static constexpr int kServerPhaseBegin = kServerQueue;
+
+    // startTicks 为调用开始的时刻（RPCClock::Now()）
+    explicit RPCCallTiming(uint64_t startTicks = RPCClock::Now())
+    : m_start(startTicks), m_last(startTicks)
+    {
+    }
+
+    // 上一阶段结束到 now 之间的时间记到 phase 上
+    void Mark(Phase phase, uint64_t now = RPCClock::Now())
+    {
+        m_ticks[phase] += now - m_last;
+        m_marked |= 1u << phase;
+        m_last = now;
+    }
+
+    bool Marked(Phase phase) const { return (m_marked & (1u << phase)) != 0; }
+    uint64_t PhaseNs(Phase phase) const { return RPCClock::ToNs(m_ticks[phase]); }
+
+    // 从开始到最近一次 Mark 的时间
+    uint64_t ElapsedNs() const { return RPCClock::ToNs(m_last - m_start); }
+
+    static const char* PhaseName(Phase phase);
+
+    /**
+     * @brief 调用结束，记录阶段直方图，需要时输出慢调用日志
+     *
+     * @param client true 为客户端（RPCChannel），false 为服务端（RPCProvider）
+     * @param errorCode RPCResponseError 的错误码，客户端本地错误为 RPCStats::kLocalError
+     */
+    void Finish(bool client, const google::protobuf::MethodDescriptor* method, int errorCode);
+
+private:
+    uint64_t m_start;
+    uint64_t m_last;
+    uint32_t m_marked = 0;                 // 记录过的阶段，没有走到的阶段不计入直方图
+    uint64_t m_ticks[kPhaseCount] = {0};
+};
@@ -3,19 +3,62 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <string>
+#include <memory>
+
+#include "RPCStreamReader.h"
+#include "RPCTrace.h"
+
+class RPCConnection;
+class RPCCallTiming;
 
 class RPCChannel final : public google::protobuf::RpcChannel
 {
 public:
+    // 通过注册中心（RPCRegistry）查找服务地址
+    RPCChannel() = default;
+
+    // 直连指定的 RPCProvider（"ip:port"），不经过服务发现。用于本地压测和调试
+    explicit RPCChannel(const std::string& endpoint);
+
     // 重写google::protobuf::RpcChannel::CallMethod
+    // 失败时按以下规则换一个提供者重试，最多 maxRetries 次，每次重试前随机退避，并且受进程内的重试预算限制：
+    //   1.服务端过载（RESOURCE_EXHAUSTED）或者正在停止（UNAVAILABLE），请求没有执行，所有方法都重试
+    //   2.取不到连接、熔断打开，请求没有发出，所有方法都重试
+    //   3.发送或者接收失败，请求可能已经执行，只重试 proto 里标注了 option (MyRPC.idempotent) = true 的方法
+    // 重试次数通过 RPCController::RetryCount() 获取
     void CallMethod(const google::protobuf::MethodDescriptor *method,
                     google::protobuf::RpcController *controller,
                     const google::protobuf::Message *request,
                     google::protobuf::Message *response,
                     google::protobuf::Closure *done) override;
 
+    // 发起服务端流式调用，通过返回的 RPCStreamReader 逐条读取响应。调用失败时设置 controller 并返回 nullptr
+    std::unique_ptr<RPCStreamReader> CallStream(const google::protobuf::MethodDescriptor *method,
+                                                google::protobuf::RpcController *controller,
+                                                const google::protobuf::Message *request);
 
 private:
-    // 通过网络将sendStr发送给框架的服务端
-    void SendToServer(const std::string& serviceName, const std::string& methodName, const std::string& sendStr, google::protobuf::Message *response, google::protobuf::RpcController *controller);
-};
\ No newline at end of file
+    // 将被调用的方法和参数封装成发送流：4字节前缀长度 + headerSize(4字节) + header + request，配置项 requestHeader = binary 时
+    // 使用二进制头部（见 RPCCodec.h）。参数过大时拆成多帧依次拼接
+    // trace 为本次调用的调用链上下文，requestSize 不为空时存放 request 序列化后的字节数
+    bool PackRequest(const google::protobuf::MethodDescriptor *method, const google::protobuf::Message *request, uint64_t streamId, const RPCTraceContext& trace,
+                     std::string* sendStr, google::protobuf::RpcController *controller, size_t* requestSize = nullptr);
+
+    // 为本次调用生成调用链上下文：父上下文依次取 controller 里设置的、当前线程正在处理的服务端调用的
+    static RPCTraceContext NewTraceContext(google::protobuf::RpcController *controller);
+
+    // 从注册中心查找 RPCProvider 的地址，并从连接池中获取一条到该地址的连接。timing 不为空时记录 lookup 和 connect 阶段
+    // avoidEndpoint 不为空时尽量选择其他提供者（重试时避开上一次失败的提供者），pEndpoint 不为空时存放选中的地址
+    // pProbe 存放本次调用是不是熔断器半开时的探测调用，是的话调用方必须报告结果或者归还探测名额。没有取到连接时已经归还
+    std::shared_ptr<RPCConnection> GetConnection(const std::string& serviceName, const std::string& methodName, google::protobuf::RpcController *controller,
+                                                 RPCCallTiming* timing = nullptr, const std::string& avoidEndpoint = "", std::string* pEndpoint = nullptr,
+                                                 bool* pProbe = nullptr);
+
+    // 通过网络将sendStr发送给框架的服务端。返回 RPCResponseError 错误码，本地错误返回 RPCStats::kLocalError；
+    // responseSize 存放收到的响应字节数，timing 记录从查找地址到反序列化响应的各个阶段
+    // avoidEndpoint 同 GetConnection；pEndpoint 存放选中的提供者地址，注册中心里找不到时为空；pSent 存放请求是否已经发出
+    int SendToServer(const std::string& serviceName, const std::string& methodName, const std::string& sendStr, google::protobuf::Message *response, google::protobuf::RpcController *controller,
+                     size_t* responseSize, RPCCallTiming* timing, const std::string& avoidEndpoint, std::string* pEndpoint, bool* pSent);
+
+    std::string m_directEndpoint; // 直连的 RPCProvider 地址，为空时通过注册中心查找
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <google/protobuf/message.h>
+#include <string>
+#include <vector>
+
+class RPCConnection;
+
+namespace MyRPC
+{
+    class RPCResponseWrapper;
+}
+
+/**
+ * 大消息分块传输的辅助函数
+ *
+ * 超过 GetChunkSize() 的请求参数和响应数据会被拆成多帧发送，每一帧都不超过单帧上限（64M），
+ * 接收端把各个分块按顺序放进 std::vector<std::string>，不拼接成一整块内存，
+ * 直接通过 ParseFromChunks() 从分块链上反序列化。
+ */
+class RPCChunk
+{
+public:
+    // 单个分块的最大字节数，由配置项 chunkSize 决定（单位 KB，默认 1024）
+    static size_t GetChunkSize();
+
+    // 分块重组后的消息最大字节数，由配置项 maxMessageSize 决定（单位 MB，默认 1024）
+    static size_t GetMaxMessageSize();
+
+    // 从按顺序排列的分块上反序列化 msg，不拼接分块
+    static bool ParseFromChunks(const std::vector<std::string>& chunks, google::protobuf::Message* msg);
+
+    /**
+     * @brief 解析客户端收到的一帧响应。若响应被分块发送，继续从 pConn 上读取剩余的分块
+     *
+     * @param pConn 接收响应的连接
+     * @param frame 已经收到的第一帧
+     * @param wrapper 传出参数，第一帧的 wrapper（data 字段被移动到 chunks 里）
+     * @param chunks 传出参数，按顺序存放的 data 分块
+     * @return int 1 成功，0 对端关闭连接，-1 出错
+     */
+    static int CollectResponse(RPCConnection* pConn, std::string& frame, MyRPC::RPCResponseWrapper* wrapper, std::vector<std::string>* chunks);
+};
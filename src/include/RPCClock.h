@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * 低开销的单调时钟，用来给一次调用的各个阶段打时间戳
+ *
+ * CPU 支持恒定频率的 TSC（invariant TSC）时直接读取时间戳计数器，一次读取只要几纳秒，
+ * 不需要进入 vDSO；否则退化为 steady_clock。Now() 的单位是“刻度”，只能相减之后用 ToNs() 换算成纳秒，
+ * 不能和 RPCTrace::NowNs() 之类的纳秒时间戳混用。TSC 的频率在第一次换算时根据 steady_clock 校准。
+ */
+class RPCClock
+{
+public:
+    // 当前时刻，单位为刻度
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (UseTsc())
+        {
+            return __rdtsc();
+        }
+#endif
+        return SteadyNs();
+    }
+
+    // 把两个 Now() 之间的刻度差换算成纳秒
+    static uint64_t ToNs(uint64_t ticks);
+
+    // 是否在使用 TSC
+    static bool UseTsc()
+    {
+        static const bool useTsc = DetectTsc();
+        return useTsc;
+    }
+
+private:
+    static bool DetectTsc();
+
+    static uint64_t SteadyNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "RPCTrace.h"
+
+class Buffer;
+
+namespace MyRPC
+{
+    class RpcHeader;
+}
+
+namespace google
+{
+namespace protobuf
+{
+    class Message;
+}
+}
+
+// 解析出来的请求头，两种请求帧共用。循环复用同一个对象时，服务名和方法名一般不需要重新分配内存
+struct RPCRequestHeader
+{
+    std::string m_serviceName; // 分块传输时只有第 0 块携带服务名和方法名
+    std::string m_methodName;
+    uint64_t m_streamId = 0;   // 请求 ID：非 0 表示服务端流式调用，响应帧都携带该 ID
+    uint32_t m_chunkSeq = 0;   // 大请求分块传输时的分块序号，从 0 开始
+    bool m_moreChunks = false; // 后面是否还有分块
+    bool m_heartbeat = false;  // 心跳帧（PING），不携带参数
+    RPCTraceContext m_trace;   // 调用链上下文，分块传输时只有第 0 块携带
+};
+
+/**
+ * 请求帧和响应帧的编解码，RPCChannel 和 RPCProvider 共用，micro_bench 直接测量这里的每一步。
+ * EncodeRequest / EncodeResponse 是两端实际调用的完整编码步骤（序列化、填写头部、分块、拼接帧），其余函数是其中的单个步骤
+ *
+ * 请求帧有两种格式，服务端按第一个字节区分，迁移期间两种都接收：
+ *   protobuf 头部：4字节前缀长度 + headerSize(4字节) + RpcHeader + 参数
+ *   二进制头部：固定 32 字节的头部 + 服务名 + 方法名 + 扩展 TLV + 参数。头部用几次定长读取解出，不需要反序列化和分配内存
+ *     偏移  字段         字节数
+ *     0     magic        2    0x4D52（"MR"）。protobuf 头部的第一个字节是帧长度的最高字节，不超过 0x03
+ *     2     version      1    当前为 1，更高的版本回复 PARSE_ERROR
+ *     3     flags        1    kFlagHeartbeat | kFlagMoreChunks | kFlagSampled
+ *     4     frameSize    4    整帧的字节数，包括固定头部
+ *     8     streamId     8    请求 ID
+ *     16    chunkSeq     4
+ *     20    serviceLen   2
+ *     22    methodLen    2
+ *     24    extLen       2    扩展 TLV 的总字节数
+ *     26    reserved     2    填 0
+ *     28    payloadSize  4    参数的字节数
+ *   扩展 TLV 为 type(2字节) + len(2字节) + value，不认识的 type 直接跳过，新增字段不需要升级版本号。
+ *   kExtTrace 的 value 依次为 traceId、spanId、parentSpanId，各 8 字节
+ * 响应帧：4字节前缀长度 + RPCResponseWrapper
+ * 整数都用大端序存储
+ */
+class RPCCodec
+{
+public:
+    static const uint32_t kMaxFrameSize = 64 * 1024 * 1024; // 单帧上限，超过的消息需要分块发送
+
+    // 二进制头部
+    static const uint16_t kMagic = 0x4D52;
+    static const uint8_t kVersion = 1;
+    static const size_t kFixedHeaderSize = 32;
+    static const uint8_t kFlagHeartbeat = 0x01;
+    static const uint8_t kFlagMoreChunks = 0x02;
+    static const uint8_t kFlagSampled = 0x04;
+    static const uint16_t kExtTrace = 1;
+
+    // ParseRequestFrame 的返回值
+    enum ParseResult
+    {
+        kFrameOk = 1,        // 取出了一帧完整的请求
+        kFrameIncomplete = 0, // 缓冲区里还没有一帧完整的请求
+        kFrameTooLarge = -1, // 帧长度超过上限或者小于头部，连接上的数据不可信
+        kBadHeader = -2,     // 请求头无法解析，该帧已经被丢弃
+    };
+
+    // EncodeRequest 的返回值
+    enum EncodeResult
+    {
+        kEncodeOk = 0,
+        kSerializeFailed = -1, // request 或者 RpcHeader 序列化失败
+        kMessageTooLarge = -2, // request 序列化之后超过 maxMessageSize
+        kNameTooLong = -3,     // 二进制头部：服务名或者方法名超过 65535 字节
+    };
+
+    /**
+     * @brief 序列化 request，封装成请求帧追加到 sendStr。RPCChannel 发起调用时使用
+     *
+     * @param header 服务名、方法名、流 ID 和调用链上下文，分块字段由本函数填写
+     * @param binary 使用二进制头部，否则使用 protobuf 头部
+     * @param chunkSize request 超过该大小时拆成多帧
+     * @param requestSize 不为空时存放 request 序列化后的字节数
+     */
+    static EncodeResult EncodeRequest(const RPCRequestHeader& header, const google::protobuf::Message& request, bool binary,
+                                      size_t chunkSize, size_t maxMessageSize, std::string* sendStr, size_t* requestSize = nullptr);
+
+    /**
+     * @brief 把参数封装成请求帧追加到 sendStr，参数超过 chunkSize 时拆成多帧依次追加
+     *
+     * @param header 第 0 块使用的 header，argvSize 和分块字段由本函数填写。后续分块的 header 只保留流 ID 和分块信息
+     * @return header 序列化失败时返回 false
+     */
+    static bool PackRequest(MyRPC::RpcHeader& header, const std::string& requestStr, size_t chunkSize, std::string* sendStr);
+
+    /**
+     * @brief 同 PackRequest，使用二进制头部
+     *
+     * @param header 第 0 块使用的 header，分块字段由本函数填写。后续分块只携带流 ID 和分块信息
+     * @return 服务名或者方法名超过 65535 字节时返回 false
+     */
+    static bool PackBinaryRequest(const RPCRequestHeader& header, const std::string& requestStr, size_t chunkSize, std::string* sendStr);
+
+    // 从缓冲区里取出一帧请求（两种格式都可以），header 和 argv 存放解析结果
+    static ParseResult ParseRequestFrame(Buffer* buffer, RPCRequestHeader* header, std::string* argv);
+
+    // 缓冲区里第一帧请求的总字节数，长度字段还没有收到时返回可读的字节数。用于在收完之前检查能否缓存这一帧
+    static uint64_t PendingFrameSize(const Buffer* buffer);
+
+    // 给序列化好的 RPCResponseWrapper 加上 4 字节长度前缀，追加到 frame
+    static void AppendResponseFrame(const std::string& wrapperStr, std::string* frame);
+
+    /**
+     * @brief 序列化 response，封装成调用成功的响应帧追加到 frames。RPCProvider 回复调用和发送流式响应时使用
+     *
+     * @param endOfStream 是否为流式调用的最后一帧（trailer）
+     * @param chunkSize 数据超过该大小时拆成多帧，除最后一帧外都设置 more_chunks
+     * @param dataSize 不为空时存放 response 序列化后的字节数
+     * @return 序列化失败时返回 false，frames 不变
+     */
+    static bool EncodeResponse(const google::protobuf::Message& response, uint64_t streamId, bool endOfStream, size_t chunkSize,
+                               std::string* frames, size_t* dataSize = nullptr);
+};
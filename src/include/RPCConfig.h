@@ -1,6 +1,7 @@
 #pragma once
 #include <unordered_map>
 #include <string>
+#include <limits>
 
 class RPCConfig
 {
@@ -8,11 +9,23 @@ public:
     RPCConfig() = default;
     ~RPCConfig() = default;
     
-    // 读取配置文件信息
+    // 读取配置文件信息，文件打不开时退出进程
     void LoadConfigFile(const std::string& filePath);
 
+    // 读取配置文件信息，文件打不开时返回 false。用于运行期间重新读取的配置文件
+    bool TryLoadConfigFile(const std::string& filePath);
+
     // 查询配置文件信息
     std::string Load(const std::string& key) const;
+
+    // 读取数值型配置项。未配置时返回 defaultValue；不是完整的数字、或者不在 [minValue, maxValue] 里时输出警告并返回 defaultValue
+    // 支持 int、unsigned、long、unsigned long、long long、unsigned long long 和 double
+    template <typename T>
+    T LoadNumber(const std::string& key, T defaultValue,
+                 T minValue = std::numeric_limits<T>::lowest(), T maxValue = std::numeric_limits<T>::max()) const;
+
+    // 查询所有以 prefix 开头的配置项，返回的 key 去掉了 prefix
+    std::unordered_map<std::string, std::string> LoadPrefix(const std::string& prefix) const;
 private:
     std::unordered_map<std::string, std::string> m_confmap;
 };
\ No newline at end of file
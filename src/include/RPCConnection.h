@@ -1,5 +1,7 @@
+#pragma once
 #include <string>
 #include <chrono>
+#include <algorithm>
 
 class RPCConnection
 {
@@ -14,14 +16,33 @@ public:
     int Send(const std::string& data);
     int Recv(char* buffer, size_t bufferSize);
 
+    // 发送 data 之后接收对端的响应。启用 io_uring 时只需一次系统调用，返回值和 Recv 一致
+    int SendRecv(const std::string& data, char* buffer, size_t bufferSize);
+
+    // 接收一帧完整的响应（去掉 4 字节长度前缀）。返回值：1 成功，0 对端关闭连接，-1 出错
+    int RecvFrame(std::string* frame);
+
+    // 发送 data 之后接收一帧完整的响应，返回值和 RecvFrame 一致
+    int SendRecvFrame(const std::string& data, std::string* frame);
+
+    // 非阻塞地检测连接是否还能用：对端已关闭、套接字出错或者连接上残留着未读数据时关闭连接并返回 false
+    bool Probe(bool checkSocketError = false);
+
+    // 发送协议层的心跳帧（PING），timeoutMs 毫秒内收到 PONG 返回 true，否则关闭连接并返回 false
+    bool Ping(int timeoutMs);
+
     const std::string& GetIp() const { return m_ip; }
     uint16_t GetPort() const { return m_port; }
     std::chrono::steady_clock::time_point GetLastUsedTime() const { return m_lastUsed; }
     void UpdateLastUsedTime() { m_lastUsed = std::chrono::steady_clock::now(); }
+    std::chrono::steady_clock::time_point GetLastActiveTime() const { return std::max(m_lastUsed, m_lastPing); }
 private:
     int m_fd;
     std::string m_ip;
     uint16_t m_port;
     bool m_connected;
+    bool m_useUring; // 是否使用 io_uring 传输（由配置项 clientTransport 决定）
+    std::string m_pending; // 已经从内核读出、但还没有被取走的响应数据
     std::chrono::steady_clock::time_point m_lastUsed; // 连接最近一次使用时间
+    std::chrono::steady_clock::time_point m_lastPing; // 连接最近一次心跳成功的时间
 };
\ No newline at end of file
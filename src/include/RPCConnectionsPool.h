@@ -1,22 +1,53 @@
 #pragma once
 #include "RPCConnection.h"
 #include <unordered_map>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <functional>
 #include <string>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <chrono>
 
+/**
+ * 客户端连接池，按主机（ip:port）管理连接，同时记录每台主机的健康状态：
+ *
+ * 熔断：连续失败 breakerConsecutiveFailures 次，或者 10 秒窗口内至少 20 次调用、失败率达到 breakerErrorRate 时打开熔断器。
+ *   打开期间 AllowRequest 返回 false，调用直接失败，注册中心选择实例时跳过该主机；breakerOpenMs 之后进入半开状态，
+ *   只放行一个探测调用，成功则关闭，失败则再次打开，打开时间随连续打开的次数翻倍（最多 8 倍）。
+ *   只有连接失败和收发出错算作失败，handler 返回的业务错误不算。服务端过载、正在停止或者限流的拒绝不报告，只用于重试。
+ * 离群摘除：清理线程每秒按服务比较各主机的平均延迟，比同服务主机的中位数高 outlierLatencyFactor 倍（且至少高 1ms）的主机
+ *   按熔断处理，暂时摘除。同一服务最多同时摘除一半的主机。摘除和重新加入时清空该主机的延迟统计。
+ * 主机在它的所有服务里都已经从注册中心下线时，清理线程删除它的健康状态。
+ */
 class RPCConnectionsPool
 {
 public:
     static RPCConnectionsPool* GetInstance();
     std::shared_ptr<RPCConnection> GetConnection(const std::string& ip, uint16_t port);
     void ReturnConnection(std::shared_ptr<RPCConnection> pConn);
+
+    // 预先和指定主机建立连接，使该主机的连接数至少达到 count（不超过单主机上限）。返回该主机当前的连接数
+    int Prewarm(const std::string& ip, uint16_t port, int count);
     void SetMaxIdleTime(int seconds) { m_maxIdleTime = seconds; }
     void SetMaxConnectionsPerHost(int count) { m_maxConnectionsPerHost = count; }
+    void SetHeartbeatInterval(int seconds) { m_heartbeatInterval = seconds; }
+    void SetHeartbeatTimeout(int milliseconds) { m_heartbeatTimeout = milliseconds; }
+
+    // 熔断器是否允许向该主机发送请求。半开状态只放行一个探测调用，pProbe 不为空时存放本次放行的是不是探测调用
+    bool AllowRequest(const std::string& ip, uint16_t port, bool* pProbe = nullptr);
+
+    // 探测调用没有结果可以报告（没有取到连接、服务端拒绝了请求）时归还探测名额，下一个调用马上可以探测
+    void ReleaseProbe(const std::string& ip, uint16_t port);
+
+    // 调用结束后报告结果。success 为 false 表示主机级的失败，latencyNs 用于离群检测，serviceName 为空时不参与离群检测
+    void ReportResult(const std::string& ip, uint16_t port, const std::string& serviceName, bool success, uint64_t latencyNs);
+
+    // 主机（"ip:port"）当前是否可以选择：熔断器没有打开，或者已经可以半开探测
+    bool IsAvailable(const std::string& endpoint);
 
 private:
     RPCConnectionsPool();
@@ -28,7 +59,8 @@ private:
     RPCConnectionsPool& operator=(const RPCConnectionsPool&&) = delete;
 
     void CleanIdleConnections(); // 清空所有连接
-    void CleanTimeOutConnections(); // 清空超时连接
+    void CleanTimeOutConnections(); // 清空超时连接和已经失效的连接
+    void SendHeartbeats(); // 给空闲时间超过心跳间隔的连接发送心跳，清除没有回应的连接
     void RunCleaner(); // 清理线程运行的函数
 
     struct ConnectionKey
@@ -50,14 +82,64 @@ private:
         }
     };
 
-    std::unordered_map<ConnectionKey, std::queue<std::shared_ptr<RPCConnection>>, KeyHash> m_idleConnection; //记录空闲连接的哈希表
+    // 空闲连接。清理线程探测或者发送心跳时把连接标记为租出，连接留在队列里，GetConnection 跳过它
+    struct IdleConnection
+    {
+        std::shared_ptr<RPCConnection> m_pConn;
+        bool m_leased = false;
+    };
+    using IdleQueue = std::deque<IdleConnection>;
+    using ConnectionList = std::vector<std::pair<ConnectionKey, std::shared_ptr<RPCConnection>>>;
+
+    std::unordered_map<ConnectionKey, IdleQueue, KeyHash> m_idleConnection; //记录空闲连接的哈希表
     std::unordered_map<ConnectionKey, int, KeyHash> m_connectionCount; // 记录每台主机上连接的个数
 
+    void RemoveConnection(const ConnectionKey& key); // 连接计数-1，计数减为0时删除该主机，调用前需要持有 m_mtx
+
+    // 逐个检查 candidates 里仍然空闲的连接：检查期间连接标记为租出，不持有锁；check 返回 false 的连接被删除。
+    // 同一时间只租出一个连接，其余的空闲连接照常可以被 GetConnection 取走
+    void CheckIdleConnections(ConnectionList& candidates, const std::function<bool(RPCConnection&)>& check);
+
+    // 一台主机的健康状态
+    struct HostHealth
+    {
+        enum State { kClosed, kOpen, kHalfOpen };
+        State m_state = kClosed;
+        int m_consecutiveFailures = 0;
+        int m_trips = 0;                                         // 连续打开的次数，关闭后清零
+        uint32_t m_windowCalls = 0;                              // 当前统计窗口内的调用数和失败数
+        uint32_t m_windowFailures = 0;
+        std::chrono::steady_clock::time_point m_windowStart;
+        std::chrono::steady_clock::time_point m_openUntil;       // 打开状态持续到这个时间
+        std::chrono::steady_clock::time_point m_probeStart;      // 半开状态下探测调用开始的时间
+        bool m_probing = false;
+        std::unordered_map<std::string, std::pair<double, uint32_t>> m_latency; // 服务名 -> (延迟的指数移动平均 ns, 本轮样本数)
+    };
+
+    // 打开熔断器，调用前需要持有 m_healthMtx
+    void Trip(const ConnectionKey& key, HostHealth& health, const char* reason);
+
+    // 按服务比较各主机的延迟，摘除离群的主机
+    void DetectOutliers();
+
+    // 清空主机的延迟统计，摘除和熔断器关闭时调用，调用前需要持有 m_healthMtx
+    static void ResetLatency(HostHealth& health);
+
+    // 删除主机在已经下线的服务上的延迟统计，所有服务都下线时删除整个健康状态
+    void PruneHosts();
+
+    std::unordered_map<ConnectionKey, HostHealth, KeyHash> m_health; // 每台主机的健康状态
+    std::mutex m_healthMtx;
+    std::atomic<int> m_openHosts{0}; // 熔断器没有关闭的主机数，为 0 时 IsAvailable 不加锁
+
 
     int m_maxIdleTime; // 连接的最大空闲时间
     int m_maxConnectionsPerHost; // 每个主机最大连接个数
+    std::atomic<int> m_heartbeatInterval; // 空闲连接的心跳间隔（秒），0 表示不发送心跳
+    std::atomic<int> m_heartbeatTimeout; // 等待心跳回复的超时时间（毫秒）
     std::mutex m_mtx;
     std::atomic<bool> m_stopCleaner;
     std::thread m_cleanerThread; // 清理超时连接的线程
     std::condition_variable m_cond;
+    std::condition_variable m_leaseCond; // 租出的空闲连接检查完毕时通知等待连接的 GetConnection
 };
\ No newline at end of file
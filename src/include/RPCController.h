@@ -1,7 +1,11 @@
 #pragma once
 
 #include "google/protobuf/service.h"
+#include "google/protobuf/message.h"
 #include <string>
+#include <functional>
+
+#include "RPCTrace.h"
 
 class RPCController final : public google::protobuf::RpcController
 {
@@ -18,7 +22,32 @@ public:
     void SetFailed(const std::string& reason) override;
     bool IsCanceled() const override;
     void NotifyOnCancel(google::protobuf::Closure* callback) override;
+
+    ////////////////////服务端流式调用//////////////////////////
+    // 当前调用是否为客户端发起的流式调用
+    bool IsStreaming() const;
+
+    // 向客户端发送一帧流式响应。流式调用的 handler 在工作线程里执行，连接上还没有发出的响应超过一个分块时 Write 阻塞，
+    // 等数据写进内核再发送。非流式调用、连接已经关闭，或者客户端 streamWriteTimeoutMs 内都没有读走数据时不发送并返回 false，
+    // handler 应该停止写。等待超时的调用以 RESOURCE_EXHAUSTED 结束
+    bool Write(const google::protobuf::Message& msg);
+
+    // 由 RPCProvider 在分发流式调用前设置
+    void SetStreamWriter(std::function<bool(const google::protobuf::Message&)> writer);
+
+    ////////////////////调用链追踪//////////////////////////
+    // 服务端：本次调用的上下文，由 RPCProvider 设置。客户端：用户设置后作为发起调用的父上下文
+    const RPCTraceContext& GetTraceContext() const;
+    void SetTraceContext(const RPCTraceContext& ctx);
+
+    ////////////////////客户端重试//////////////////////////
+    // 客户端：上一次调用重试的次数，0 表示第一次就成功或者没有重试。由 RPCChannel 设置
+    int RetryCount() const;
+    void SetRetryCount(int count);
 private:
     bool m_failed; // 是否发生错误的标志
     std::string m_errMsg; // 发生错误后的错误信息
+    std::function<bool(const google::protobuf::Message&)> m_streamWriter; // 发送流式响应帧的函数，非流式调用为空
+    RPCTraceContext m_trace; // 调用链上下文
+    int m_retries; // 客户端重试的次数
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * 对数分桶的延迟直方图（单位纳秒）
+ *
+ * 小于 64 的值每个值一个桶；之后每个 2 的幂区间 [2^e, 2^(e+1)) 再均分成 64 个子桶，
+ * 相对误差不超过 1/64。记录只是一次数组自增，不做同步，由使用者保证每个直方图只被一个线程写入
+ * （例如每个线程各持有一个分片），读取时再合并。
+ */
+class RPCHistogram
+{
+public:
+    RPCHistogram()
+    : m_counts(kBucketCount, 0), m_total(0), m_sum(0), m_max(0)
+    {
+    }
+
+    // 记录一个样本
+    void Record(uint64_t value)
+    {
+        ++m_counts[Index(value)];
+        ++m_total;
+        m_sum += value;
+        m_max = std::max(m_max, value);
+    }
+
+    // 清空所有样本
+    void Reset()
+    {
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        m_total = 0;
+        m_sum = 0;
+        m_max = 0;
+    }
+
+    // 合并另一个直方图的样本
+    void Merge(const RPCHistogram& other)
+    {
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    // 返回 p 分位（0 < p <= 1）的近似值，取所在桶的下界
+    uint64_t Percentile(double p) const
+    {
+        if (m_total == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(p * m_total);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= rank)
+            {
+                return std::min(LowerBound(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t Count() const { return m_total; }
+    uint64_t Max() const { return m_max; }
+    double Mean() const { return m_total == 0 ? 0.0 : static_cast<double>(m_sum) / m_total; }
+
+private:
+    static const int kSubBucketBits = 6;
+    static const uint64_t kSubBuckets = 1ULL << kSubBucketBits; // 每个 2 的幂区间的子桶个数
+    static const size_t kBucketCount = kSubBuckets + (64 - kSubBucketBits) * kSubBuckets;
+
+    // 计算 value 所在的桶下标
+    static size_t Index(uint64_t value)
+    {
+        if (value < kSubBuckets)
+        {
+            return value;
+        }
+        int exponent = 63 - __builtin_clzll(value); // value 的最高位
+        int shift = exponent - kSubBucketBits;
+        uint64_t sub = (value >> shift) - kSubBuckets; // 最高位之后的 6 位
+        return kSubBuckets + shift * kSubBuckets + sub;
+    }
+
+    // 返回下标为 index 的桶的下界
+    static uint64_t LowerBound(size_t index)
+    {
+        if (index < kSubBuckets)
+        {
+            return index;
+        }
+        uint64_t shift = (index - kSubBuckets) / kSubBuckets;
+        uint64_t sub = (index - kSubBuckets) % kSubBuckets;
+        return (kSubBuckets + sub) << shift;
+    }
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_sum;
+    uint64_t m_max;
+};
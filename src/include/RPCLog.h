@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// 编译期的最低日志级别（0 debug，1 info，2 warn，3 error），更低级别的 RPC_LOG 整条语句被编译器删除
+#ifndef MYRPC_LOG_MIN_LEVEL
+#define MYRPC_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * RPC 框架的日志前端
+ *
+ * 和 Log 相比：
+ *   1.级别被过滤的日志不构造任何对象，也不格式化参数（编译期和运行期两级过滤）
+ *   2.格式化写入线程局部的缓冲区，不使用 ostringstream，也不加锁
+ *   3.每个调用点每秒最多输出 rateLimit 条，多出的只计数，下一条输出时附带被抑制的条数
+ *   4.格式化好的日志放进无锁队列，由后台线程交给 AsyncLogging（未启动时写到 Log 的输出流）
+ *
+ * 用法和 LOG 相同：RPC_LOG(error) << "recv() err, fd=" << fd;
+ */
+class RPCLog
+{
+public:
+    enum Level
+    {
+        debug,
+        info,
+        warn,
+        error
+    };
+
+    // 运行期的最低日志级别，默认 info
+    static void SetLevel(Level level) { s_level.store(level, std::memory_order_relaxed); }
+    static bool Enabled(Level level) { return level >= s_level.load(std::memory_order_relaxed); }
+
+    // 每个调用点每秒最多输出的条数，0 表示不限制，默认 100
+    static void SetRateLimit(uint32_t perSecond) { s_rateLimit.store(perSecond, std::memory_order_relaxed); }
+    static uint32_t RateLimit() { return s_rateLimit.load(std::memory_order_relaxed); }
+
+    // 从配置项 logLevel、logRateLimit 读取设置，由 RPCApplication::Init 调用
+    static void LoadConfig();
+
+    // 等待队列里已有的日志全部交给后端
+    static void Flush();
+
+private:
+    static std::atomic<int> s_level;
+    static std::atomic<uint32_t> s_rateLimit;
+};
+
+// 一个 RPC_LOG 调用点的限流状态
+class RPCLogSite
+{
+public:
+    // 当前这一秒是否还允许输出
+    bool Admit();
+
+    // 取出并清零被抑制的条数
+    uint64_t TakeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_window{0};     // 当前计数的秒
+    std::atomic<uint32_t> m_count{0};      // 当前这一秒已经输出的条数
+    std::atomic<uint64_t> m_suppressed{0}; // 被抑制的条数
+};
+
+// 一条日志，析构时把格式化好的内容放进队列
+class RPCLogRecord
+{
+public:
+    RPCLogRecord(RPCLog::Level level, const char* file, int line, const char* func, RPCLogSite* site);
+    ~RPCLogRecord();
+
+    RPCLogRecord(const RPCLogRecord&) = delete;
+    RPCLogRecord& operator=(const RPCLogRecord&) = delete;
+
+    RPCLogRecord& operator<<(std::string_view str) { m_buf->append(str.data(), str.size()); return *this; }
+    RPCLogRecord& operator<<(const char* str) { return *this << std::string_view(str == nullptr ? "(null)" : str); }
+    RPCLogRecord& operator<<(const std::string& str) { m_buf->append(str); return *this; }
+    RPCLogRecord& operator<<(char c) { m_buf->push_back(c); return *this; }
+    RPCLogRecord& operator<<(bool b) { return *this << (b ? "true" : "false"); }
+    RPCLogRecord& operator<<(int v) { return AppendInteger(static_cast<long long>(v)); }
+    RPCLogRecord& operator<<(unsigned int v) { return AppendInteger(static_cast<unsigned long long>(v)); }
+    RPCLogRecord& operator<<(long v) { return AppendInteger(static_cast<long long>(v)); }
+    RPCLogRecord& operator<<(unsigned long v) { return AppendInteger(static_cast<unsigned long long>(v)); }
+    RPCLogRecord& operator<<(long long v) { return AppendInteger(v); }
+    RPCLogRecord& operator<<(unsigned long long v) { return AppendInteger(v); }
+    RPCLogRecord& operator<<(double v);
+    RPCLogRecord& operator<<(const void* p);
+
+private:
+    RPCLogRecord& AppendInteger(long long v);
+    RPCLogRecord& AppendInteger(unsigned long long v);
+
+    std::string* m_buf;      // 线程局部的格式化缓冲区，嵌套打日志时使用 m_own
+    std::string m_own;
+    bool m_nested;
+    RPCLogSite* m_site;
+};
+
+#define RPC_LOG_SITE() ([]() -> RPCLogSite* { static RPCLogSite site; return &site; }())
+
+/*
+    RPC 框架内部使用的日志宏，lv 为 debug、info、warn、error。
+    被过滤或者被限流时，后面的 << 表达式不会求值
+*/
+#define RPC_LOG(lv)                                                                   \
+    if (RPCLog::lv < MYRPC_LOG_MIN_LEVEL || !RPCLog::Enabled(RPCLog::lv)) {}          \
+    else if (RPCLogSite* rpcLogSite_ = RPC_LOG_SITE(); !rpcLogSite_->Admit()) {}      \
+    else RPCLogRecord(RPCLog::lv, __FILE__, __LINE__, __func__, rpcLogSite_)
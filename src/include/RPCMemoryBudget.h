@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace MyRPC
+{
+    class MemoryStats;
+}
+
+class RPCConnMemory;
+
+/**
+ * RPCProvider 的内存记账和上限
+ *
+ * 按类别统计每条连接和整个进程缓存的字节数：
+ *   input       输入缓冲区里还没有收完的请求帧
+ *   reassembly  分块请求已经收到、还没有收齐的分块
+ *   inflight    已经分发、还没有执行完 done 的调用的请求参数
+ *   output      交给连接、还没有发送完的响应
+ *
+ * 网络库没有暂停读的接口，所以用准入代替暂停：
+ *   1.一帧请求的长度前缀到达时就检查，缓存这帧会让连接超过 maxConnectionMemoryMB、或者进程超过
+ *     maxTotalMemoryMB 时，回复 RESOURCE_EXHAUSTED 并断开连接，不再等它收满 64MB
+ *   2.进程超过上限、连接上堆积的响应超过上限（客户端读得太慢）、或者正在执行的调用数超过 maxInFlightCalls 时，
+ *     新的调用直接回复 RESOURCE_EXHAUSTED，不执行 handler
+ * 这样少数慢客户端最多占用各自连接的上限，不会把整个进程的内存耗尽。
+ * 连接关闭时立即释放它的 input、reassembly 和 output，断开的客户端不会继续占用进程的额度。
+ */
+class RPCMemoryBudget
+{
+public:
+    enum Category
+    {
+        kInput = 0,
+        kReassembly,
+        kInFlight,
+        kOutput,
+        kCategoryCount,
+    };
+
+    static RPCMemoryBudget* GetInstance();
+
+    uint64_t ConnectionLimit() const { return m_connectionLimit; }
+    uint64_t TotalLimit() const { return m_totalLimit; }
+
+    // 进程缓存的字节数，category 为 kCategoryCount 时返回总和
+    uint64_t Used(Category category = kCategoryCount) const;
+
+    // 进程里正在执行的调用数
+    int64_t InFlightCalls() const { return m_inFlightCalls.load(std::memory_order_relaxed); }
+
+    // 连接 conn 能否把一帧 frameBytes 字节（含长度前缀）的请求收完
+    bool AdmitFrame(const RPCConnMemory& conn, uint64_t frameBytes);
+
+    // 连接 conn 上的分块请求能否增长到 reassemblyBytes 字节
+    bool AdmitReassembly(const RPCConnMemory& conn, uint64_t reassemblyBytes);
+
+    // 连接 conn 上能否开始一次新的调用
+    bool AdmitCall(const RPCConnMemory& conn);
+
+    // 填充统计服务返回的内存信息
+    void Fill(MyRPC::MemoryStats* stats) const;
+
+private:
+    friend class RPCConnMemory;
+
+    RPCMemoryBudget();
+    RPCMemoryBudget(const RPCMemoryBudget&) = delete;
+    RPCMemoryBudget& operator=(const RPCMemoryBudget&) = delete;
+
+    uint64_t m_connectionLimit;  // 每条连接的上限（字节）
+    uint64_t m_totalLimit;       // 进程的上限（字节）
+    int64_t m_inFlightCallLimit; // 正在执行的调用数上限，0 表示不限制
+
+    std::atomic<uint64_t> m_used[kCategoryCount];
+    std::atomic<int64_t> m_inFlightCalls{0};
+    std::atomic<int64_t> m_connections{0};      // 正在记账的连接数
+    std::atomic<uint64_t> m_rejectedFrames{0};  // 因为超过上限而断开的连接数
+    std::atomic<uint64_t> m_rejectedCalls{0};   // 因为超过上限而拒绝的调用数
+};
+
+// 一条连接的内存记账，销毁时把还没有释放的字节从进程的统计里减掉
+class RPCConnMemory
+{
+public:
+    RPCConnMemory();
+    ~RPCConnMemory();
+
+    RPCConnMemory(const RPCConnMemory&) = delete;
+    RPCConnMemory& operator=(const RPCConnMemory&) = delete;
+
+    // 把 category 的字节数设置为 bytes
+    void Set(RPCMemoryBudget::Category category, uint64_t bytes);
+    void Add(RPCMemoryBudget::Category category, uint64_t bytes);
+    void Sub(RPCMemoryBudget::Category category, uint64_t bytes);
+
+    // category 为 kCategoryCount 时返回总和
+    uint64_t Used(RPCMemoryBudget::Category category = RPCMemoryBudget::kCategoryCount) const;
+
+    // 调用开始和结束，维护进程正在执行的调用数
+    void CallStarted();
+    void CallFinished();
+
+    // 连接已经关闭：输入、分块和还没有发出的响应都不会再被处理，立即释放。inflight 在调用结束时释放
+    void Release();
+    bool Closed() const { return m_closed.load(std::memory_order_acquire); }
+
+    // 等待连接上还没有发出的响应（output）不超过 bytes，流式调用的 Write 用它做背压，不能在 I/O 线程里调用。
+    // output 被重新设置（发送缓冲区清空）或者连接关闭时唤醒。连接已经关闭或者等待超时返回 false
+    bool WaitOutput(uint64_t bytes, std::chrono::milliseconds timeout);
+
+private:
+    std::atomic<uint64_t> m_used[RPCMemoryBudget::kCategoryCount];
+    std::atomic<int64_t> m_calls{0};
+    std::atomic<bool> m_closed{false};
+    std::mutex m_outputMtx;                 // 和 m_outputCond 一起唤醒 WaitOutput
+    std::condition_variable m_outputCond;
+};
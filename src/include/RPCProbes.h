@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * 请求生命周期上的静态探针（USDT），供 perf / bpftrace 在不重启进程的情况下挂载
+ *
+ * 编译时找到 sys/sdt.h（systemtap-sdt-dev）时生效，每个探针在代码里只是一条 nop 指令，没有挂载时几乎没有开销；
+ * 否则 MYRPC_PROBE 展开为空语句，参数不会被求值。provider 名为 myrpc，探针列表：
+ *
+ *   服务端
+ *     request_received  (conn, service, method, argvSize, chunkSeq)   OnMessage 切出一帧请求并解析完请求头
+ *     request_decoded   (ctx, service, method, bytesIn)               Dispatch 把参数反序列化成请求对象
+ *     dispatch_start    (ctx, service, method)                        调用 handler 之前
+ *     dispatch_end      (ctx, service, method)                        handler 的 CallMethod 返回（异步 handler 此时可能还没有执行 done）
+ *     response_enqueued (conn, streamId, bytes)                       SendRpcResponse 把响应交给发送缓冲区
+ *     call_done         (ctx, errorCode, bytesOut)                    done 回调发送完响应，调用结束
+ *   客户端
+ *     client_send       (service, method, bytes)                      SendToServer 发送请求之前
+ *     client_recv       (service, method, bytes, errorCode)           SendToServer 收齐响应之后
+ *
+ * ctx 是服务端调用上下文的地址，同一次调用的 request_decoded / dispatch_* / call_done 用它关联。
+ * 示例脚本见 tools/bpftrace/
+ */
+
+#ifdef MYRPC_HAVE_SDT
+#include <sys/sdt.h>
+
+#define MYRPC_PROBE_CAT_(a, b) a##b
+#define MYRPC_PROBE_CAT(a, b) MYRPC_PROBE_CAT_(a, b)
+#define MYRPC_PROBE_NARG_(_1, _2, _3, _4, _5, _6, N, ...) N
+#define MYRPC_PROBE_NARG(...) MYRPC_PROBE_NARG_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+// 按参数个数选择 DTRACE_PROBEn，至少一个参数，最多六个
+#define MYRPC_PROBE(name, ...) MYRPC_PROBE_CAT(DTRACE_PROBE, MYRPC_PROBE_NARG(__VA_ARGS__))(myrpc, name, __VA_ARGS__)
+#else
+#define MYRPC_PROBE(name, ...) do {} while (0)
+#endif
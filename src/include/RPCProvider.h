@@ -3,24 +3,78 @@
 #include "google/protobuf/service.h"
 #include "Connection.h"
 #include "Buffer.h"
+#include "RPCController.h"
+#include "RPCTrace.h"
+#include "RPCCallTiming.h"
+#include "RPCMemoryBudget.h"
+#include "RPCRegistry.h"
 
 #include <string>
 #include <unordered_map>
 #include <google/protobuf/descriptor.h>
 #include <memory>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
 
+namespace MyRPC
+{
+    class RPCResponseWrapper;
+}
+class TcpServer;
+class ThreadPool;
+struct RPCRequestHeader;
 
-// 用于发布 RPC 服务的类
+/**
+ * 用于发布 RPC 服务的类
+ *
+ * 优雅停止：收到 SIGTERM / SIGINT 或者调用 Shutdown() 后按顺序
+ *   1.从注册中心撤销本提供者
+ *   2.等待 drainDelayMs，让客户端通过 watcher 看到变化、不再选中本提供者
+ *   3.之后到达的请求不再执行，回复可以重试的 UNAVAILABLE
+ *   4.等待正在执行的调用结束、响应发送完毕，最多等待 drainTimeoutMs
+ *   5.关闭服务器，Run() 返回
+ * 滚动发布时客户端看不到失败的调用。
+ *
+ * 流式调用的 handler 在 streamThreads 个工作线程里执行，其余调用在 I/O 线程里执行。
+ * controller->Write() 在连接上还没有发出的响应超过一个分块时阻塞，等 I/O 线程把它们写进内核再继续，
+ * 服务端为一个流缓存的数据和流的总长度无关。
+ */
 class RPCProvider
 {
 public:
+    RPCProvider();
+    ~RPCProvider();
+
     // 框架暴露给外部的接口，用来发布 RPC 远程调用服务
     void NotifyService(google::protobuf::Service *);
 
-    // 启动 RPC 服务结点，开始提供远程网络调用服务
+    // 启动 RPC 服务结点，开始提供远程网络调用服务。优雅停止完成后返回
     void Run();
 
+    // 开始优雅停止，立即返回。可以在任何线程里调用，包括 handler 里
+    void Shutdown();
+
 private:
+    std::unique_ptr<TcpServer> m_pTcpServer;
+    std::unique_ptr<ThreadPool> m_pStreamPool; // 执行流式调用 handler 的工作线程，Write 阻塞时不占用 I/O 线程
+    std::string m_endpoint;                   // 发布到注册中心的地址 "ip:port"
+    RPCRegistry::ServiceMethods m_registered; // 发布到注册中心的服务，停止时撤销
+    std::atomic<bool> m_draining{false};      // 已经撤销注册，新的请求回复 UNAVAILABLE
+    std::atomic<bool> m_stopped{false};       // 服务器已经关闭
+    sem_t m_shutdownSem;                      // Shutdown 和信号处理函数通过它唤醒停止线程，sem_post 可以在信号处理函数里调用
+    std::thread m_drainThread;
+
+    // 停止线程：等待停止请求，然后执行优雅停止的各个步骤
+    void DrainLoop();
+
+    // 收到 SIGTERM / SIGINT 时唤醒停止线程
+    static void OnStopSignal(int signo);
+
     // 描述 service 对象
     struct ServiceInfo
     {
@@ -30,11 +84,97 @@ private:
 
     std::unordered_map<std::string, struct ServiceInfo> m_serviceMap; // 记录所有注册的服务（service 对象）
 
+    std::unique_ptr<google::protobuf::Service> m_pStatsService; // 框架内置的统计服务
+
+    // 一次 RPC 调用的上下文，从分发开始存活到 done 回调执行完毕
+    struct CallContext
+    {
+        std::shared_ptr<Connection> m_pConn;                          // 发起调用的连接
+        uint64_t m_streamId = 0;                                      // 流式调用的 ID，普通调用为 0
+        RPCController m_controller;                                   // 传给 handler 的控制器
+        std::unique_ptr<google::protobuf::Message> m_pRequest;
+        std::unique_ptr<google::protobuf::Message> m_pResponse;
+        const google::protobuf::MethodDescriptor *m_pMethod = nullptr; // 被调用的方法，用于统计
+        std::chrono::steady_clock::time_point m_start;                 // 开始分发的时间
+        size_t m_bytesIn = 0;                                          // 请求参数的字节数
+        size_t m_bytesOut = 0;                                         // 已经发出的流式响应字节数
+        uint64_t m_handlerStartNs = 0;                                 // 开始执行 handler 的时间，用于调用链追踪
+        RPCCallTiming m_timing;                                        // 各阶段的耗时，从收到请求开始计时
+        std::shared_ptr<RPCConnMemory> m_pMemory;                      // 所属连接的内存记账，调用结束时释放 inflight
+        bool m_streamStalled = false;                                  // 客户端 streamWriteTimeoutMs 内没有读走流式响应，结束时回复 RESOURCE_EXHAUSTED
+    };
+
+    // 分块传输中的大请求，收齐所有分块后再分发
+    struct ChunkedRequest
+    {
+        std::weak_ptr<Connection> m_pConn;
+        std::string m_serviceName;
+        std::string m_methodName;
+        uint64_t m_streamId = 0;
+        RPCTraceContext m_trace;          // 第 0 块携带的调用链上下文
+        uint64_t m_receivedTicks = 0;     // 收到第 0 块的时刻（RPCClock）
+        uint32_t m_nextSeq = 0;           // 期望收到的下一个分块序号
+        size_t m_totalSize = 0;           // 已经收到的参数字节数
+        std::vector<std::string> m_chunks; // 按顺序存放的参数分块，不拼接
+    };
+
+    std::unordered_map<Connection*, ChunkedRequest> m_chunkedRequests; // 每条连接上正在接收的大请求
+    std::mutex m_chunkMtx; // OnMessage 运行在多个 I/O 线程里，保护 m_chunkedRequests
+
+    // 一条连接的内存记账
+    struct ConnMemoryEntry
+    {
+        std::weak_ptr<Connection> m_pConn;
+        std::shared_ptr<RPCConnMemory> m_pMemory;
+        bool m_skipClose = false; // 套接字被复用时，上一条连接的关闭回调还没有到达，跳过它
+        size_t m_peerSlot = 0;    // 客户端 IP 在限流里的桶号，创建时算一次
+    };
+
+    std::unordered_map<int, ConnMemoryEntry> m_connMemory; // 每条连接缓存的字节数，按套接字索引，关闭回调只提供套接字
+    std::shared_mutex m_connMemoryMtx; // 保护 m_connMemory，查找只加读锁
+
+    // 返回连接的内存记账，第一次调用时创建。create 为 false 时找不到返回 nullptr。pPeerSlot 不为空时返回限流用的客户端桶号
+    std::shared_ptr<RPCConnMemory> GetConnMemory(const std::shared_ptr<Connection> &pConn, bool create = true, size_t *pPeerSlot = nullptr);
+
+    // 连接已经关闭，释放它缓存的字节和没有收齐的分块请求
+    void OnConnectionClosed(int fd);
+
+    // 连接的发送缓冲区已经全部发出
+    void OnSendComplete(std::shared_ptr<Connection> pConn);
+
     void OnMessage(std::shared_ptr<Connection> pConn, Buffer* buffer);
 
-    // 回调函数，将response发送回客户端
-    void SendRpcResponse(std::shared_ptr<Connection> pConn, google::protobuf::Message *response);
+    // 记录大请求的一个分块。返回值：1 已收齐（结果存入 complete），0 还有分块未到，-1 出错，-2 超过内存上限
+    int AppendChunk(std::shared_ptr<Connection> pConn, RPCConnMemory &memory, const RPCRequestHeader &header, std::string piece, uint64_t receivedTicks, ChunkedRequest *complete);
+
+    // 查找服务和方法，反序列化参数并调用 handler。出错时给客户端返回错误信息，连接上后面的请求照常处理
+    // trace 为请求携带的调用链上下文，receivedTicks 为收到请求的时刻（RPCClock），peerSlot 为限流用的客户端桶号
+    void Dispatch(std::shared_ptr<Connection> pConn, const std::shared_ptr<RPCConnMemory> &pMemory, size_t peerSlot, const std::string &serviceName, const std::string &methodName,
+                  uint64_t streamId, const RPCTraceContext &trace, uint64_t receivedTicks, const std::vector<std::string> &argvChunks);
+
+    // 执行 handler，流式调用在工作线程里调用
+    void CallHandler(google::protobuf::Service *pService, CallContext *pCtx, google::protobuf::Closure *done, const RPCTraceContext &trace);
+
+    // done 回调，handler 执行完毕后发送响应并释放调用上下文
+    void OnCallDone(CallContext* pCtx);
+
+    // 回调函数，将response发送回客户端。流式调用时该响应作为流的最后一帧（trailer）。返回 response 序列化后的字节数
+    // timing 不为空时记录 encode 和 send 阶段
+    size_t SendRpcResponse(std::shared_ptr<Connection> pConn, google::protobuf::Message *response, uint64_t streamId = 0, RPCCallTiming *timing = nullptr);
+
+    // 发送一帧流式响应，m_bytesOut 累加该帧的字节数。连接上还没有发出的响应超过一个分块时等待发送缓冲区清空。
+    // 连接已经关闭、或者等待超过 streamWriteTimeoutMs 时不发送，返回 false
+    bool SendStreamFrame(CallContext *pCtx, const google::protobuf::Message &msg);
 
     // RPC调用过程中出现问题，导致调用失败，给框架的客户端返回失败信息
-    void SendErrorResponse(std::shared_ptr<Connection> pConn, int error_code, const std::string &error_msg);
+    void SendErrorResponse(std::shared_ptr<Connection> pConn, int error_code, const std::string &error_msg, uint64_t streamId = 0);
+
+    // 回复客户端的心跳帧（PONG）
+    void SendHeartbeatResponse(std::shared_ptr<Connection> pConn);
+
+    // 给响应加上 4 字节长度前缀后发送
+    void SendFrame(std::shared_ptr<Connection> pConn, const std::string &wrapperStr);
+
+    // 发送已经加上长度前缀的一帧或者多帧响应，在发送缓冲区清空之前计入连接的 kOutput
+    void SendFrames(std::shared_ptr<Connection> pConn, const std::string &frames);
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class RPCConfig;
+
+/**
+ * RPCProvider 的限流：分发请求前按方法、按客户端 IP 检查令牌桶，超过限制的调用回复 RATE_LIMITED，不执行 handler
+ *
+ * 配置项的值为 "每秒调用数[,突发调用数]"，突发调用数默认等于每秒调用数，每秒调用数为 0 表示不限制：
+ *   rateLimit.<服务名>.<方法名>       该方法所有客户端合计的限制
+ *   rateLimitPerIp.<服务名>.<方法名>  该方法对每个客户端 IP 的限制
+ *   rateLimitPerIp                    每个客户端 IP 所有方法合计的限制
+ * 配置了 rateLimitFile 时从该文件读取上面的配置项，文件修改后 1 秒内生效，不需要重启。
+ *
+ * 令牌桶按 GCRA 实现，每个桶只有一个原子变量（下一个令牌的到达时间），用 CAS 更新，不加锁。
+ * 规则表替换时整体换掉并把版本号加一。每个线程缓存一份规则表的引用，Admit 只读版本号，
+ * 版本号变化时才加锁重新取一次，平时不碰共享的引用计数。旧表在所有线程都换成新表之后释放。
+ * 没有配置任何限制时 Admit 只读一个原子变量。
+ * 按 IP 的限制把 IP 哈希到固定数量的桶里，不会随客户端数量增长；哈希冲突的 IP 共享一个桶，只会更严格。
+ * 桶号由 PeerSlot 在每条连接上算一次，Admit 不做系统调用。
+ */
+class RPCRateLimiter
+{
+public:
+    static RPCRateLimiter* GetInstance();
+
+    // 是否放行一次调用。peerSlot 为调用所在连接的 PeerSlot，只有按 IP 的限制会用到
+    bool Admit(const std::string& serviceName, const std::string& methodName, size_t peerSlot);
+
+    // 连接 fd 的客户端 IP 对应的桶号，取不到地址时返回 0。每条连接建立后调用一次，结果由调用方缓存
+    static size_t PeerSlot(int fd);
+
+    // 用 config 里的限流配置项替换当前的限制，新的桶是满的。可以在任何线程里调用
+    void Apply(const RPCConfig& config);
+
+    // 读取主配置或者 rateLimitFile 里的限制。配置了 rateLimitFile 时启动后台线程监视文件的修改。只有第一次调用有效
+    void Start();
+
+private:
+    RPCRateLimiter() = default;
+    RPCRateLimiter(const RPCRateLimiter&) = delete;
+    RPCRateLimiter& operator=(const RPCRateLimiter&) = delete;
+
+    // 一条限制：每隔 m_intervalNs 产生一个令牌，最多攒 m_burstNs / m_intervalNs 个
+    struct Limit
+    {
+        int64_t m_intervalNs = 0;
+        int64_t m_burstNs = 0;
+    };
+
+    // 令牌桶，m_tat 为下一个令牌的理论到达时间（steady_clock 纳秒）
+    struct Bucket
+    {
+        std::atomic<int64_t> m_tat{0};
+    };
+
+    struct MethodRule
+    {
+        Limit m_total;
+        std::unique_ptr<Bucket> m_pTotal;   // 没有配置时为空
+        Limit m_perIp;
+        std::unique_ptr<Bucket[]> m_pPerIp; // 按 IP 哈希的桶，没有配置时为空
+    };
+
+    // 一份完整的规则表，替换后不再修改
+    struct Rules
+    {
+        std::unordered_map<std::string, std::unordered_map<std::string, MethodRule>> m_methods; // <服务名，<方法名，规则>>
+        Limit m_perIp;
+        std::unique_ptr<Bucket[]> m_pPerIp;
+    };
+
+    std::shared_ptr<const Rules> m_pRules; // 当前的规则表，没有任何限制时为空，由 m_mtx 保护
+    std::atomic<uint64_t> m_generation{0}; // m_pRules 的版本号，每次 Apply 加一
+    std::atomic<bool> m_enabled{false};    // m_pRules 是否为空，没有限制时 Admit 不用读规则表
+    std::mutex m_mtx;
+    std::once_flag m_started;
+
+    // 取一个令牌，令牌不足时返回 false
+    static bool TryAcquire(Bucket& bucket, const Limit& limit, int64_t nowNs);
+
+    // 解析 "每秒调用数[,突发调用数]"，非法或者不限制时返回 false
+    static bool ParseLimit(const std::string& key, const std::string& value, Limit* limit);
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+/**
+ * 服务注册中心的抽象接口：RPCProvider 通过它发布服务，RPCChannel 和 RPCWarmUp 通过它查找提供者地址
+ *
+ * 由配置项 registry 选择实现：
+ *   zookeeper（默认）ZkRegistry，服务发布为 zookeeper 上的结点，第一次使用时才建立 zookeeper 会话
+ *   static           RPCStaticRegistry，进程内的内存表，可以用配置项 registryFile 预先加载地址。
+ *                    不依赖任何外部组件，启动不需要等待，用于本地压测和测试
+ *   none             同 static，保留给旧的配置文件
+ */
+class RPCRegistry
+{
+public:
+    using ServiceMethods = std::map<std::string, std::vector<std::string>>; // 服务名 -> 方法名列表
+
+    // 提供者的负载摘要
+    struct LoadReport
+    {
+        uint32_t m_inFlightCalls = 0;  // 正在执行的调用数
+        uint64_t m_queuedBytes = 0;    // 缓存着还没有执行或者还没有发出的字节数
+        uint32_t m_cpuPermille = 0;    // 进程 CPU 占用，按核数归一化，0 ~ 1000
+    };
+
+    /**
+     * 客户端实际使用的权重：容量权重按负载折算
+     *   weight * max(0.1, 1 - cpu) / (1 + inFlight / 64 + queuedMB)
+     * CPU 跑满的实例最多降到十分之一，排队越多的实例分到的流量越少。提供者用同一个公式判断负载变化是否值得发布
+     */
+    static double EffectiveWeight(uint32_t weight, const LoadReport& load);
+
+    // 把 "ip:port" 拆成 ip 和端口。ip 为空、端口不是 1 ~ 65535 的完整数字时返回 false
+    static bool ParseEndpoint(const std::string& endpoint, std::string* ip, uint16_t* port);
+
+    virtual ~RPCRegistry() = default;
+
+    // 一次发布提供者的所有服务，提供者地址为 endpoint（"ip:port"）。返回发布失败的条目数
+    virtual int Register(const ServiceMethods& services, const std::string& endpoint) = 0;
+
+    // 撤销 Register 发布的服务，用于优雅停止。返回撤销失败的条目数
+    virtual int Deregister(const ServiceMethods& services, const std::string& endpoint) = 0;
+
+    // 发布提供者的负载，注册中心不支持时忽略
+    virtual void ReportLoad(const LoadReport& load) {}
+
+    // 查找方法的提供者地址 "ip:port"，不存在时返回空字符串
+    virtual std::string Lookup(const std::string& serviceName, const std::string& methodName) = 0;
+
+    // 服务所有方法的提供者地址（去重），用于预热
+    virtual std::vector<std::string> ListEndpoints(const std::string& serviceName) = 0;
+
+    // 返回按配置创建的注册中心，进程内唯一
+    static RPCRegistry* GetInstance();
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * 客户端的重试预算（令牌桶）：每次调用存入 ratio 个令牌，每次重试取出 1 个。
+ * 提供者整体故障时，重试最多让流量增加 ratio，不会把故障放大。
+ * 令牌以千分之一为单位存放，初始是满的，调用量很少的客户端也能重试偶发的失败。
+ * 存取都是一次 CAS，可以在任何线程里调用
+ */
+class RPCRetryBudget
+{
+public:
+    static const int64_t kTokenUnit = 1000; // 一个令牌
+
+    // ratio 为每次调用存入的令牌数，capTokens 为最多攒下的令牌数
+    RPCRetryBudget(double ratio, int64_t capTokens);
+
+    // 一次调用开始时存入 ratio 个令牌，不超过上限
+    void Deposit();
+
+    // 重试前取出一个令牌，不足一个时返回 false，不重试
+    bool Withdraw();
+
+    // 当前的令牌数，以 kTokenUnit 为单位
+    int64_t Tokens() const { return m_tokens.load(std::memory_order_relaxed); }
+
+private:
+    int64_t m_deposit; // 每次调用存入的令牌，以 kTokenUnit 为单位
+    int64_t m_cap;
+    std::atomic<int64_t> m_tokens;
+};
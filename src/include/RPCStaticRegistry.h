@@ -0,0 +1,40 @@
+#pragma once
+
+#include "RPCRegistry.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+
+/**
+ * 进程内的静态注册中心
+ *
+ * Register 只写进内存表，同一进程里的 RPCChannel 可以直接查到；其他进程的提供者地址从文件加载，
+ * 每行一条，格式和配置文件相同（# 开头为注释）：
+ *
+ *   UserServiceRpc/Login = 127.0.0.1:60001           # 单个方法
+ *   FriendServiceRpc = 127.0.0.1:60002,127.0.0.1:60003 # 服务的所有方法，多个地址轮流使用
+ *
+ * 查找时先匹配 "服务/方法"，再匹配 "服务"。查找只加读锁，压测时不会成为瓶颈。
+ */
+class RPCStaticRegistry : public RPCRegistry
+{
+public:
+    // 从 filePath 加载地址，返回加载的条目数，文件无法打开时返回 -1
+    int LoadFile(const std::string& filePath);
+
+    int Register(const ServiceMethods& services, const std::string& endpoint) override;
+    int Deregister(const ServiceMethods& services, const std::string& endpoint) override;
+    std::string Lookup(const std::string& serviceName, const std::string& methodName) override;
+    std::vector<std::string> ListEndpoints(const std::string& serviceName) override;
+
+private:
+    // 把 endpoints 加入 key 对应的地址列表，已经存在的地址不重复添加
+    void Add(const std::string& key, const std::vector<std::string>& endpoints);
+
+    std::shared_mutex m_mtx;                                                  // 保护 m_endpoints
+    std::unordered_map<std::string, std::vector<std::string>> m_endpoints;    // "服务/方法" 或 "服务" -> 地址列表
+    std::atomic<uint64_t> m_next{0};                                          // 多个地址时轮流选择
+};
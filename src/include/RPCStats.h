@@ -0,0 +1,112 @@
+#pragma once
+
+#include "RPCHistogram.h"
+#include "RPCCallTiming.h"
+
+#include <google/protobuf/descriptor.h>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+namespace MyRPC
+{
+    class StatsResponse;
+}
+
+/**
+ * 每个方法的调用统计：调用次数、按错误码的失败次数、正在进行的调用数、收发字节数和延迟直方图
+ *
+ * 服务端（RPCProvider）和客户端（RPCChannel）分开统计。每个线程写自己的分片，分片的锁只在
+ * 读取快照时才会有竞争，记录一次调用只是一次哈希查找和几次自增。方法用 MethodDescriptor 指针区分，
+ * 读取快照时才转换成名字。
+ */
+class RPCStats
+{
+public:
+    enum Side
+    {
+        kServer = 0,
+        kClient = 1,
+    };
+
+    static constexpr int kLocalError = -1; // 客户端本地错误：连接、发送或者接收失败，请求可能没有到达服务端
+
+    static RPCStats* GetInstance();
+
+    // 调用开始，method 为空表示未知的方法
+    void OnStart(Side side, const google::protobuf::MethodDescriptor* method);
+
+    // 调用结束。errorCode 为 RPCResponseError 的错误码或者 kLocalError，bytesIn/bytesOut 为收发的消息字节数
+    void OnFinish(Side side, const google::protobuf::MethodDescriptor* method, int errorCode,
+                  size_t bytesIn, size_t bytesOut, uint64_t latencyNs);
+
+    // 记录一次调用各阶段的耗时，只记录走到了的阶段。由 RPCCallTiming::Finish 调用
+    void OnPhases(const RPCCallTiming& timing);
+
+    // 合并所有分片，填充到 response 里。prefix 不为空时只返回全名以 prefix 开头的方法（阶段统计总是全部返回）
+    void Snapshot(MyRPC::StatsResponse* response, const std::string& prefix = "");
+
+    // 文本格式的统计信息，每个方法一行
+    std::string DumpText(const std::string& prefix = "");
+
+    // 把快照转换成文本格式
+    static std::string FormatText(const MyRPC::StatsResponse& response);
+
+private:
+    static constexpr int kErrorSlots = 16; // 错误码 -1 ~ 14，更大的错误码计入最后一个槽
+
+    struct MethodMetrics
+    {
+        uint64_t m_started = 0;
+        uint64_t m_finished = 0;
+        uint64_t m_errors[kErrorSlots] = {0}; // 下标为错误码 + 1，下标 1 （SUCCESS）不使用
+        uint64_t m_bytesIn = 0;
+        uint64_t m_bytesOut = 0;
+        RPCHistogram m_latency;
+
+        void Merge(const MethodMetrics& other);
+    };
+
+    using MetricsMap = std::unordered_map<const google::protobuf::MethodDescriptor*, MethodMetrics>;
+
+    // 各阶段的直方图，用到的阶段才分配（客户端线程和服务端线程只会用到各自的阶段）
+    struct PhaseMetrics
+    {
+        std::unique_ptr<RPCHistogram> m_phases[RPCCallTiming::kPhaseCount];
+
+        void Merge(const PhaseMetrics& other);
+    };
+
+    // 一个线程的统计分片
+    struct Shard
+    {
+        std::mutex m_mtx;         // 只有所属线程写入，读取快照时才会竞争
+        MetricsMap m_metrics[2];  // 按 Side 区分
+        PhaseMetrics m_phases;
+    };
+
+    // 线程退出时把分片合并到 m_retired 里
+    struct ShardHolder
+    {
+        Shard* m_pShard = nullptr;
+        ~ShardHolder();
+    };
+
+    RPCStats() = default;
+    RPCStats(const RPCStats&) = delete;
+    RPCStats& operator=(const RPCStats&) = delete;
+
+    // 返回当前线程的分片，第一次调用时创建
+    Shard* LocalShard();
+
+    // 合并所有分片
+    void Collect(MetricsMap merged[2], PhaseMetrics* phases);
+
+    std::mutex m_mtx;              // 保护 m_shards 和 m_retired
+    std::vector<Shard*> m_shards;  // 存活线程的分片
+    MetricsMap m_retired[2];       // 已经退出的线程留下的统计
+    PhaseMetrics m_retiredPhases;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Stats.pb.h"
+
+/**
+ * 框架内置的统计服务，由 RPCProvider::Run() 和用户服务一起发布
+ *
+ * 返回本进程所有方法的服务端和客户端统计（RPCStats），供监控系统定期拉取。
+ * 服务名 RPCStatsService 是保留的，配置项 statsService = off 时不发布。
+ */
+class RPCStatsService final : public MyRPC::RPCStatsService
+{
+public:
+    void GetStats(google::protobuf::RpcController *controller,
+                  const MyRPC::StatsRequest *request,
+                  MyRPC::StatsResponse *response,
+                  google::protobuf::Closure *done) override;
+};
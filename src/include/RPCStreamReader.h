@@ -0,0 +1,62 @@
+#pragma once
+#include <google/protobuf/service.h>
+#include <google/protobuf/message.h>
+#include <string>
+#include <memory>
+#include <chrono>
+
+class RPCConnection;
+
+/**
+ * 服务端流式调用的客户端读取器，由 RPCChannel::CallStream() 创建
+ *
+ * 服务端的每一帧响应都携带本次调用的流 ID，最后一帧（trailer）里是 handler 最终填写的 response。
+ * 读取器每次只从连接上取出一帧并反序列化，客户端的内存占用只和单帧大小有关，和结果集的总大小无关。
+ * 流结束时读取器向连接池的熔断器报告结果，延迟取从发出请求到收到第一帧的时间，和流的长度无关。
+ *
+ *     auto reader = channel.CallStream(method, &controller, &request);
+ *     while (reader && reader->Read(&chunk)) { ... }
+ *     if (reader) reader->Finish(&response);
+ */
+class RPCStreamReader
+{
+public:
+    // probe 表示这次调用是熔断器半开时的探测调用，sendTime 是发出请求的时间
+    RPCStreamReader(std::shared_ptr<RPCConnection> pConn, uint64_t streamId, google::protobuf::RpcController *controller,
+                    const std::string& serviceName, bool probe, std::chrono::steady_clock::time_point sendTime);
+    ~RPCStreamReader();
+
+    RPCStreamReader(const RPCStreamReader&) = delete;
+    RPCStreamReader& operator=(const RPCStreamReader&) = delete;
+
+    // 读取下一条流式响应，流结束或者出错时返回 false，出错时错误信息记录在 controller 里
+    bool Read(google::protobuf::Message *msg);
+
+    // 丢弃剩余未读取的响应，并把 trailer 解析到 response（可以为 nullptr）。调用成功返回 true
+    bool Finish(google::protobuf::Message *response);
+
+private:
+    // 读取下一帧的数据。返回值：1 数据帧，0 流正常结束，-1 出错
+    int NextFrame(std::string* data);
+
+    // 流结束后把连接归还给连接池
+    void Release();
+
+    // 向熔断器报告一次结果，只报告一次。rejected 表示服务端没有执行调用就拒绝了，不报告，只归还探测名额
+    void Report(bool success, bool rejected = false);
+
+    std::shared_ptr<RPCConnection> m_pConn;
+    uint64_t m_streamId;
+    google::protobuf::RpcController *m_controller;
+    bool m_finished;      // 是否已经读到 trailer 或者发生错误
+    std::string m_frame;  // 复用的帧缓冲区
+    std::string m_trailer; // 最后一帧里的 response
+
+    std::string m_ip;          // 连接的主机，报告结果用
+    uint16_t m_port;
+    std::string m_serviceName;
+    bool m_probe;              // 是不是半开探测调用
+    bool m_reported;           // 是否已经报告过结果
+    std::chrono::steady_clock::time_point m_sendTime;
+    uint64_t m_latencyNs;      // 从发出请求到收到第一帧的时间，还没有收到时为 0
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+#include <cstdint>
+
+// 调用链上下文，随 RpcHeader 在服务之间传递。traceId 为 0 表示没有开启追踪
+struct RPCTraceContext
+{
+    uint64_t m_traceId = 0;      // 整条调用链的 ID
+    uint64_t m_spanId = 0;       // 本次调用的 ID，客户端和服务端记录的同一次调用共用一个 spanId
+    uint64_t m_parentSpanId = 0; // 上游调用的 spanId，调用链的第一个调用为 0
+    bool m_sampled = false;      // 是否记录本调用链的 span
+};
+
+/**
+ * 调用链追踪
+ *
+ * RPCChannel 发起调用时为其生成新的 spanId，父调用依次取自 controller 里设置的上下文、当前线程正在
+ * 处理的服务端调用（RPCProvider 在执行 handler 期间通过 RPCTraceScope 设置），都没有时按配置项
+ * traceSampleRate 的比例开启新的调用链。
+ *
+ * 被采样的 span 写入当前线程的无锁环形缓冲区，写满时丢弃；后台线程每秒把所有缓冲区里的 span 以
+ * Chrome Trace Event 格式追加到配置项 traceFile 指定的文件中，可以用 chrome://tracing 或 Perfetto 打开。
+ */
+class RPCTrace
+{
+public:
+    // 当前线程正在处理的调用的上下文，没有时返回 nullptr
+    static const RPCTraceContext* Current();
+
+    // 为一次新的调用生成上下文：parent 有效时继承其 traceId 和采样标志，否则按采样率开启新的调用链
+    static RPCTraceContext NewChild(const RPCTraceContext& parent);
+
+    // 单调时钟，单位纳秒
+    static uint64_t NowNs();
+
+    // 记录一个 span 阶段，ctx 未被采样时直接返回。name 必须是字符串常量
+    static void Record(const RPCTraceContext& ctx, const char* name, const google::protobuf::MethodDescriptor* method,
+                       uint64_t startNs, uint64_t endNs);
+
+    // 立即把缓冲区里的 span 写入文件
+    static void Flush();
+
+private:
+    friend class RPCTraceScope;
+    static const RPCTraceContext*& CurrentSlot();
+};
+
+// 在作用域内把 ctx 设置为当前线程正在处理的调用，离开作用域时恢复
+class RPCTraceScope
+{
+public:
+    explicit RPCTraceScope(const RPCTraceContext* ctx);
+    ~RPCTraceScope();
+
+    RPCTraceScope(const RPCTraceScope&) = delete;
+    RPCTraceScope& operator=(const RPCTraceScope&) = delete;
+
+private:
+    const RPCTraceContext* m_prev;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#ifdef MYRPC_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/**
+ * 基于 io_uring 的客户端 I/O 传输层
+ *
+ * 每个调用线程持有一个独立的 ring（单生产者，无需加锁）。ring 初始化时注册一块固定的接收缓冲区，
+ * 一次 RPC 调用的 send 和 recv 通过 IOSQE_IO_LINK 串联，只需一次 io_uring_enter 系统调用就能完成
+ * “发送请求 + 等待响应”，而阻塞模式下至少需要 send、recv 两次系统调用。
+ * 编译时没有 liburing，或者运行时内核不支持 io_uring，IsSupported() 返回 false，调用方回退到阻塞 I/O。
+ *
+ * 已知限制：接收的数据先落在固定缓冲区里，再 memcpy 到调用方的 buf。固定缓冲区由 ring 所在的线程共用，
+ * 而 RPCConnection::RecvFrame 要在属于连接的缓冲区里拼接跨多次接收的帧，所以不能直接在固定缓冲区上解析。
+ * 固定缓冲区省掉的是每次接收时内核对用户页的映射，不是这一次拷贝；大响应的接收开销和阻塞 recv 相当。
+ */
+class RPCUring
+{
+public:
+    ~RPCUring();
+
+    // 判断当前环境能否使用 io_uring（只探测一次）
+    static bool IsSupported();
+
+    // 获取当前线程的 ring 对象，不支持 io_uring 时返回 nullptr
+    static RPCUring* ThreadLocal();
+
+    // 发送 len 字节的 data，然后接收最多 bufSize 字节到 buf。返回值和 recv() 一致
+    int SendRecv(int fd, const char* data, size_t len, char* buf, size_t bufSize);
+
+    // 单独发送，返回值和 send() 一致
+    int Send(int fd, const char* data, size_t len);
+
+    // 单独接收，返回值和 recv() 一致
+    int Recv(int fd, char* buf, size_t bufSize);
+
+    static const size_t kRecvBufferSize = 64 * 1024; // 注册的固定接收缓冲区大小
+
+private:
+    RPCUring();
+    RPCUring(const RPCUring&) = delete;
+    RPCUring& operator=(const RPCUring&) = delete;
+
+    bool Init(); // 初始化 ring 并注册固定缓冲区
+
+#ifdef MYRPC_HAVE_LIBURING
+    // 等待 count 个完成事件，按照 user_data 把结果写入 results
+    void Reap(int count, int* results);
+
+    struct io_uring m_ring;
+#endif
+    bool m_inited;
+    char* m_recvBuf; // 注册到内核的固定接收缓冲区
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+
+// 一次预热的结果
+struct RPCWarmUpResult
+{
+    int m_services = 0;     // 解析成功的服务个数
+    int m_endpoints = 0;    // 发现的 RPCProvider 地址个数
+    int m_connections = 0;  // 预热之后连接池里到这些地址的连接总数
+    int m_failures = 0;     // 解析失败的服务个数和一条连接都没有建立成功的地址个数之和
+    long long m_elapsedMs = 0; // 预热耗时
+};
+
+/**
+ * 客户端连接预热
+ *
+ * 进程启动后的第一批调用需要建立 zookeeper 会话、查询服务地址、和 RPCProvider 三次握手，
+ * 还要初始化 protobuf 的描述符和默认实例。预热把这些工作提前到启动阶段完成：
+ * 解析每个服务的全部提供者，并行地为每个提供者建立 connectionsPerHost 条连接放进连接池。
+ */
+class RPCWarmUp
+{
+public:
+    /**
+     * @brief 同步预热，阻塞直到完成
+     *
+     * @param services 服务名称，可以是 "UserServiceRpc" 或者带包名的 "RPCTest.UserServiceRpc"。
+     *                 带包名时还会提前初始化该服务所有方法的请求和响应类型
+     * @param connectionsPerHost 每个提供者预先建立的连接数
+     */
+    static RPCWarmUpResult Run(const std::vector<std::string>& services, int connectionsPerHost);
+
+    // 在后台线程里预热，完成后调用 callback（可以为空），并且可以通过返回的 future 等待结果
+    static std::shared_future<RPCWarmUpResult> RunAsync(const std::vector<std::string>& services,
+                                                        int connectionsPerHost,
+                                                        std::function<void(const RPCWarmUpResult&)> callback = nullptr);
+
+private:
+    // 解析一个服务的所有提供者地址 "ip:port"
+    static std::vector<std::string> ResolveService(const std::string& serviceName);
+
+    // 初始化服务的 protobuf 描述符和请求、响应的默认实例
+    static void WarmDescriptors(const std::string& fullName);
+};
@@ -1,15 +1,46 @@
-#pragma
+#pragma once
 #include "ZooKeeperUtil.h"
 
 #include <memory>
 #include <mutex>
 #include <atomic>
+#include <functional>
+#include <vector>
 
+namespace MyRPC
+{
+    class RegistryStats;
+}
+
+/**
+ * 管理进程内唯一的 zookeeper 会话
+ *
+ * 会话过期（进程长时间停顿或者网络中断超过会话超时）后，旧句柄上的临时结点和 watcher 都已经被 zkServer 删除，
+ * 旧句柄也不能再使用。收到过期事件时在后台线程里建立新会话，然后回调恢复监听者，由它们重新注册结点、
+ * 重新设置 watcher；在新会话建立之前调用 GetZkClient 的线程也会直接建立新会话。
+ *
+ * 客户端以 shared_ptr 交给调用方，会话被替换后旧客户端在最后一个使用者放开时才关闭。
+ * 同一时间只有一个线程建立会话，握手最多等待 zookeeperConnectTimeoutMs，期间不持有保护当前客户端的锁。
+ */
 class ZkConnectionManager
 {
 public:
     static ZkConnectionManager* getInstance();
-    ZkClient* GetZkClient();
+
+    // 返回当前会话的客户端，第一次调用或者会话过期后建立新会话（阻塞到连接成功），超时返回 nullptr
+    std::shared_ptr<ZkClient> GetZkClient();
+
+    // 不阻塞的版本：会话可用时返回客户端；否则返回 nullptr，还没有会话时在后台开始连接
+    std::shared_ptr<ZkClient> TryGetZkClient();
+
+    // 当前会话是否可用（已连接、没有断线、没有过期）
+    bool Available() const;
+
+    // 建立了新会话时回调（包括第一个会话和过期后的新会话），参数为新会话的客户端
+    void AddRecoveryListener(std::function<void(const std::shared_ptr<ZkClient>&)> listener);
+
+    // 会话过期次数、断线后恢复的次数和累计不可用的时间
+    void Fill(MyRPC::RegistryStats* stats) const;
 
 private:
     ZkConnectionManager();
@@ -19,7 +50,26 @@ private:
     ZkConnectionManager& operator=(const ZkConnectionManager& ) = delete;
     ZkConnectionManager& operator=(const ZkConnectionManager&& ) = delete;
 
-    std::unique_ptr<ZkClient> m_PZkClient;
+    // ZkClient 的会话状态回调，运行在 zookeeper 的 I/O 线程里
+    void OnStateChange(ZkClient* pClient, int state);
+
+    // 连接恢复，结束一段不可用时间
+    void OnAvailable();
+
+    // 在后台线程里调用 GetZkClient，同一时间只有一个
+    void ConnectInBackground();
+
+    std::shared_ptr<ZkClient> m_pZkClient;       // 当前会话的客户端，只通过 std::atomic_load / atomic_store 访问
+    std::atomic<ZkClient*> m_pCurrent{nullptr};  // 当前会话的客户端的地址，I/O 线程用它过滤旧会话的事件，不能解引用
     std::atomic<bool> m_isConnected;
-    std::mutex m_mtx;
-};
\ No newline at end of file
+    std::atomic<bool> m_recovering{false};       // 后台连接线程正在运行
+    std::timed_mutex m_connectMtx;               // 同一时间只有一个线程建立会话
+
+    std::mutex m_listenerMtx;
+    std::vector<std::function<void(const std::shared_ptr<ZkClient>&)>> m_listeners;
+
+    std::atomic<int64_t> m_unavailableSince{0};  // 开始不可用的时间（steady_clock 纳秒），0 表示可用
+    std::atomic<uint64_t> m_expirations{0};
+    std::atomic<uint64_t> m_reconnects{0};
+    std::atomic<uint64_t> m_unavailableNs{0};
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "RPCRegistry.h"
+#include "ZooKeeperUtil.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <mutex>
+
+/**
+ * 基于 zookeeper 的注册中心
+ *
+ * 结点布局：/serviceName 为永久结点，每个提供者实例在它下面有一个临时结点 /serviceName/ip:port，
+ * 数据为序列化的 MyRPC::ServiceManifest（地址、方法列表、权重和协议特性）。结点数只和实例数有关，和方法数无关。
+ * 提供者进程退出后临时结点随会话一起删除。发布时所有结点的创建请求一次性流水线发出（父结点在前），只等待一个往返。
+ *
+ * 客户端按服务缓存实例清单，同一服务的任何方法都只需要一次查找；子结点或者清单变化时由 watcher 让缓存失效，
+ * 下一次查找重新读取。会话过期后在新会话上重新创建本进程发布的结点，并让所有缓存失效，下一次查找时重新设置 watcher。
+ * 提供者通过 ReportLoad 把负载写回自己的清单，客户端按 EffectiveWeight 加权随机选择实例。
+ *
+ * 就近选择：提供者把配置项 zone / rack 写进清单。客户端配置了 zone 时只在同可用区的实例里选择；
+ * 同可用区实例按负载折算后的权重之和低于容量的 zoneSpillRatio 时（实例繁忙或者大部分已经下线），
+ * 才把其他可用区的实例也加进来。同机架的实例权重加倍。
+ *
+ * 配置了 registrySnapshot 时，客户端每隔 registrySnapshotInterval 秒把缓存写到本地快照文件，启动时先加载快照。
+ * 快照里的服务和 zookeeper 不可用时保留的旧数据都标记为 stale：查找照常返回这些地址，不去等 zookeeper，
+ * 会话恢复后再重新读取。这样冷启动的第一次查找不需要等待建立会话，zookeeper 故障也不会让调用失败。
+ */
+class ZkRegistry : public RPCRegistry
+{
+public:
+    ZkRegistry();
+
+    int Register(const ServiceMethods& services, const std::string& endpoint) override;
+    int Deregister(const ServiceMethods& services, const std::string& endpoint) override;
+    void ReportLoad(const LoadReport& load) override;
+    std::string Lookup(const std::string& serviceName, const std::string& methodName) override;
+    std::vector<std::string> ListEndpoints(const std::string& serviceName) override;
+
+private:
+    // 一个提供者实例
+    struct Instance
+    {
+        std::string m_endpoint;
+        std::unordered_set<std::string> m_methods;
+        uint32_t m_capacity = 100; // 清单里的容量权重
+        double m_weight = 100;     // 按负载折算后的权重
+        std::string m_zone;
+        std::string m_rack;
+        std::string m_manifest; // 序列化的清单，写快照用
+    };
+
+    // 一个服务的实例缓存
+    struct ServiceEntry
+    {
+        std::vector<Instance> m_instances;
+        bool m_valid = false;       // watcher 触发后置为 false，下一次查找重新读取
+        uint64_t m_generation = 0;  // 每次失效加 1，读取期间发生的失效不会被读取结果覆盖
+        bool m_stale = false;       // 来自快照，或者 zookeeper 不可用时保留的旧数据
+    };
+
+    // 解析一个实例结点的数据
+    static bool ParseInstance(const std::string& data, Instance* instance);
+
+    // 缓存失效时从 zookeeper 重新读取服务的实例列表。zookeeper 不可用且有旧数据时不等待，继续使用旧数据
+    void Refresh(const std::string& serviceName);
+
+    // 从快照文件加载缓存，返回加载的服务数
+    int LoadSnapshot(const std::string& path);
+
+    // 缓存有变化时写快照文件，先写临时文件再改名，进程中途退出也不会留下半个文件
+    void SaveSnapshot(const std::string& path);
+
+    // 建立了新会话：重新创建本进程发布的结点，让缓存失效
+    void OnSessionRecovered(const std::shared_ptr<ZkClient>& zk);
+
+    // zookeeper 的 watcher 回调：path 为 /serviceName 或者 /serviceName/ip:port，path 为空时让所有缓存失效
+    static void OnWatch(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx);
+    void Invalidate(const std::string& path);
+
+    std::shared_mutex m_mtx;                                       // 保护 m_services，查找只加读锁
+    std::unordered_map<std::string, ServiceEntry> m_services;      // 服务名 -> 实例缓存
+    bool m_dirty = false;                                          // 上次写快照之后缓存有变化，由 m_mtx 保护
+
+    std::mutex m_publishMtx;                                                   // 保护 m_published
+    std::vector<std::pair<std::string, std::string>> m_published;             // 本进程发布的实例结点路径和序列化的清单
+};
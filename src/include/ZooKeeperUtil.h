@@ -4,16 +4,22 @@
 #include <memory>
 #include <functional>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <semaphore.h>
 
 // zookeeper的客户端类
 class ZkClient
 {
 public:
-    ZkClient();
+    // 会话状态变化的回调（ZOO_CONNECTED_STATE、ZOO_CONNECTING_STATE、ZOO_EXPIRED_SESSION_STATE 等），运行在 zookeeper 的 I/O 线程里
+    using StateCallback = std::function<void(ZkClient*, int state)>;
+
+    explicit ZkClient(StateCallback onState = nullptr);
     ~ZkClient();
 
-    // 启动 zookeeper 的客户端程序zkClient，和 zookeeper的服务端 zkServer 建立连接
-    void Start();
+    // 启动 zookeeper 的客户端程序zkClient，和 zookeeper的服务端 zkServer 建立连接。timeoutMs 内没有连接成功时关闭句柄并返回 false
+    bool Start(int timeoutMs);
 
     
     /**
@@ -26,10 +32,45 @@ public:
      */
     void Create(const char* path, const char* data, int dataLen, int state = 0);
 
-    // 获取指定 path 的结点的值
-    std::string GetData(const char* path);
+    // 批量创建的一个结点
+    struct Node
+    {
+        std::string m_path;
+        std::string m_data;
+        int m_state = 0; // 0 为永久性结点，ZOO_EPHEMERAL 为临时性结点
+    };
+
+    /**
+     * @brief 按顺序批量创建结点。所有请求用 zoo_acreate 一次发出，再统一等待结果，总共只需要一个往返
+     *
+     * 已经存在的结点视为创建成功，所以可以重复调用。父结点必须排在子结点前面
+     * @return 创建失败（包括等待超时）的结点数
+     */
+    int CreateAll(const std::vector<Node>& nodes);
+
+    // 会话是否已经过期。过期的句柄不能再使用，临时结点和 watcher 都已经被 zkServer 删除
+    bool Expired() const { return m_expired.load(std::memory_order_acquire); }
+
+    // 删除指定 path 的结点，结点不存在也算成功
+    bool Delete(const char* path);
+
+    // 覆盖指定 path 的结点的值，成功返回 true
+    bool Set(const char* path, const std::string& data);
+
+    // 获取指定 path 的结点的值，结点不存在时返回空字符串。watcher 不为空时在结点数据变化或者删除时回调一次
+    std::string GetData(const char* path, watcher_fn watcher = nullptr, void* watcherCtx = nullptr);
+
+    // 获取指定 path 的结点的所有子结点名称，结点不存在时返回空数组。watcher 不为空时在子结点变化时回调一次
+    // pResult 不为空时存放 zookeeper 的返回码，用来区分结点不存在（ZNONODE）和连接出错
+    std::vector<std::string> GetChildren(const char* path, watcher_fn watcher = nullptr, void* watcherCtx = nullptr, int* pResult = nullptr);
 
 private:
+    friend void watcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx);
+
+    sem_t m_isReady;                  // Start 等待第一次连接成功
+    std::atomic<bool> m_expired{false};
+    StateCallback m_onState;
+
     std::function<void(zhandle_t*)> deleter = [](zhandle_t* p){ if (p) zookeeper_close(p); };
     std::unique_ptr<zhandle_t, decltype(deleter)> m_zhandle;//zookeeper的客户端句柄 
 };
\ No newline at end of file
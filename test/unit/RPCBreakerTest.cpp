@@ -0,0 +1,190 @@
+#include "UnitTest.h"
+#include "RPCApplication.h"
+#include "RPCConnectionsPool.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+// 熔断器只看 AllowRequest / ReportResult / IsAvailable，不需要真的连接主机，每个用例用不同的端口
+static const char* kIp = "127.0.0.1";
+static const int kOpenMs = 100;
+
+static void SleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static void Fail(uint16_t port, int times = 1)
+{
+    for (int i = 0; i < times; ++i)
+    {
+        RPCConnectionsPool::GetInstance()->ReportResult(kIp, port, "", false, 0);
+    }
+}
+
+static void Succeed(uint16_t port)
+{
+    RPCConnectionsPool::GetInstance()->ReportResult(kIp, port, "", true, 0);
+}
+
+static bool Allow(uint16_t port)
+{
+    return RPCConnectionsPool::GetInstance()->AllowRequest(kIp, port);
+}
+
+static bool Available(uint16_t port)
+{
+    return RPCConnectionsPool::GetInstance()->IsAvailable(std::string(kIp) + ":" + std::to_string(port));
+}
+
+// 连续失败达到阈值时打开，打开期间拒绝调用，注册中心选择实例时跳过
+static void TestConsecutiveFailuresTrip()
+{
+    uint16_t port = 10001;
+    EXPECT_TRUE(Allow(port));
+    Fail(port, 2);
+    EXPECT_TRUE(Allow(port));
+    EXPECT_TRUE(Available(port));
+
+    Fail(port);
+    EXPECT_FALSE(Allow(port));
+    EXPECT_FALSE(Available(port));
+    EXPECT_TRUE(Available(port + 1000)); // 其他主机不受影响
+}
+
+// 中间有一次成功时重新计数
+static void TestSuccessResetsFailures()
+{
+    uint16_t port = 10002;
+    Fail(port, 2);
+    Succeed(port);
+    Fail(port, 2);
+    EXPECT_TRUE(Allow(port));
+    Fail(port);
+    EXPECT_FALSE(Allow(port));
+}
+
+// 打开时间过后半开，只放行一个探测调用，探测成功后关闭
+static void TestHalfOpenProbeSucceeds()
+{
+    uint16_t port = 10003;
+    Fail(port, 3);
+    EXPECT_FALSE(Allow(port));
+
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(Available(port));
+    EXPECT_TRUE(Allow(port));  // 探测调用
+    EXPECT_FALSE(Allow(port)); // 探测结束之前不放行其他调用
+    EXPECT_FALSE(Available(port));
+
+    Succeed(port);
+    EXPECT_TRUE(Available(port));
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_TRUE(Allow(port));
+    }
+
+    // 关闭后重新开始计数，打开时间恢复成 breakerOpenMs
+    Fail(port, 3);
+    EXPECT_FALSE(Allow(port));
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(Allow(port));
+}
+
+// 探测失败时再次打开，打开时间翻倍
+static void TestHalfOpenProbeFails()
+{
+    uint16_t port = 10004;
+    Fail(port, 3);
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(Allow(port));
+    Fail(port); // 一次失败就重新打开，不需要达到连续失败的阈值
+
+    EXPECT_FALSE(Allow(port));
+    SleepMs(kOpenMs + 20); // 第一次的打开时间已经过了，翻倍之后还没有
+    EXPECT_FALSE(Allow(port));
+    EXPECT_FALSE(Available(port));
+    SleepMs(kOpenMs + 30);
+    EXPECT_TRUE(Available(port));
+    EXPECT_TRUE(Allow(port));
+}
+
+// 探测调用一直没有报告结果时，过一个打开时间再放行一个
+static void TestLostProbe()
+{
+    uint16_t port = 10005;
+    Fail(port, 3);
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(Allow(port));
+    EXPECT_FALSE(Allow(port));
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(Allow(port));
+    EXPECT_FALSE(Allow(port));
+}
+
+// 探测调用没有发出去时归还名额，下一个调用马上可以探测；只有真正放行了探测的调用拿到探测标记
+static void TestReleaseProbe()
+{
+    uint16_t port = 10007;
+    RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+    bool probe = true;
+    EXPECT_TRUE(pPool->AllowRequest(kIp, port, &probe));
+    EXPECT_FALSE(probe); // 熔断器关闭，不是探测调用
+
+    Fail(port, 3);
+    SleepMs(kOpenMs + 50);
+    EXPECT_TRUE(pPool->AllowRequest(kIp, port, &probe));
+    EXPECT_TRUE(probe);
+    EXPECT_FALSE(Allow(port));
+
+    pPool->ReleaseProbe(kIp, port);
+    EXPECT_TRUE(pPool->AllowRequest(kIp, port, &probe)); // 不用等一个打开时间
+    EXPECT_TRUE(probe);
+    Fail(port);
+
+    pPool->ReleaseProbe(kIp, port); // 探测失败已经重新打开，归还不会放行调用
+    EXPECT_FALSE(Allow(port));
+}
+
+// 窗口内调用数足够、失败率达到 breakerErrorRate 时打开，即使没有连续失败
+static void TestErrorRateTrip()
+{
+    uint16_t port = 10006;
+    for (int i = 0; i < 19; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            Succeed(port);
+        }
+        else
+        {
+            Fail(port);
+        }
+    }
+    EXPECT_TRUE(Allow(port)); // 19 次调用，不到最少的 20 次
+    Fail(port);              // 20 次调用里 10 次失败
+    EXPECT_FALSE(Allow(port));
+}
+
+int main()
+{
+    std::string path = WriteTempConfig("breakerConsecutiveFailures = 3\n"
+                                       "breakerErrorRate = 0.5\n"
+                                       "breakerOpenMs = " + std::to_string(kOpenMs) + "\n"
+                                       "outlierLatencyFactor = 0\n");
+    char prog[] = "RPCBreakerTest";
+    char option[] = "-i";
+    char* argv[] = {prog, option, &path[0], nullptr};
+    RPCApplication::Init(3, argv);
+    unlink(path.c_str());
+
+    TestConsecutiveFailuresTrip();
+    TestSuccessResetsFailures();
+    TestHalfOpenProbeSucceeds();
+    TestHalfOpenProbeFails();
+    TestLostProbe();
+    TestReleaseProbe();
+    TestErrorRateTrip();
+    return UNIT_TEST_RESULT();
+}
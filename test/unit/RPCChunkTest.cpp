@@ -0,0 +1,160 @@
+#include "UnitTest.h"
+#include "RPCChunk.h"
+#include "RPCCodec.h"
+#include "Header.pb.h"
+#include "Response.pb.h"
+#include "Buffer.h"
+
+#include <string>
+#include <vector>
+
+static const size_t kChunkSize = 1000;
+
+// 一个序列化之后明显超过 kChunkSize 的消息
+static MyRPC::RPCResponseWrapper MakeLargeMessage()
+{
+    MyRPC::RPCResponseWrapper wrapper;
+    wrapper.set_success(true);
+    wrapper.set_stream_id(7);
+    std::string data(10 * kChunkSize + 123, '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<char>(i * 131);
+    }
+    wrapper.set_data(data);
+    return wrapper;
+}
+
+// 把缓冲区里的帧全部取出，参数按顺序放进 chunks
+static std::vector<RPCRequestHeader> ParseAll(const std::string& stream, std::vector<std::string>* chunks)
+{
+    Buffer buffer;
+    buffer.append(stream.data(), stream.size());
+
+    std::vector<RPCRequestHeader> headers;
+    RPCRequestHeader header;
+    std::string argv;
+    while (RPCCodec::ParseRequestFrame(&buffer, &header, &argv) == RPCCodec::kFrameOk)
+    {
+        headers.push_back(header);
+        chunks->push_back(argv);
+    }
+    EXPECT_EQ(buffer.readableBytes(), 0u);
+    return headers;
+}
+
+// 两种格式的请求按 kChunkSize 分块之后，序号连续，只有最后一块没有 moreChunks，
+// 服务名、方法名和调用链只在第 0 块里，分块重组之后和原来的消息一致
+static void TestRequestChunks()
+{
+    MyRPC::RPCResponseWrapper message = MakeLargeMessage();
+    std::string requestStr;
+    EXPECT_TRUE(message.SerializeToString(&requestStr));
+    size_t chunkCnt = (requestStr.size() + kChunkSize - 1) / kChunkSize;
+
+    for (int binary = 0; binary < 2; ++binary)
+    {
+        std::string stream;
+        if (binary)
+        {
+            RPCRequestHeader header;
+            header.m_serviceName = "FriendServiceRpc";
+            header.m_methodName = "GetFriendsList";
+            header.m_streamId = 99;
+            header.m_trace.m_traceId = 1;
+            header.m_trace.m_spanId = 2;
+            header.m_trace.m_sampled = true;
+            EXPECT_TRUE(RPCCodec::PackBinaryRequest(header, requestStr, kChunkSize, &stream));
+        }
+        else
+        {
+            MyRPC::RpcHeader header;
+            header.set_servicename("FriendServiceRpc");
+            header.set_methodname("GetFriendsList");
+            header.set_streamid(99);
+            header.set_traceid(1);
+            header.set_spanid(2);
+            header.set_sampled(true);
+            EXPECT_TRUE(RPCCodec::PackRequest(header, requestStr, kChunkSize, &stream));
+        }
+
+        std::vector<std::string> chunks;
+        std::vector<RPCRequestHeader> headers = ParseAll(stream, &chunks);
+        EXPECT_EQ(headers.size(), chunkCnt);
+        for (size_t i = 0; i < headers.size(); ++i)
+        {
+            bool first = (i == 0);
+            EXPECT_EQ(headers[i].m_chunkSeq, i);
+            EXPECT_EQ(headers[i].m_moreChunks, i + 1 < chunkCnt);
+            EXPECT_EQ(headers[i].m_streamId, 99u);
+            EXPECT_EQ(headers[i].m_serviceName, first ? "FriendServiceRpc" : "");
+            EXPECT_EQ(headers[i].m_methodName, first ? "GetFriendsList" : "");
+            EXPECT_EQ(headers[i].m_trace.m_traceId, first ? 1u : 0u);
+            EXPECT_EQ(headers[i].m_trace.m_sampled, first);
+            EXPECT_TRUE(chunks[i].size() <= kChunkSize);
+        }
+
+        MyRPC::RPCResponseWrapper parsed;
+        EXPECT_TRUE(RPCChunk::ParseFromChunks(chunks, &parsed));
+        EXPECT_EQ(parsed.stream_id(), message.stream_id());
+        EXPECT_EQ(parsed.data(), message.data());
+
+        // 缺了最后一块，data 字段不完整，不能解析成功
+        chunks.pop_back();
+        EXPECT_FALSE(RPCChunk::ParseFromChunks(chunks, &parsed));
+    }
+}
+
+// 不超过 kChunkSize 的请求只有一帧，空参数也占一帧
+static void TestSingleChunk()
+{
+    std::vector<std::string> chunks;
+    std::string stream;
+    RPCRequestHeader header;
+    header.m_serviceName = "UserServiceRpc";
+    header.m_methodName = "Login";
+    EXPECT_TRUE(RPCCodec::PackBinaryRequest(header, std::string(kChunkSize, 'x'), kChunkSize, &stream));
+    EXPECT_TRUE(RPCCodec::PackBinaryRequest(header, "", kChunkSize, &stream));
+
+    std::vector<RPCRequestHeader> headers = ParseAll(stream, &chunks);
+    EXPECT_EQ(headers.size(), 2u);
+    EXPECT_FALSE(headers[0].m_moreChunks);
+    EXPECT_FALSE(headers[1].m_moreChunks);
+    EXPECT_EQ(chunks[0].size(), kChunkSize);
+    EXPECT_TRUE(chunks[1].empty());
+}
+
+// 分块的边界落在任意位置都能解析，包括落在 varint 和字段头中间
+static void TestParseFromUnevenChunks()
+{
+    MyRPC::RPCResponseWrapper message = MakeLargeMessage();
+    std::string serialized;
+    EXPECT_TRUE(message.SerializeToString(&serialized));
+
+    for (size_t step = 1; step <= 7; ++step)
+    {
+        std::vector<std::string> chunks;
+        for (size_t offset = 0; offset < serialized.size(); offset += step * 997)
+        {
+            chunks.push_back(serialized.substr(offset, step * 997));
+        }
+        chunks.insert(chunks.begin() + 1, std::string()); // 空分块不影响结果
+
+        MyRPC::RPCResponseWrapper parsed;
+        EXPECT_TRUE(RPCChunk::ParseFromChunks(chunks, &parsed));
+        EXPECT_EQ(parsed.data(), message.data());
+    }
+
+    std::vector<std::string> splitHeader = {serialized.substr(0, 3), serialized.substr(3)};
+    MyRPC::RPCResponseWrapper parsed;
+    EXPECT_TRUE(RPCChunk::ParseFromChunks(splitHeader, &parsed));
+    EXPECT_EQ(parsed.data(), message.data());
+}
+
+int main()
+{
+    TestRequestChunks();
+    TestSingleChunk();
+    TestParseFromUnevenChunks();
+    return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,319 @@
+#include "UnitTest.h"
+#include "RPCCodec.h"
+#include "Header.pb.h"
+#include "Response.pb.h"
+#include "Buffer.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const size_t kNoChunk = 1024 * 1024; // 大于测试里所有参数的分块大小，不分块
+
+static RPCRequestHeader MakeHeader()
+{
+    RPCRequestHeader header;
+    header.m_serviceName = "UserServiceRpc";
+    header.m_methodName = "Login";
+    header.m_streamId = 0x0102030405060708ULL;
+    header.m_trace.m_traceId = 0x1111222233334444ULL;
+    header.m_trace.m_spanId = 0x5555666677778888ULL;
+    header.m_trace.m_parentSpanId = 42;
+    header.m_trace.m_sampled = true;
+    return header;
+}
+
+static std::string PackLegacy(const RPCRequestHeader& header, const std::string& argv)
+{
+    MyRPC::RpcHeader rpcHeader;
+    rpcHeader.set_servicename(header.m_serviceName);
+    rpcHeader.set_methodname(header.m_methodName);
+    rpcHeader.set_streamid(header.m_streamId);
+    rpcHeader.set_heartbeat(header.m_heartbeat);
+    rpcHeader.set_traceid(header.m_trace.m_traceId);
+    rpcHeader.set_spanid(header.m_trace.m_spanId);
+    rpcHeader.set_parentspanid(header.m_trace.m_parentSpanId);
+    rpcHeader.set_sampled(header.m_trace.m_sampled);
+    std::string frame;
+    EXPECT_TRUE(RPCCodec::PackRequest(rpcHeader, argv, kNoChunk, &frame));
+    return frame;
+}
+
+static std::string PackBinary(const RPCRequestHeader& header, const std::string& argv)
+{
+    std::string frame;
+    EXPECT_TRUE(RPCCodec::PackBinaryRequest(header, argv, kNoChunk, &frame));
+    return frame;
+}
+
+static void ExpectSameHeader(const RPCRequestHeader& a, const RPCRequestHeader& b)
+{
+    EXPECT_EQ(a.m_serviceName, b.m_serviceName);
+    EXPECT_EQ(a.m_methodName, b.m_methodName);
+    EXPECT_EQ(a.m_streamId, b.m_streamId);
+    EXPECT_EQ(a.m_chunkSeq, b.m_chunkSeq);
+    EXPECT_EQ(a.m_moreChunks, b.m_moreChunks);
+    EXPECT_EQ(a.m_heartbeat, b.m_heartbeat);
+    EXPECT_EQ(a.m_trace.m_traceId, b.m_trace.m_traceId);
+    EXPECT_EQ(a.m_trace.m_spanId, b.m_trace.m_spanId);
+    EXPECT_EQ(a.m_trace.m_parentSpanId, b.m_trace.m_parentSpanId);
+    EXPECT_EQ(a.m_trace.m_sampled, b.m_trace.m_sampled);
+}
+
+// 两种格式编码之后都能原样解出请求头和参数
+static void TestRoundTrip()
+{
+    RPCRequestHeader header = MakeHeader();
+    std::string argv("\x00\x01 binary-safe \xff", 16);
+
+    for (int binary = 0; binary < 2; ++binary)
+    {
+        std::string frame = binary ? PackBinary(header, argv) : PackLegacy(header, argv);
+        Buffer buffer;
+        buffer.append(frame.data(), frame.size());
+        EXPECT_EQ(RPCCodec::PendingFrameSize(&buffer), frame.size());
+
+        RPCRequestHeader parsed;
+        std::string parsedArgv;
+        EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &parsedArgv), RPCCodec::kFrameOk);
+        ExpectSameHeader(header, parsed);
+        EXPECT_EQ(parsedArgv, argv);
+        EXPECT_EQ(buffer.readableBytes(), 0u);
+    }
+}
+
+// 心跳帧没有参数，没有开启追踪时二进制头部不携带调用链扩展
+static void TestHeartbeatWithoutTrace()
+{
+    RPCRequestHeader header;
+    header.m_heartbeat = true;
+
+    std::string frame = PackBinary(header, "");
+    EXPECT_EQ(frame.size(), RPCCodec::kFixedHeaderSize);
+
+    Buffer buffer;
+    buffer.append(frame.data(), frame.size());
+    RPCRequestHeader parsed = MakeHeader(); // 复用的对象里残留的调用链要被清掉
+    std::string argv("stale");
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    ExpectSameHeader(header, parsed);
+    EXPECT_TRUE(argv.empty());
+}
+
+// 同一个缓冲区里混着两种格式的帧，按顺序逐帧取出
+static void TestMixedFormats()
+{
+    RPCRequestHeader first = MakeHeader();
+    RPCRequestHeader second = MakeHeader();
+    second.m_methodName = "Register";
+    second.m_streamId = 0;
+    second.m_trace = RPCTraceContext();
+
+    std::string stream = PackLegacy(first, "one") + PackBinary(second, "two") + PackLegacy(second, "three");
+    Buffer buffer;
+    buffer.append(stream.data(), stream.size());
+
+    RPCRequestHeader parsed;
+    std::string argv;
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    ExpectSameHeader(first, parsed);
+    EXPECT_EQ(argv, "one");
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    ExpectSameHeader(second, parsed);
+    EXPECT_EQ(argv, "two");
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    ExpectSameHeader(second, parsed);
+    EXPECT_EQ(argv, "three");
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameIncomplete);
+}
+
+// 帧逐字节到达：收齐之前不消费缓冲区，长度字段到达之后就能知道整帧的大小
+static void TestIncompleteFrames()
+{
+    RPCRequestHeader header = MakeHeader();
+    for (int binary = 0; binary < 2; ++binary)
+    {
+        std::string frame = binary ? PackBinary(header, "payload") : PackLegacy(header, "payload");
+        size_t lengthBytes = binary ? 8 : 4; // 能读出帧长度所需的字节数
+
+        Buffer buffer;
+        RPCRequestHeader parsed;
+        std::string argv;
+        for (size_t i = 0; i + 1 < frame.size(); ++i)
+        {
+            buffer.append(frame.data() + i, 1);
+            EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameIncomplete);
+            EXPECT_EQ(buffer.readableBytes(), i + 1);
+            EXPECT_EQ(RPCCodec::PendingFrameSize(&buffer), i + 1 >= lengthBytes ? frame.size() : i + 1);
+        }
+        buffer.append(frame.data() + frame.size() - 1, 1);
+        EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+        EXPECT_EQ(argv, "payload");
+    }
+}
+
+// 版本号不认识、长度字段和内容对不上时只丢弃这一帧，后面的帧照常解析
+static void TestBadHeaderDropsOneFrame()
+{
+    RPCRequestHeader header = MakeHeader();
+    std::string bad = PackBinary(header, "bad");
+    bad[2] = static_cast<char>(RPCCodec::kVersion + 1);
+    std::string badLength = PackBinary(header, "bad");
+    badLength[31] = static_cast<char>(badLength[31] + 1); // payloadSize 比实际多 1
+    std::string stream = bad + badLength + PackBinary(header, "good");
+
+    Buffer buffer;
+    buffer.append(stream.data(), stream.size());
+    RPCRequestHeader parsed;
+    std::string argv;
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kBadHeader);
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kBadHeader);
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    EXPECT_EQ(argv, "good");
+}
+
+// 不认识的扩展直接跳过
+static void TestUnknownExtensionSkipped()
+{
+    RPCRequestHeader header = MakeHeader();
+    std::string frame = PackBinary(header, "argv");
+    size_t extOffset = RPCCodec::kFixedHeaderSize + header.m_serviceName.size() + header.m_methodName.size();
+    frame[extOffset] = 0x7f; // type 改成 0x7f01
+
+    Buffer buffer;
+    buffer.append(frame.data(), frame.size());
+    RPCRequestHeader parsed;
+    std::string argv;
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv), RPCCodec::kFrameOk);
+    EXPECT_EQ(parsed.m_trace.m_traceId, 0u);
+    EXPECT_TRUE(parsed.m_trace.m_sampled); // 采样标志在固定头部里
+    EXPECT_EQ(argv, "argv");
+}
+
+// 帧长度超过上限时不等待收齐，直接报告
+static void TestFrameTooLarge()
+{
+    std::string binary = PackBinary(MakeHeader(), "argv");
+    binary[4] = 0x04; // frameSize = 0x04xxxxxx，超过 64MB
+    Buffer binaryBuffer;
+    binaryBuffer.append(binary.data(), binary.size());
+
+    std::string legacy("\x04\x00\x00\x00\x00", 5); // 长度前缀为 64MB
+    Buffer legacyBuffer;
+    legacyBuffer.append(legacy.data(), legacy.size());
+
+    RPCRequestHeader parsed;
+    std::string argv;
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&binaryBuffer, &parsed, &argv), RPCCodec::kFrameTooLarge);
+    EXPECT_EQ(RPCCodec::ParseRequestFrame(&legacyBuffer, &parsed, &argv), RPCCodec::kFrameTooLarge);
+}
+
+// 响应帧是 4 字节大端长度前缀加上 wrapper
+static void TestResponseFrame()
+{
+    std::string frame("prefix");
+    RPCCodec::AppendResponseFrame("wrapper", &frame);
+    EXPECT_EQ(frame, std::string("prefix\x00\x00\x00\x07wrapper", 17));
+}
+
+// EncodeRequest 按 chunkSize 分块，两种格式切出来的分块拼起来就是序列化后的参数，只有第 0 块带服务名
+static void TestEncodeRequestChunks()
+{
+    MyRPC::RPCResponseWrapper request; // 任意一个 protobuf 消息都可以作为参数
+    request.set_data(std::string(1000, 'x'));
+    std::string requestStr = request.SerializeAsString();
+
+    for (bool binary : {false, true})
+    {
+        std::string frames;
+        size_t requestSize = 0;
+        EXPECT_EQ(RPCCodec::EncodeRequest(MakeHeader(), request, binary, 300, 1 << 20, &frames, &requestSize), RPCCodec::kEncodeOk);
+        EXPECT_EQ(requestSize, requestStr.size());
+
+        Buffer buffer;
+        buffer.append(frames.data(), frames.size());
+        RPCRequestHeader parsed;
+        std::string argv;
+        std::string joined;
+        uint32_t chunks = 0;
+        while (RPCCodec::ParseRequestFrame(&buffer, &parsed, &argv) == RPCCodec::kFrameOk)
+        {
+            EXPECT_EQ(parsed.m_chunkSeq, chunks);
+            EXPECT_EQ(parsed.m_serviceName, chunks == 0 ? std::string("UserServiceRpc") : std::string());
+            EXPECT_EQ(parsed.m_streamId, MakeHeader().m_streamId);
+            EXPECT_TRUE(argv.size() <= 300);
+            joined += argv;
+            ++chunks;
+            if (!parsed.m_moreChunks)
+            {
+                break;
+            }
+        }
+        EXPECT_EQ(chunks, (requestStr.size() + 299) / 300);
+        EXPECT_EQ(joined, requestStr);
+        EXPECT_EQ(buffer.readableBytes(), 0u);
+    }
+
+    std::string frames;
+    EXPECT_EQ(RPCCodec::EncodeRequest(MakeHeader(), request, true, 300, 999, &frames), RPCCodec::kMessageTooLarge);
+    EXPECT_TRUE(frames.empty());
+}
+
+// EncodeResponse 按 chunkSize 分块，除最后一帧外都设置 more_chunks，每一帧都带流 ID
+static void TestEncodeResponseChunks()
+{
+    MyRPC::RPCResponseWrapper response;
+    response.set_data(std::string(1000, 'y'));
+    std::string responseStr = response.SerializeAsString();
+
+    std::string frames;
+    size_t dataSize = 0;
+    EXPECT_TRUE(RPCCodec::EncodeResponse(response, 7, true, 300, &frames, &dataSize));
+    EXPECT_EQ(dataSize, responseStr.size());
+
+    std::vector<MyRPC::RPCResponseWrapper> wrappers;
+    size_t offset = 0;
+    while (offset + 4 <= frames.size())
+    {
+        uint32_t len = 0;
+        memcpy(&len, frames.data() + offset, 4);
+        len = ntohl(len);
+        wrappers.emplace_back();
+        EXPECT_TRUE(wrappers.back().ParseFromArray(frames.data() + offset + 4, len));
+        offset += 4 + len;
+    }
+    EXPECT_EQ(offset, frames.size());
+    EXPECT_EQ(wrappers.size(), (responseStr.size() + 299) / 300);
+
+    std::string joined;
+    for (size_t i = 0; i < wrappers.size(); ++i)
+    {
+        EXPECT_TRUE(wrappers[i].success());
+        EXPECT_EQ(wrappers[i].stream_id(), 7u);
+        EXPECT_TRUE(wrappers[i].end_of_stream());
+        EXPECT_EQ(wrappers[i].more_chunks(), i + 1 < wrappers.size());
+        joined += wrappers[i].data();
+    }
+    EXPECT_EQ(joined, responseStr);
+
+    // 空响应也要发出一帧
+    frames.clear();
+    EXPECT_TRUE(RPCCodec::EncodeResponse(MyRPC::RPCResponseWrapper(), 0, false, 300, &frames));
+    EXPECT_FALSE(frames.empty());
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestHeartbeatWithoutTrace();
+    TestMixedFormats();
+    TestIncompleteFrames();
+    TestBadHeaderDropsOneFrame();
+    TestUnknownExtensionSkipped();
+    TestFrameTooLarge();
+    TestResponseFrame();
+    TestEncodeRequestChunks();
+    TestEncodeResponseChunks();
+    return UNIT_TEST_RESULT();
+}
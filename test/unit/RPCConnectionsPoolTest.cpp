@@ -0,0 +1,81 @@
+#include "UnitTest.h"
+#include "RPCApplication.h"
+#include "RPCConnectionsPool.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 只接受连接、从不回复的服务端，心跳一定超时
+static int Listen(uint16_t* port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+    {
+        std::fprintf(stderr, "listen failed\n");
+        std::exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// 清理线程给空闲连接发送心跳的时候，连接留在池里占着名额。
+// 主机的连接数达到上限时 GetConnection 等心跳结束，不能直接返回空
+static void TestGetConnectionDuringHeartbeat()
+{
+    uint16_t port = 0;
+    int listenFd = Listen(&port);
+    std::thread acceptor([listenFd]()
+    {
+        std::vector<int> fds;
+        int fd = 0;
+        while ((fd = accept(listenFd, nullptr, nullptr)) >= 0)
+        {
+            fds.push_back(fd); // 不读也不回复
+        }
+    });
+    acceptor.detach();
+
+    RPCConnectionsPool* pPool = RPCConnectionsPool::GetInstance();
+    pPool->SetMaxConnectionsPerHost(1);
+
+    auto pConn = pPool->GetConnection("127.0.0.1", port);
+    EXPECT_TRUE(pConn != nullptr);
+    EXPECT_TRUE(pPool->GetConnection("127.0.0.1", port) == nullptr); // 唯一的名额正在使用
+    pPool->ReturnConnection(std::move(pConn));
+
+    // 清理线程每秒一轮，空闲满 1 秒之后的一两轮之内开始发送心跳，心跳 3 秒之后超时。2.5 秒时连接一定正在检查
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    auto start = std::chrono::steady_clock::now();
+    pConn = pPool->GetConnection("127.0.0.1", port);
+    auto waited = std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(pConn != nullptr); // 心跳超时的连接被关闭，名额空出来之后建立了新的连接
+    EXPECT_TRUE(waited > std::chrono::milliseconds(500));
+    EXPECT_TRUE(waited < std::chrono::milliseconds(3100));
+    pPool->ReturnConnection(std::move(pConn));
+}
+
+int main()
+{
+    std::string path = WriteTempConfig("heartbeatInterval = 1\n"
+                                       "heartbeatTimeout = 3000\n");
+    char prog[] = "RPCConnectionsPoolTest";
+    char option[] = "-i";
+    char* argv[] = {prog, option, &path[0], nullptr};
+    RPCApplication::Init(3, argv);
+    unlink(path.c_str());
+
+    TestGetConnectionDuringHeartbeat();
+    return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,56 @@
+#include "UnitTest.h"
+#include "RPCRegistry.h"
+
+#include <string>
+
+static bool Parse(const std::string& endpoint, std::string* ip = nullptr, uint16_t* port = nullptr)
+{
+    std::string parsedIp;
+    uint16_t parsedPort = 0;
+    bool ok = RPCRegistry::ParseEndpoint(endpoint, &parsedIp, &parsedPort);
+    if (ip != nullptr)
+    {
+        *ip = parsedIp;
+    }
+    if (port != nullptr)
+    {
+        *port = parsedPort;
+    }
+    return ok;
+}
+
+static void TestValid()
+{
+    std::string ip;
+    uint16_t port = 0;
+    EXPECT_TRUE(Parse("10.0.0.1:8000", &ip, &port));
+    EXPECT_EQ(ip, "10.0.0.1");
+    EXPECT_EQ(port, 8000);
+
+    EXPECT_TRUE(Parse("localhost:65535", &ip, &port));
+    EXPECT_EQ(ip, "localhost");
+    EXPECT_EQ(port, 65535);
+}
+
+// 注册中心里的地址来自其他进程写的清单，格式不对时只能拒绝，不能抛异常
+static void TestInvalid()
+{
+    EXPECT_FALSE(Parse(""));
+    EXPECT_FALSE(Parse("10.0.0.1"));
+    EXPECT_FALSE(Parse("10.0.0.1:"));
+    EXPECT_FALSE(Parse(":8000"));
+    EXPECT_FALSE(Parse("10.0.0.1:abc"));
+    EXPECT_FALSE(Parse("10.0.0.1:80x"));
+    EXPECT_FALSE(Parse("10.0.0.1:-1"));
+    EXPECT_FALSE(Parse("10.0.0.1: 80"));
+    EXPECT_FALSE(Parse("10.0.0.1:0"));
+    EXPECT_FALSE(Parse("10.0.0.1:65536"));
+    EXPECT_FALSE(Parse("10.0.0.1:99999999999999999999999"));
+}
+
+int main()
+{
+    TestValid();
+    TestInvalid();
+    return UNIT_TEST_RESULT();
+}
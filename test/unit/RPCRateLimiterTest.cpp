@@ -0,0 +1,155 @@
+#include "UnitTest.h"
+#include "RPCRateLimiter.h"
+#include "RPCConfig.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// 用 content 里的配置项替换限流规则
+static void Apply(const std::string& content)
+{
+    std::string path = WriteTempConfig(content);
+    RPCConfig config;
+    EXPECT_TRUE(config.TryLoadConfigFile(path));
+    unlink(path.c_str());
+    RPCRateLimiter::GetInstance()->Apply(config);
+}
+
+static bool Admit(const std::string& service, const std::string& method, size_t peerSlot = 0)
+{
+    return RPCRateLimiter::GetInstance()->Admit(service, method, peerSlot);
+}
+
+// 方法的合计限制：攒满的令牌用完之后拒绝，和客户端无关
+static void TestTotalLimit()
+{
+    Apply("rateLimit.Svc.Total = 1,2\n");
+    EXPECT_TRUE(Admit("Svc", "Total", 1));
+    EXPECT_TRUE(Admit("Svc", "Total", 2));
+    EXPECT_FALSE(Admit("Svc", "Total", 3));
+    EXPECT_FALSE(Admit("Svc", "Total", 1));
+
+    // 没有配置的方法和服务不受限制
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(Admit("Svc", "Other"));
+        EXPECT_TRUE(Admit("OtherSvc", "Total"));
+    }
+}
+
+// 按 IP 的限制：每个桶单独计数，桶号超过桶数时取模
+static void TestPerIpLimit()
+{
+    Apply("rateLimitPerIp.Svc.PerIp = 1,1\n");
+    EXPECT_TRUE(Admit("Svc", "PerIp", 1));
+    EXPECT_FALSE(Admit("Svc", "PerIp", 1));
+    EXPECT_TRUE(Admit("Svc", "PerIp", 2));
+    EXPECT_FALSE(Admit("Svc", "PerIp", 2));
+    EXPECT_FALSE(Admit("Svc", "PerIp", 1 + 1024));
+    EXPECT_TRUE(Admit("Svc", "Other", 1));
+}
+
+// 每个 IP 所有方法合计的限制
+static void TestGlobalPerIpLimit()
+{
+    Apply("rateLimitPerIp = 1,2\n");
+    EXPECT_TRUE(Admit("Svc", "A", 5));
+    EXPECT_TRUE(Admit("OtherSvc", "B", 5));
+    EXPECT_FALSE(Admit("Svc", "C", 5));
+    EXPECT_TRUE(Admit("Svc", "C", 6));
+}
+
+// 令牌按每秒调用数恢复，攒下的令牌不超过突发调用数
+static void TestRefill()
+{
+    Apply("rateLimit.Svc.Fast = 20,1\n"); // 每 50ms 一个令牌
+    EXPECT_TRUE(Admit("Svc", "Fast"));
+    EXPECT_FALSE(Admit("Svc", "Fast"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_TRUE(Admit("Svc", "Fast"));
+    EXPECT_FALSE(Admit("Svc", "Fast")); // 空闲再久也只攒 1 个
+}
+
+// 重新应用配置时换上新的桶，新桶是满的
+static void TestReapplyRefills()
+{
+    Apply("rateLimit.Svc.Total = 1,1\n");
+    EXPECT_TRUE(Admit("Svc", "Total"));
+    EXPECT_FALSE(Admit("Svc", "Total"));
+
+    Apply("rateLimit.Svc.Total = 1,1\n");
+    EXPECT_TRUE(Admit("Svc", "Total"));
+}
+
+// 其他线程缓存的规则表在重新应用配置之后换成新表
+static void TestReapplySeenByOtherThread()
+{
+    Apply("rateLimit.Svc.Total = 1,1\n");
+    int step = 0;
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool results[3] = {false, false, false};
+    std::thread worker([&]()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        results[0] = Admit("Svc", "Total"); // 缓存旧表，取走唯一的令牌
+        results[1] = Admit("Svc", "Total");
+        step = 1;
+        cond.notify_all();
+        cond.wait(lock, [&]() { return step == 2; });
+        results[2] = Admit("Svc", "Total"); // 新表的桶是满的
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait(lock, [&]() { return step == 1; });
+        Apply("rateLimit.Svc.Total = 1,1\n");
+        step = 2;
+        cond.notify_all();
+    }
+    worker.join();
+    EXPECT_TRUE(results[0]);
+    EXPECT_FALSE(results[1]);
+    EXPECT_TRUE(results[2]);
+}
+
+// 没有配置、配置为 0 或者非法时不限制
+static void TestUnlimited()
+{
+    Apply("rateLimit.Svc.Total = 1,1\n");
+    EXPECT_TRUE(Admit("Svc", "Total"));
+    Apply("");
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(Admit("Svc", "Total"));
+    }
+
+    Apply("rateLimit.Svc.Zero = 0\n"
+          "rateLimit.Svc.Bad = abc\n"
+          "rateLimit.NoMethod = 1,1\n"
+          "rateLimitPerIp.Svc. = 1,1\n"
+          "rateLimitPerIp = 0\n");
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(Admit("Svc", "Zero"));
+        EXPECT_TRUE(Admit("Svc", "Bad"));
+        EXPECT_TRUE(Admit("NoMethod", ""));
+        EXPECT_TRUE(Admit("Svc", ""));
+    }
+}
+
+int main()
+{
+    TestTotalLimit();
+    TestPerIpLimit();
+    TestGlobalPerIpLimit();
+    TestRefill();
+    TestReapplyRefills();
+    TestReapplySeenByOtherThread();
+    TestUnlimited();
+    return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,100 @@
+#include "UnitTest.h"
+#include "RPCRetryBudget.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// 初始是满的，取完之后拒绝重试
+static void TestStartsFull()
+{
+    RPCRetryBudget budget(0.1, 10);
+    EXPECT_EQ(budget.Tokens(), 10 * RPCRetryBudget::kTokenUnit);
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_TRUE(budget.Withdraw());
+    }
+    EXPECT_FALSE(budget.Withdraw());
+    EXPECT_EQ(budget.Tokens(), 0);
+}
+
+// ratio 为 0.1 时每 10 次调用攒下一个令牌
+static void TestDepositByRatio()
+{
+    RPCRetryBudget budget(0.1, 10);
+    while (budget.Withdraw())
+    {
+    }
+
+    for (int i = 0; i < 9; ++i)
+    {
+        budget.Deposit();
+    }
+    EXPECT_FALSE(budget.Withdraw());
+    budget.Deposit();
+    EXPECT_TRUE(budget.Withdraw());
+    EXPECT_FALSE(budget.Withdraw());
+}
+
+// 攒下的令牌不超过上限
+static void TestCap()
+{
+    RPCRetryBudget budget(0.5, 2);
+    for (int i = 0; i < 100; ++i)
+    {
+        budget.Deposit();
+    }
+    EXPECT_EQ(budget.Tokens(), 2 * RPCRetryBudget::kTokenUnit);
+
+    EXPECT_TRUE(budget.Withdraw());
+    budget.Deposit();
+    budget.Deposit();
+    budget.Deposit();
+    EXPECT_EQ(budget.Tokens(), 2 * RPCRetryBudget::kTokenUnit);
+}
+
+// ratio 为 0 时取完就不再重试
+static void TestZeroRatio()
+{
+    RPCRetryBudget budget(0, 1);
+    EXPECT_TRUE(budget.Withdraw());
+    for (int i = 0; i < 1000; ++i)
+    {
+        budget.Deposit();
+    }
+    EXPECT_FALSE(budget.Withdraw());
+}
+
+// 多个线程同时取令牌，取出的总数不超过攒下的令牌
+static void TestConcurrent()
+{
+    RPCRetryBudget budget(1, 1000);
+    std::atomic<int> withdrawn(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                withdrawn += budget.Withdraw() ? 1 : 0;
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(withdrawn.load(), 1000);
+    EXPECT_EQ(budget.Tokens(), 0);
+}
+
+int main()
+{
+    TestStartsFull();
+    TestDepositByRatio();
+    TestCap();
+    TestZeroRatio();
+    TestConcurrent();
+    return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,152 @@
+#include "UnitTest.h"
+#include "RPCApplication.h"
+#include "RPCProvider.h"
+#include "RPCChannel.h"
+#include "RPCController.h"
+#include "RPCMemoryBudget.h"
+#include "bench.pb.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+static const int kFrames = 1024;
+static const size_t kFrameBytes = 16 * 1024; // 一共 16MB，远大于连接的缓存上限 1MB
+
+// 借用压测的 EchoService，Echo 按流式调用逐帧返回 kFrames 帧，记录发送期间进程缓存的响应最多有多少
+class StreamingService : public RPCBench::EchoServiceRpc
+{
+public:
+    std::atomic<uint64_t> m_peakOutput{0};
+    std::atomic<int> m_written{0};
+
+    void Echo(google::protobuf::RpcController* controller, const RPCBench::EchoRequest*,
+              RPCBench::EchoResponse*, google::protobuf::Closure* done) override
+    {
+        RPCController* pController = dynamic_cast<RPCController*>(controller);
+        RPCBench::EchoResponse frame;
+        frame.set_payload(std::string(kFrameBytes, 'x'));
+        for (int i = 0; i < kFrames && pController->Write(frame); ++i)
+        {
+            ++m_written;
+            uint64_t output = RPCMemoryBudget::GetInstance()->Used(RPCMemoryBudget::kOutput);
+            if (output > m_peakOutput.load())
+            {
+                m_peakOutput.store(output);
+            }
+        }
+        done->Run();
+    }
+};
+
+static uint16_t FreePort()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+    {
+        std::fprintf(stderr, "bind failed\n");
+        std::exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static bool WaitForListen(uint16_t port)
+{
+    for (int i = 0; i < 500; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        if (ok)
+        {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// 流的总长度超过 maxConnectionMemoryMB 时仍然完整发完：Write 等发送缓冲区清空再继续，服务端缓存的响应不超过一个分块加一条消息
+static void TestStreamLargerThanConnectionLimit(uint16_t port, StreamingService* pService)
+{
+    RPCChannel channel("127.0.0.1:" + std::to_string(port));
+    RPCController controller;
+    RPCBench::EchoRequest request;
+    const google::protobuf::MethodDescriptor* pMethod = RPCBench::EchoServiceRpc::descriptor()->FindMethodByName("Echo");
+
+    auto reader = channel.CallStream(pMethod, &controller, &request);
+    EXPECT_TRUE(reader != nullptr);
+    if (reader == nullptr)
+    {
+        return;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // 客户端先不读，服务端的发送缓冲区和内核缓冲区都会堆满
+    RPCBench::EchoResponse frame;
+    int frames = 0;
+    size_t bytes = 0;
+    while (reader->Read(&frame))
+    {
+        ++frames;
+        bytes += frame.payload().size();
+    }
+    EXPECT_TRUE(reader->Finish(nullptr));
+    EXPECT_FALSE(controller.Failed());
+    EXPECT_EQ(frames, kFrames);
+    EXPECT_EQ(bytes, kFrames * kFrameBytes);
+    EXPECT_EQ(pService->m_written.load(), kFrames);
+
+    // 窗口是一个分块（64KB），已经交给 I/O 线程、还没有追加到发送缓冲区的消息最多再多一个窗口
+    EXPECT_TRUE(pService->m_peakOutput.load() <= 2 * (64 * 1024 + kFrameBytes + 64));
+    EXPECT_TRUE(pService->m_peakOutput.load() < RPCMemoryBudget::GetInstance()->ConnectionLimit());
+}
+
+int main()
+{
+    uint16_t port = FreePort();
+    std::string path = WriteTempConfig("rpcAddr = 127.0.0.1\n"
+                                       "rpcPort = " + std::to_string(port) + "\n"
+                                       "registry = static\n"
+                                       "statsService = off\n"
+                                       "chunkSize = 64\n"
+                                       "maxConnectionMemoryMB = 1\n"
+                                       "streamWriteTimeoutMs = 10000\n"
+                                       "drainDelayMs = 0\n"
+                                       "drainTimeoutMs = 1000\n");
+    char prog[] = "RPCStreamTest";
+    char option[] = "-i";
+    char* argv[] = {prog, option, &path[0], nullptr};
+    RPCApplication::Init(3, argv);
+    unlink(path.c_str());
+
+    StreamingService service;
+    RPCProvider provider;
+    provider.NotifyService(&service);
+    std::thread server([&provider]() { provider.Run(); });
+    if (!WaitForListen(port))
+    {
+        std::fprintf(stderr, "provider failed to listen on %u\n", port);
+        std::exit(1);
+    }
+
+    TestStreamLargerThanConnectionLimit(port, &service);
+
+    provider.Shutdown();
+    server.join();
+    return UNIT_TEST_RESULT();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+/**
+ * 单元测试用的断言，不依赖测试框架
+ *
+ * 断言失败时打印文件、行号和表达式并计数，不中断后面的检查。
+ * 每个测试程序的 main 最后返回 UNIT_TEST_RESULT()，有失败时返回非 0，由 ctest 判断结果。
+ */
+static int g_unitTestFailures = 0;
+
+#define EXPECT_TRUE(cond)                                                                  \
+    do                                                                                     \
+    {                                                                                      \
+        if (!(cond))                                                                       \
+        {                                                                                  \
+            std::fprintf(stderr, "%s:%d: EXPECT_TRUE(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++g_unitTestFailures;                                                          \
+        }                                                                                  \
+    } while (0)
+
+#define EXPECT_FALSE(cond) EXPECT_TRUE(!(cond))
+
+#define EXPECT_EQ(a, b)                                                                    \
+    do                                                                                     \
+    {                                                                                      \
+        if (!((a) == (b)))                                                                 \
+        {                                                                                  \
+            std::fprintf(stderr, "%s:%d: EXPECT_EQ(%s, %s) failed\n", __FILE__, __LINE__, #a, #b); \
+            ++g_unitTestFailures;                                                          \
+        }                                                                                  \
+    } while (0)
+
+#define UNIT_TEST_RESULT()                                                                 \
+    (std::printf("%s: %d failure(s)\n", __FILE__, g_unitTestFailures), g_unitTestFailures == 0 ? 0 : 1)
+
+// 把 content 写进一个临时的配置文件，返回文件路径。调用方读取之后用 unlink 删除
+inline std::string WriteTempConfig(const std::string& content)
+{
+    char path[] = "/tmp/myrpc_unit_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, content.data(), content.size()) != static_cast<ssize_t>(content.size()))
+    {
+        std::fprintf(stderr, "write temp config failed\n");
+        std::exit(1);
+    }
+    close(fd);
+    return path;
+}